@@ -1,4 +1,7 @@
 ﻿#include "graphicsmap.h"
+#include "mapprojection.h"
+#include "mapobjectitem.h"
+#include "mapimagewriter.h"
 #include <QScrollBar>
 #include <QOpenGLWidget>
 #include <QHBoxLayout>
@@ -9,17 +12,293 @@
 #include <QThread>
 #include <QFileInfo>
 #include <QtMath>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMap>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
 
-#define ZOOM_BASE 10  ///< ZOOM_BASE级瓦片正好缩放为原比例(1:1),低于ZOOM_BASE级的放大，反之缩小
-#define TILE_LEN 256  ///< 瓦片长度，标准的都是256 * 256
-#define SCENE_LEN ((1<<ZOOM_BASE) * TILE_LEN)   ///< 存放瓦片的场景大小
+#define ZOOM_BASE MapScene::ZoomBase  ///< ZOOM_BASE级时场景正好缩放为原比例(1:1),低于ZOOM_BASE级的放大，反之缩小
+#define SCENE_LEN MapScene::Length     ///< 场景宽度，瓦片方案的投影和瓦片划分都基于该宽度
+#define ZOOM_ANIMATION_MS 180   ///< 平滑缩放动画时长
+#define ZOOM_SETTLE_MS 150      ///< 平滑缩放停止多久之后才加载瓦片
+#define TILE_BUFFER_MARGIN 128  ///< 瓦片层缓冲区在视口四周多出的像素
+#define EXPORT_MAX_ZOOM 22      ///< 导出图片支持的最大瓦片层级
+#define EXPORT_MAX_LENGTH 65500 ///< 导出图片的最大边长，JPEG格式的限制
+#define EXPORT_STRIP_WINDOW 4   ///< 同时在内存中的条带数，决定导出的内存峰值
+#define PROJECTION_CHUNK 256    ///< 批量投影时每次从QGeoCoordinate中取出的点数
+#define DEFER_MARGIN 64         ///< 视图外延迟更新的对象在进入视口前多少像素开始应用更新
 
 QStringList GraphicsMap::m_mapTypes;    ///< 地图资源类型
+QAtomicInt GraphicsMap::m_sceneScheme(WebMercator256);  ///< 静态坐标转换函数使用的瓦片方案
+QSet<GraphicsMap*> GraphicsMap::m_maps;
+
+/// 是否为等经纬度投影
+static bool isGeographic(MapScheme scheme)
+{
+    return mapSchemeDispatch(scheme, [](auto s) {
+        return std::is_same<typename decltype(s)::Projection, MapEquirectangular>::value;
+    });
+}
+
+/// 在线程池中执行函数
+class GraphicsMapTask : public QRunnable
+{
+public:
+    explicit GraphicsMapTask(const std::function<void()> &func) : m_func(func) {}
+    virtual void run() override { m_func(); }
+
+private:
+    std::function<void()> m_func;
+};
+
+/*!
+ * \brief 地图导出任务
+ * \details 导出图像按瓦片行划分为条带，每个条带的瓦片只加载一次：
+ * 1.瓦片在线程池中加载并绘制到条带图像中，缺失的瓦片使用上层瓦片的对应部分代替
+ * 2.条带回到界面线程后叠加场景图元，转换为RGB888格式，按从上到下的顺序交给编码线程
+ * 3.编码线程通过MapImageWriter逐行编码写入文件，写完一个条带才开始绘制下一个条带
+ * \note 结果图像不在内存中拼接，同时存在的条带不超过EXPORT_STRIP_WINDOW个，内存峰值与图像高度无关
+ */
+class GraphicsMapExporter : public QObject
+{
+public:
+    GraphicsMapExporter(GraphicsMap *map, const QString &fileName, const QRectF &sceneRect, int zoom, int dpi, bool withItems) :
+        QObject(map),
+        m_map(map),
+        m_fileName(fileName),
+        m_zoom(zoom),
+        m_dpi(dpi),
+        m_scale(dpi / 96.0),
+        m_withItems(withItems),
+        m_finishedCount(0),
+        m_nextRender(0),
+        m_nextWrite(0),
+        m_finished(false)
+    {
+        // the strips must be encoded in order
+        m_encoder.setMaxThreadCount(1);
+        m_path = map->m_type > 0 ? GraphicsMap::m_mapTypes.value(map->m_type-1) : QString();
+        m_type = map->m_type;
+        m_tms = map->m_bTMS;
+        m_filter = map->m_tileFilters.value(map->m_type);
+        m_background = map->backgroundBrush().style() == Qt::NoBrush ? QColor(Qt::white) : map->backgroundBrush().color();
+        m_scheme = map->m_scheme;
+        mapSchemeDispatch(m_scheme, [&](auto scheme) {
+            typedef decltype(scheme) Scheme;
+            m_tileLength = Scheme::Tiling::TileLength;
+            m_sceneTileLength = Scheme::Tiling::sceneTileLength(zoom);
+            m_sceneOrigin = Scheme::sceneRect().topLeft();
+            m_columns = Scheme::Tiling::columns(zoom);
+            m_rows = Scheme::rows(zoom);
+        });
+        // scene -> tile pixel of the export zoom
+        auto factor = m_tileLength / m_sceneTileLength;
+        m_pixelRect = QRectF((sceneRect.topLeft() - m_sceneOrigin) * factor, (sceneRect.bottomRight() - m_sceneOrigin) * factor);
+        m_firstRow = qFloor(m_pixelRect.top() / m_tileLength);
+        m_rowCount = qCeil(m_pixelRect.bottom() / m_tileLength) - m_firstRow;
+    }
+    ~GraphicsMapExporter()
+    {
+        m_pool.waitForDone();
+        m_encoder.waitForDone();
+    }
+
+    bool start()
+    {
+        const qint64 width = qCeil(m_pixelRect.width() * m_scale);
+        const qint64 height = qCeil(m_pixelRect.height() * m_scale);
+        if(width <= 0 || height <= 0 || m_rowCount <= 0)
+            return false;
+        // strips are streamed to the file, only the format limits the size
+        if(width > EXPORT_MAX_LENGTH || height > EXPORT_MAX_LENGTH) {
+            qWarning() << "GraphicsMap export refused:" << width << "x" << height << "exceeds" << EXPORT_MAX_LENGTH << "pixels";
+            return false;
+        }
+        m_size = QSize(int(width), int(height));
+        if(!m_writer.open(m_fileName, m_size, m_dpi)) {
+            qWarning() << "GraphicsMap export failed:" << m_writer.errorString();
+            return false;
+        }
+        //
+        while(m_nextRender < qMin(EXPORT_STRIP_WINDOW, m_rowCount)) {
+            renderStrip(m_nextRender++);
+        }
+        return true;
+    }
+
+private:
+    void renderStrip(int row)
+    {
+        m_pool.start(new GraphicsMapTask([this, row](){
+            auto strip = renderTiles(row);
+            QMetaObject::invokeMethod(this, [this, row, strip](){ onStripRendered(row, strip); }, Qt::QueuedConnection);
+        }));
+    }
+
+    /// 条带在结果图像中的范围
+    QRect stripRect(int row) const
+    {
+        int top = qMax(0, qRound(((m_firstRow + row) * m_tileLength - m_pixelRect.top()) * m_scale));
+        int bottom = qMin(m_size.height(), qRound(((m_firstRow + row + 1) * m_tileLength - m_pixelRect.top()) * m_scale));
+        return QRect(0, top, m_size.width(), bottom - top);
+    }
+
+    /// 在线程池中绘制一行瓦片
+    QImage renderTiles(int row) const
+    {
+        auto rect = stripRect(row);
+        QImage strip(rect.size(), QImage::Format_ARGB32_Premultiplied);
+        strip.fill(m_background);
+        if(m_path.isEmpty() || strip.isNull())
+            return strip;
+
+        QPainter painter(&strip);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform, !qFuzzyCompare(m_scale, 1.0));
+        painter.translate(0, -rect.top());
+        const quint32 y = m_firstRow + row;
+        if(y >= m_rows)
+            return strip;
+        const qint64 xMin = qMax<qint64>(0, qFloor(m_pixelRect.left() / m_tileLength));
+        const qint64 xMax = qMin<qint64>(m_columns, qCeil(m_pixelRect.right() / m_tileLength));
+        for(qint64 x = xMin; x < xMax; ++x) {
+            GraphicsMap::TileSpec tileSpec{m_type, static_cast<quint8>(m_zoom), static_cast<quint32>(x), y};
+            QRectF source(0, 0, m_tileLength, m_tileLength);
+            auto image = GraphicsMapThread::loadTileImage(m_path, m_scheme, tileSpec, m_tms, m_filter);
+            // use the corresponding part of the upper tile instead
+            while(image.isNull() && tileSpec.zoom > 0) {
+                source = QRectF((tileSpec.x % 2) * m_tileLength/2 + source.x()/2, (tileSpec.y % 2) * m_tileLength/2 + source.y()/2,
+                                source.width()/2, source.height()/2);
+                tileSpec = tileSpec.rise();
+                image = GraphicsMapThread::loadTileImage(m_path, m_scheme, tileSpec, m_tms, m_filter);
+            }
+            if(image.isNull())
+                continue;
+            QRectF target((x * m_tileLength - m_pixelRect.left()) * m_scale, (y * m_tileLength - m_pixelRect.top()) * m_scale,
+                          m_tileLength * m_scale, m_tileLength * m_scale);
+            painter.drawImage(target, image, source);
+        }
+        return strip;
+    }
+
+    /// 在界面线程中叠加图元，并按顺序交给编码线程
+    void onStripRendered(int row, QImage strip)
+    {
+        if(m_finished)
+            return;
+        auto rect = stripRect(row);
+        if(m_withItems && !rect.isEmpty()) {
+            // output pixel -> scene
+            auto factor = m_sceneTileLength / m_tileLength;
+            auto toScene = [&](qreal x, qreal y) {
+                return QPointF(m_pixelRect.left() + x / m_scale, m_pixelRect.top() + y / m_scale) * factor + m_sceneOrigin;
+            };
+            QRectF sceneRect(toScene(0, rect.top()), toScene(rect.width(), rect.bottom() + 1));
+            // tiles have been drawn, just render the other items
+            for(auto tile : qAsConst(m_map->m_tiles)) {
+                tile->setVisible(false);
+            }
+            QPainter painter(&strip);
+            painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing | QPainter::SmoothPixmapTransform);
+            m_map->scene()->render(&painter, QRectF(0, 0, rect.width(), rect.height()), sceneRect, Qt::IgnoreAspectRatio);
+            painter.end();
+            for(auto tile : qAsConst(m_map->m_tiles)) {
+                tile->setVisible(m_map->tileItemsVisible());
+            }
+        }
+        // NOTE: the strip is opaque, so converting to RGB888 drops nothing
+        m_pending.insert(row, strip.convertToFormat(QImage::Format_RGB888));
+        strip = QImage();
+        // the encoder only accepts the rows from top to bottom
+        while(!m_pending.isEmpty() && m_pending.firstKey() == m_nextWrite) {
+            auto rows = m_pending.take(m_nextWrite++);
+            m_encoder.start(new GraphicsMapTask([this, rows](){
+                bool ok = m_writer.write(rows);
+                auto error = ok ? QString() : m_writer.errorString();
+                QMetaObject::invokeMethod(this, [this, ok, error](){ onStripWritten(ok, error); }, Qt::QueuedConnection);
+            }));
+        }
+    }
+
+    /// 条带写入文件后释放，开始绘制下一个条带
+    void onStripWritten(bool ok, const QString &error)
+    {
+        if(m_finished)
+            return;
+        if(!ok) {
+            qWarning() << "GraphicsMap export failed:" << error;
+            finish(false);
+            return;
+        }
+        ++m_finishedCount;
+        emit m_map->exportProgress(m_finishedCount, m_rowCount);
+        if(m_nextRender < m_rowCount)
+            renderStrip(m_nextRender++);
+        if(m_finishedCount < m_rowCount)
+            return;
+        m_encoder.start(new GraphicsMapTask([this](){
+            bool ok = m_writer.close();
+            if(!ok)
+                qWarning() << "GraphicsMap export failed:" << m_writer.errorString();
+            QMetaObject::invokeMethod(this, [this, ok](){ finish(ok); }, Qt::QueuedConnection);
+        }));
+    }
+
+    /// 结束导出，失败时未完成的文件在析构时删除
+    void finish(bool ok)
+    {
+        m_finished = true;
+        m_pending.clear();
+        m_map->m_exporter = nullptr;
+        emit m_map->exportFinished(m_fileName, ok);
+        this->deleteLater();
+    }
+
+private:
+    GraphicsMap   *m_map;
+    QThreadPool    m_pool;          ///< 导出专用线程池，析构时可以等待所有任务结束
+    QString        m_fileName;
+    QString        m_path;          ///< 瓦片路径
+    quint8         m_type;          ///< 瓦片类型
+    bool           m_tms;           ///< 是否为TMS瓦片协议
+    MapColorFilter m_filter;        ///< 瓦片颜色滤镜
+    QColor         m_background;    ///< 缺失瓦片处的背景色
+    MapScheme      m_scheme;        ///< 瓦片方案
+    int            m_tileLength;    ///< 瓦片像素长度
+    double         m_sceneTileLength;   ///< 导出层级的瓦片在场景中的边长
+    QPointF        m_sceneOrigin;   ///< 瓦片矩阵左上角的场景坐标
+    quint32        m_columns;       ///< 导出层级的瓦片列数
+    quint32        m_rows;          ///< 导出层级的瓦片行数
+    QRectF         m_pixelRect;     ///< 导出范围，单位为导出层级下的瓦片像素
+    int            m_zoom;
+    int            m_dpi;
+    qreal          m_scale;         ///< 瓦片像素到输出像素的缩放比例
+    bool           m_withItems;
+    int            m_firstRow;      ///< 第一个条带对应的瓦片行号
+    int            m_rowCount;      ///< 条带数量
+    int            m_finishedCount; ///< 已写入文件的条带数量
+    int            m_nextRender;    ///< 下一个开始绘制的条带
+    int            m_nextWrite;     ///< 下一个交给编码线程的条带
+    bool           m_finished;      ///< 已经发出exportFinished，等待删除
+    QSize          m_size;          ///< 导出图像大小，线程池中只读取该值
+    QMap<int, QImage> m_pending;    ///< 已绘制完成、等待前面条带的条带
+    QThreadPool    m_encoder;       ///< 单线程的编码线程池，按顺序写入条带
+    MapImageWriter m_writer;        ///< 逐行写入文件
+};
 
 GraphicsMap::GraphicsMap(QWidget *parent) : QGraphicsView(parent),
+    m_exporter(nullptr),
     m_type(0),
+    m_scheme(WebMercator256),
     m_isloading(false),
     m_hasPendingLoad(false),
+    m_smoothZoom(false),
+    m_zoomSettling(false),
+    m_tileBufferEnabled(false),
+    m_bTMS(false),
     m_zoom(1),
     m_minZoom(1),
     m_maxZoom(20),
@@ -28,16 +307,27 @@ GraphicsMap::GraphicsMap(QWidget *parent) : QGraphicsView(parent),
     this->setScene(new QGraphicsScene);
     qRegisterMetaType<GraphicsMap::TileSpec>("GraphicsMap::TileSpec");
     qRegisterMetaType<GraphicsMap::TileRegion>("GraphicsMap::TileRegion");
+    qRegisterMetaType<MapColorFilter>("MapColorFilter");
+    qRegisterMetaType<MapScheme>("MapScheme");
     viewport()->setObjectName("GraphicsMap");
 
     init();
     //
-    this->scene()->setSceneRect(-SCENE_LEN/2, -SCENE_LEN/2, SCENE_LEN, SCENE_LEN);
+    this->scene()->setSceneRect(MapTileScheme<MapWebMercator, MapTiling<256, 1>>::sceneRect());
+    // follow the scheme of the existing maps, the projection is shared by all of them
+    if(m_maps.isEmpty())
+        m_sceneScheme.store(WebMercator256);
+    m_maps.insert(this);
+    setTileScheme(sceneScheme());
     setZoomLevel(2);
 }
 
 GraphicsMap::~GraphicsMap()
 {
+    // wait for the running export, it refers to the scene
+    delete m_exporter;
+    m_maps.remove(this);
+    MapObjectItem::updateViewport(scene(), this, QRectF());
     // 在此处从场景移出瓦片，防止和多线程析构冲突
     for(auto item : qAsConst(m_tiles)) {
         this->scene()->removeItem(item);
@@ -50,11 +340,14 @@ void GraphicsMap::setFrameRate(int fps)
 {
     if(fps <= 0) {
         this->setViewportUpdateMode(QGraphicsView::SmartViewportUpdate);
+        disconnect(&m_updateTimer, &QTimer::timeout, this, &GraphicsMap::advanceFrame);
         disconnect(&m_updateTimer, &QTimer::timeout, viewport(), qOverload<>(&QGraphicsView::update));
         m_updateTimer.stop();
     }
     else {
         this->setViewportUpdateMode(QGraphicsView::NoViewportUpdate);
+        // slots are called in the order of connection, so the objects are moved before the update
+        connect(&m_updateTimer, &QTimer::timeout, this, &GraphicsMap::advanceFrame, Qt::ConnectionType(Qt::DirectConnection|Qt::UniqueConnection));
         connect(&m_updateTimer, &QTimer::timeout, viewport(), qOverload<>(&QGraphicsView::update), Qt::ConnectionType(Qt::DirectConnection|Qt::UniqueConnection));
         m_updateTimer.start(1000/fps);
     }
@@ -67,6 +360,58 @@ void GraphicsMap::setTilePath(const QString &path)
     updateTile();
 }
 
+bool GraphicsMap::setTileScheme(MapScheme scheme)
+{
+    if(m_scheme == scheme)
+        return true;
+    for(auto map : qAsConst(m_maps)) {
+        if(map != this && isGeographic(map->m_scheme) != isGeographic(scheme)) {
+            qWarning() << "GraphicsMap: the tile scheme conflicts with the projection of another map";
+            return false;
+        }
+    }
+    m_scheme = scheme;
+    m_sceneScheme.store(scheme);
+    this->scene()->setSceneRect(mapSchemeDispatch(scheme, [](auto s) { return decltype(s)::sceneRect(); }));
+    emit schemeRequested(scheme);
+    // force to request the same region again, all the tiles are reloaded by the new scheme
+    m_tileRegion = TileRegion{};
+    if(m_isloading)
+        m_hasPendingLoad = true;
+    else
+        updateTile();
+    return true;
+}
+
+MapScheme GraphicsMap::tileScheme() const
+{
+    return m_scheme;
+}
+
+void GraphicsMap::setTileFilter(const QString &path, const MapColorFilter &filter)
+{
+    auto type = mapType(path);
+    if(m_tileFilters.value(type) == filter)
+        return;
+    if(filter.isIdentity())
+        m_tileFilters.remove(type);
+    else
+        m_tileFilters.insert(type, filter);
+    emit filterRequested(type, filter);
+    // force to request the same region again, so that the discarded tiles will be reloaded
+    m_tileRegion = TileRegion{};
+    if(m_isloading)
+        m_hasPendingLoad = true;
+    else
+        updateTile();
+}
+
+MapColorFilter GraphicsMap::tileFilter(const QString &path) const
+{
+    auto type = static_cast<quint8>(m_mapTypes.indexOf(path)+1);
+    return m_tileFilters.value(type);
+}
+
 void GraphicsMap::setZoomLevel(float zoom)
 {
     auto boundZoom = qBound(m_minZoom, zoom, m_maxZoom);
@@ -90,6 +435,68 @@ const float &GraphicsMap::zoomLevel() const
     return m_zoom;
 }
 
+void GraphicsMap::setSmoothZoom(bool on)
+{
+    if(m_smoothZoom == on)
+        return;
+    m_smoothZoom = on;
+    // finish the running gesture immediately
+    if(!on) {
+        m_zoomAnimation.stop();
+        m_zoomSettleTimer.stop();
+        if(m_zoomSettling)
+            onZoomSettled();
+    }
+}
+
+bool GraphicsMap::isSmoothZoom() const
+{
+    return m_smoothZoom;
+}
+
+void GraphicsMap::zoomTo(float zoom)
+{
+    if(!m_smoothZoom) {
+        setZoomLevel(zoom);
+        return;
+    }
+    auto boundZoom = qBound(m_minZoom, zoom, m_maxZoom);
+    if(boundZoom == zoomTarget())
+        return;
+
+    beginZoomSnapshot();
+    // restart from current zoom so that continuous wheel steps accumulate smoothly
+    m_zoomAnimation.stop();
+    m_zoomAnimation.setStartValue(m_zoom);
+    m_zoomAnimation.setEndValue(boundZoom);
+    m_zoomAnimation.start();
+}
+
+float GraphicsMap::zoomTarget() const
+{
+    if(m_zoomAnimation.state() == QAbstractAnimation::Running)
+        return m_zoomAnimation.endValue().toFloat();
+    return m_zoom;
+}
+
+void GraphicsMap::setTileBufferEnabled(bool on)
+{
+    if(m_tileBufferEnabled == on)
+        return;
+    m_tileBufferEnabled = on;
+    m_tileBuffer = QPixmap();
+    m_tileBufferDirty = QRegion();
+    for(auto tile : qAsConst(m_tiles)) {
+        tile->setVisible(tileItemsVisible());
+    }
+    viewport()->update();
+}
+
+bool GraphicsMap::isTileBufferEnabled() const
+{
+    return m_tileBufferEnabled;
+}
+
 void GraphicsMap::setZoomRange(int min, int max)
 {
     if(min > max)
@@ -116,6 +523,7 @@ void GraphicsMap::setTileCacheCount(const int &count)
 
 void GraphicsMap::setTMSMode(const bool &on)
 {
+    m_bTMS = on;
     m_mapThread->setTMSMode(on);
 }
 
@@ -137,27 +545,113 @@ QPoint GraphicsMap::toPoint(const QGeoCoordinate &coord) const
     return this->mapFromScene(scenePos);
 }
 
-/// \see https://blog.csdn.net/iispring/article/details/8565177
-/// R = SCENE_LEN / 2PI
+bool GraphicsMap::exportImage(const QString &fileName, const QGeoRectangle &rect, int zoom, int dpi, bool withItems)
+{
+    if(m_exporter || !rect.isValid() || zoom < 0 || zoom > EXPORT_MAX_ZOOM || dpi <= 0)
+        return false;
+    QRectF sceneRect(toScene(rect.topLeft()), toScene(rect.bottomRight()));
+    // the exported area is not limited to the viewport
+    if(withItems)
+        MapObjectItem::flushAll();
+    auto exporter = new GraphicsMapExporter(this, fileName, sceneRect, zoom, dpi, withItems);
+    if(!exporter->start()) {
+        delete exporter;
+        return false;
+    }
+    m_exporter = exporter;
+    return true;
+}
+
+bool GraphicsMap::isExporting() const
+{
+    return m_exporter != nullptr;
+}
+
+/// \see MapWebMercator MapEquirectangular
 QGeoCoordinate GraphicsMap::toCoordinate(const QPointF &point)
 {
-    auto radLon = point.x() * 2 * M_PI/ SCENE_LEN;
-    auto radLat = 2 * qAtan(qPow(M_E, 2*M_PI*point.y()/SCENE_LEN)) - M_PI_2;
-    // NOTO: as for Qt, it's y asscending from up to bottom
-    return  {qRadiansToDegrees(-radLat), qRadiansToDegrees(radLon), 0};
+    double lat, lon;
+    mapSchemeDispatch(sceneScheme(), [&](auto scheme) {
+        decltype(scheme)::Projection::toCoordinate(point, lat, lon);
+    });
+    return {lat, lon, 0};
+}
+
+MapCoordinate GraphicsMap::toMapCoordinate(const QPointF &point)
+{
+    MapCoordinate coord;
+    mapSchemeDispatch(sceneScheme(), [&](auto scheme) {
+        decltype(scheme)::Projection::toCoordinate(point, coord.latitude, coord.longitude);
+    });
+    return coord;
 }
 
-/// \see https://blog.csdn.net/iispring/article/details/8565177
-/// R = SCENE_LEN / 2PI
+/// \see MapWebMercator MapEquirectangular
 QPointF GraphicsMap::toScene(const QGeoCoordinate &coord)
 {
-    /// NOTE: R = SCENE_LEN / 2PI
-    double radLon = qDegreesToRadians(coord.longitude());
-    double radLat = qDegreesToRadians(coord.latitude());
-    double x = SCENE_LEN * radLon / 2.0 / M_PI;
-    double y = SCENE_LEN / 2.0 / M_PI * qLn( qTan(M_PI_4+radLat/2.0) );
-    // NOTO: as for Qt, it's y asscending from up to bottom
-    return {x, -y};
+    return mapSchemeDispatch(sceneScheme(), [&](auto scheme) {
+        return decltype(scheme)::Projection::toScene(coord.latitude(), coord.longitude());
+    });
+}
+
+void GraphicsMap::toScene(const double *lat, const double *lon, QPointF *points, int count)
+{
+    mapSchemeDispatch(sceneScheme(), [&](auto scheme) {
+        decltype(scheme)::Projection::toScene(lat, lon, points, count);
+    });
+}
+
+QVector<QPointF> GraphicsMap::toScene(const QVector<QGeoCoordinate> &coords)
+{
+    QVector<QPointF> points(coords.size());
+    // QGeoCoordinate is implicitly shared, so copy them into plain arrays chunk by chunk
+    double lat[PROJECTION_CHUNK];
+    double lon[PROJECTION_CHUNK];
+    for(int begin = 0; begin < coords.size(); begin += PROJECTION_CHUNK) {
+        int count = qMin(PROJECTION_CHUNK, coords.size() - begin);
+        for(int i = 0; i < count; ++i) {
+            const auto &coord = coords.at(begin + i);
+            lat[i] = coord.latitude();
+            lon[i] = coord.longitude();
+        }
+        toScene(lat, lon, points.data() + begin, count);
+    }
+    return points;
+}
+
+QPointF GraphicsMap::toScene(const MapCoordinate &coord)
+{
+    return mapSchemeDispatch(sceneScheme(), [&](auto scheme) {
+        return decltype(scheme)::Projection::toScene(coord.latitude, coord.longitude);
+    });
+}
+
+QVector<QPointF> GraphicsMap::toScene(const QVector<MapCoordinate> &coords)
+{
+    QVector<QPointF> points(coords.size());
+    double lat[PROJECTION_CHUNK];
+    double lon[PROJECTION_CHUNK];
+    for(int begin = 0; begin < coords.size(); begin += PROJECTION_CHUNK) {
+        int count = qMin(PROJECTION_CHUNK, coords.size() - begin);
+        const MapCoordinate *chunk = coords.constData() + begin;
+        for(int i = 0; i < count; ++i) {
+            lat[i] = chunk[i].latitude;
+            lon[i] = chunk[i].longitude;
+        }
+        toScene(lat, lon, points.data() + begin, count);
+    }
+    return points;
+}
+
+GraphicsMap *GraphicsMap::fromScene(const QGraphicsScene *scene)
+{
+    if(!scene)
+        return nullptr;
+    for(auto view : scene->views()) {
+        if(auto map = qobject_cast<GraphicsMap*>(view))
+            return map;
+    }
+    return nullptr;
 }
 
 /// 从1编号
@@ -189,27 +683,92 @@ void GraphicsMap::resizeEvent(QResizeEvent *event)
     QGraphicsView::resizeEvent(event);
 }
 
+void GraphicsMap::advanceFrame()
+{
+    MapObjectItem::advanceMotion(scene());
+    updateDeferRect();
+}
+
+void GraphicsMap::updateDeferRect()
+{
+    const auto viewRect = viewport()->rect().adjusted(-DEFER_MARGIN, -DEFER_MARGIN, DEFER_MARGIN, DEFER_MARGIN);
+    const auto rect = mapToScene(viewRect).boundingRect();
+    if(rect == m_deferRect)
+        return;
+    m_deferRect = rect;
+    MapObjectItem::updateViewport(scene(), this, rect);
+}
+
+void GraphicsMap::drawBackground(QPainter *painter, const QRectF &rect)
+{
+    // flushing moves items, so it is never done while painting; the margin hides the one frame of delay
+    const auto viewRect = viewport()->rect().adjusted(-DEFER_MARGIN, -DEFER_MARGIN, DEFER_MARGIN, DEFER_MARGIN);
+    if(mapToScene(viewRect).boundingRect() != m_deferRect)
+        QMetaObject::invokeMethod(this, [this]() { updateDeferRect(); }, Qt::QueuedConnection);
+    QGraphicsView::drawBackground(painter, rect);
+    if(!m_zoomSnapshot.isNull()) {
+        // map snapshot pixel to scene by the transform when it was taken, and then to current viewport
+        painter->save();
+        painter->setRenderHint(QPainter::SmoothPixmapTransform, true);
+        painter->setWorldTransform(m_snapshotTransform.inverted() * painter->worldTransform());
+        painter->drawPixmap(0, 0, m_zoomSnapshot);
+        painter->restore();
+    }
+    else if(m_tileBufferEnabled) {
+        updateTileBuffer();
+        painter->save();
+        painter->setWorldTransform(QTransform());
+        painter->drawPixmap(-TILE_BUFFER_MARGIN, -TILE_BUFFER_MARGIN, m_tileBuffer);
+        painter->restore();
+    }
+}
+
 void GraphicsMap::init()
 {
+    m_zoomAnimation.setDuration(ZOOM_ANIMATION_MS);
+    m_zoomAnimation.setEasingCurve(QEasingCurve::OutCubic);
+    connect(&m_zoomAnimation, &QVariantAnimation::valueChanged, this, [&](const QVariant &value){
+        setZoomLevel(value.toFloat());
+    });
+    m_zoomSettleTimer.setSingleShot(true);
+    m_zoomSettleTimer.setInterval(ZOOM_SETTLE_MS);
+    connect(&m_zoomSettleTimer, &QTimer::timeout, this, &GraphicsMap::onZoomSettled);
+    //
     m_mapThread = new GraphicsMapThread;
     // connect those necessary slot for map tile loading
     connect(this, &GraphicsMap::tileRequested, m_mapThread, &GraphicsMapThread::requestTile, Qt::QueuedConnection);
     connect(this, &GraphicsMap::pathRequested, m_mapThread, &GraphicsMapThread::requestPath, Qt::QueuedConnection);
+    connect(this, &GraphicsMap::filterRequested, m_mapThread, &GraphicsMapThread::requestFilter, Qt::QueuedConnection);
+    connect(this, &GraphicsMap::schemeRequested, m_mapThread, &GraphicsMapThread::requestScheme, Qt::QueuedConnection);
     //
     connect(m_mapThread, &GraphicsMapThread::tileToAdd, this, [&](QGraphicsItem* item){
+        // tiles are painted by snapshot during smooth zooming, or by the tile buffer
+        item->setVisible(tileItemsVisible());
         this->scene()->addItem(item);
         m_tiles.insert(item);
+        invalidateTileBuffer(item);
     }, Qt::QueuedConnection);
     connect(m_mapThread, &GraphicsMapThread::tileToRemove, this, [&](QGraphicsItem* item){
         this->scene()->removeItem(item);
         m_tiles.remove(item);
+        invalidateTileBuffer(item);
+    }, Qt::QueuedConnection);
+    connect(m_mapThread, &GraphicsMapThread::tileToDelete, this, [&](QGraphicsItem* item){
+        if(m_tiles.remove(item)) {
+            this->scene()->removeItem(item);
+            invalidateTileBuffer(item);
+        }
+        delete item;
     }, Qt::QueuedConnection);
     connect(m_mapThread, &GraphicsMapThread::requestFinished, this, [&](){
         m_isloading = false;
         if(m_hasPendingLoad) {
-            updateTile();
             m_hasPendingLoad = false;
+            updateTile();
         }
+        // the tiles of final zoom level are ready
+        if(!m_isloading && !m_zoomSettling)
+            endZoomSnapshot();
     }, Qt::QueuedConnection);
     // TODO: We have to use Qt::QueuedConnection, if not, we will see the map twinkle when scale
     connect(this->horizontalScrollBar(), &QScrollBar::valueChanged, this, [&](){
@@ -228,28 +787,215 @@ void GraphicsMap::init()
 
 void GraphicsMap::updateTile()
 {
-    quint8 intZoom = qFloor(m_zoom+0.5);
-    //
-    qint32 tileCount = qPow(2, intZoom);
-    auto topLeftPos = mapToScene(viewport()->geometry().topLeft()-QPoint(256,256));
-    auto topRightPos = mapToScene(viewport()->geometry().topRight());
-    auto bottomLeftPos = mapToScene(viewport()->geometry().bottomLeft());
-    qint32 xOrigin = (topLeftPos.x()+SCENE_LEN/2) / SCENE_LEN * tileCount;
-    qint32 yOrigin = (topLeftPos.y()+SCENE_LEN/2) / SCENE_LEN * tileCount;
-    qint32 xHor = (topRightPos.x()+SCENE_LEN/2) / SCENE_LEN * tileCount;
-    qint32 yHor = (topRightPos.y()+SCENE_LEN/2) / SCENE_LEN * tileCount;
-    qint32 xVer = (bottomLeftPos.x()+SCENE_LEN/2) / SCENE_LEN * tileCount;
-    qint32 yVer = (bottomLeftPos.y()+SCENE_LEN/2) / SCENE_LEN * tileCount;
-    auto horCount = QVector2D(xOrigin, yOrigin).distanceToPoint(QVector2D(xHor, yHor));
-    auto verCount = QVector2D(xOrigin, yOrigin).distanceToPoint(QVector2D(xVer, yVer));
-    TileSpec origin{m_type, intZoom, static_cast<quint32>(xOrigin), static_cast<quint32>(yOrigin)};
-    TileRegion region{origin, m_rotation, static_cast<quint8>(horCount+2), static_cast<quint8>(verCount+2)};
-    //
-    if(m_tileRegion == region || xOrigin < 0 || xOrigin >= tileCount)
+    // intermediate zoom levels of a smooth zooming are useless, just wait for it to settle
+    if(m_zoomSettling) {
+        m_zoomSettleTimer.start();
         return;
-    m_tileRegion = region;
-    m_isloading = true;
-    emit tileRequested(m_tileRegion);
+    }
+    mapSchemeDispatch(m_scheme, [&](auto scheme) {
+        typedef decltype(scheme) Scheme;
+        quint8 intZoom = Scheme::tileZoom(m_zoom);
+        //
+        const qint32 tileCount = Scheme::Tiling::columns(intZoom);
+        const int tileLen = Scheme::Tiling::TileLength;
+        auto topLeftPos = mapToScene(viewport()->geometry().topLeft()-QPoint(tileLen, tileLen));
+        auto topRightPos = mapToScene(viewport()->geometry().topRight());
+        auto bottomLeftPos = mapToScene(viewport()->geometry().bottomLeft());
+        auto originTile = Scheme::tileAt(topLeftPos, intZoom);
+        auto horTile = Scheme::tileAt(topRightPos, intZoom);
+        auto verTile = Scheme::tileAt(bottomLeftPos, intZoom);
+        qint32 xOrigin = originTile.x();
+        qint32 yOrigin = originTile.y();
+        qint32 xHor = horTile.x();
+        qint32 yHor = horTile.y();
+        qint32 xVer = verTile.x();
+        qint32 yVer = verTile.y();
+        auto horCount = QVector2D(xOrigin, yOrigin).distanceToPoint(QVector2D(xHor, yHor));
+        auto verCount = QVector2D(xOrigin, yOrigin).distanceToPoint(QVector2D(xVer, yVer));
+        TileSpec origin{m_type, intZoom, static_cast<quint32>(xOrigin), static_cast<quint32>(yOrigin)};
+        TileRegion region{origin, m_rotation, static_cast<quint8>(horCount+2), static_cast<quint8>(verCount+2)};
+        //
+        if(m_tileRegion == region || xOrigin < 0 || xOrigin >= tileCount)
+            return;
+        m_tileRegion = region;
+        m_isloading = true;
+        emit tileRequested(m_tileRegion);
+    });
+}
+
+void GraphicsMap::drawTiles(QPainter *painter, const QTransform &viewTransform, const QRectF &sceneRect)
+{
+    // lower zoom tiles are the fallback of missing tiles, so paint them first
+    auto tiles = m_tiles.values();
+    std::sort(tiles.begin(), tiles.end(), [](const QGraphicsItem *lhs, const QGraphicsItem *rhs) {
+        return lhs->zValue() < rhs->zValue();
+    });
+    QStyleOptionGraphicsItem option;
+    for(auto tile : qAsConst(tiles)) {
+        if(!tile->sceneBoundingRect().intersects(sceneRect))
+            continue;
+        painter->save();
+        painter->setWorldTransform(tile->sceneTransform() * viewTransform);
+        option.exposedRect = tile->boundingRect();
+        tile->paint(painter, &option, nullptr);
+        painter->restore();
+    }
+}
+
+void GraphicsMap::beginZoomSnapshot()
+{
+    m_zoomSettling = true;
+    m_zoomSettleTimer.start();
+    if(!m_zoomSnapshot.isNull())
+        return;
+
+    // the tile buffer is exactly what we see now
+    if(m_tileBufferEnabled && !m_tileBuffer.isNull()) {
+        updateTileBuffer();
+        m_zoomSnapshot = m_tileBuffer;
+        m_snapshotTransform = m_tileBufferTransform;
+        return;
+    }
+    // cache what we see now, and then it will be scaled instead of the tiles
+    auto ratio = viewport()->devicePixelRatioF();
+    QPixmap snapshot(viewport()->size() * ratio);
+    snapshot.setDevicePixelRatio(ratio);
+    snapshot.fill(Qt::transparent);
+    {
+        QPainter painter(&snapshot);
+        auto sceneRect = mapToScene(viewport()->rect()).boundingRect();
+        drawTiles(&painter, viewportTransform(), sceneRect);
+    }
+    m_zoomSnapshot = snapshot;
+    m_snapshotTransform = viewportTransform();
+    for(auto tile : qAsConst(m_tiles)) {
+        tile->setVisible(false);
+    }
+}
+
+void GraphicsMap::endZoomSnapshot()
+{
+    if(m_zoomSnapshot.isNull())
+        return;
+    m_zoomSnapshot = QPixmap();
+    for(auto tile : qAsConst(m_tiles)) {
+        tile->setVisible(tileItemsVisible());
+    }
+    viewport()->update();
+}
+
+void GraphicsMap::onZoomSettled()
+{
+    // keep waitting until the animation is finished
+    if(m_zoomAnimation.state() == QAbstractAnimation::Running) {
+        m_zoomSettleTimer.start();
+        return;
+    }
+    m_zoomSettling = false;
+    // load the final zoom level only
+    if(m_isloading)
+        m_hasPendingLoad = true;
+    else
+        updateTile();
+    // nothing to load, that is to say the tiles have been ready
+    if(!m_isloading)
+        endZoomSnapshot();
+}
+
+/*!
+ * \brief 瓦片图元
+ * \details 整数层级且未旋转时，瓦片像素和屏幕像素一一对应，此时直接按整数像素位置贴图，
+ * 跳过QPainter的变换和插值过程；小数层级或旋转时仍使用常规的变换绘制
+ */
+class GraphicsMapTileItem : public QGraphicsPixmapItem
+{
+public:
+    explicit GraphicsMapTileItem(const QPixmap &pixmap) : QGraphicsPixmapItem(pixmap) {}
+
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
+    {
+        const auto &transform = painter->worldTransform();
+        bool pixelAligned = transform.type() <= QTransform::TxScale
+                && qFuzzyCompare(transform.m11(), 1.0) && qFuzzyCompare(transform.m22(), 1.0);
+        if(!pixelAligned) {
+            QGraphicsPixmapItem::paint(painter, option, widget);
+            return;
+        }
+        // NOTE: adjacent tiles are offset by exactly one tile length, so rounding will never make gaps between them
+        auto x = qRound(transform.dx() + offset().x());
+        auto y = qRound(transform.dy() + offset().y());
+        painter->save();
+        painter->setWorldTransform(QTransform());
+        painter->setRenderHint(QPainter::SmoothPixmapTransform, false);
+        painter->drawPixmap(x, y, pixmap());
+        painter->restore();
+    }
+};
+
+/*!
+ * \brief GraphicsMap::updateTileBuffer
+ * \details 缓冲区坐标为视口坐标向右下偏移TILE_BUFFER_MARGIN，只平移时将缓冲区整体滚动，然后仅补绘新露出的条带；
+ * 视口大小、缩放或者旋转发生变化时，整个缓冲区重绘
+ */
+void GraphicsMap::updateTileBuffer()
+{
+    auto ratio = viewport()->devicePixelRatioF();
+    QRect bufferRect(0, 0, viewport()->width() + 2*TILE_BUFFER_MARGIN, viewport()->height() + 2*TILE_BUFFER_MARGIN);
+    auto transform = viewportTransform() * QTransform::fromTranslate(TILE_BUFFER_MARGIN, TILE_BUFFER_MARGIN);
+
+    if(m_tileBuffer.isNull() || m_tileBuffer.size() != bufferRect.size() * ratio || m_tileBuffer.devicePixelRatio() != ratio) {
+        m_tileBuffer = QPixmap(bufferRect.size() * ratio);
+        m_tileBuffer.setDevicePixelRatio(ratio);
+        m_tileBuffer.fill(Qt::transparent);
+        m_tileBufferDirty = bufferRect;
+    }
+    else if(transform != m_tileBufferTransform) {
+        bool panOnly = qFuzzyCompare(transform.m11(), m_tileBufferTransform.m11())
+                && qFuzzyCompare(transform.m12(), m_tileBufferTransform.m12())
+                && qFuzzyCompare(transform.m21(), m_tileBufferTransform.m21())
+                && qFuzzyCompare(transform.m22(), m_tileBufferTransform.m22());
+        qreal dx = transform.dx() - m_tileBufferTransform.dx();
+        qreal dy = transform.dy() - m_tileBufferTransform.dy();
+        QPoint delta(qRound(dx), qRound(dy));
+        // the scroll must be whole device pixels, otherwise the content will be blurred
+        int intRatio = qRound(ratio);
+        bool scrollable = panOnly && qFuzzyCompare(ratio, qreal(intRatio))
+                && qAbs(dx - delta.x()) < 0.01 && qAbs(dy - delta.y()) < 0.01
+                && qAbs(delta.x()) < bufferRect.width() && qAbs(delta.y()) < bufferRect.height();
+        if(scrollable) {
+            m_tileBuffer.scroll(delta.x() * intRatio, delta.y() * intRatio, m_tileBuffer.rect());
+            QRegion moved(bufferRect.translated(delta));
+            m_tileBufferDirty = m_tileBufferDirty.translated(delta) + (QRegion(bufferRect) - moved);
+        }
+        else {
+            m_tileBufferDirty = bufferRect;
+        }
+    }
+    m_tileBufferTransform = transform;
+    m_tileBufferDirty &= bufferRect;
+    if(m_tileBufferDirty.isEmpty())
+        return;
+
+    // repaint the exposed strips and the changed tiles only
+    QPainter painter(&m_tileBuffer);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for(const auto &rect : m_tileBufferDirty) {
+        painter.fillRect(rect, Qt::transparent);
+    }
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    painter.setClipRegion(m_tileBufferDirty);
+    auto sceneRect = transform.inverted().mapRect(QRectF(m_tileBufferDirty.boundingRect()));
+    drawTiles(&painter, transform, sceneRect);
+    m_tileBufferDirty = QRegion();
+}
+
+void GraphicsMap::invalidateTileBuffer(QGraphicsItem *tile)
+{
+    if(!m_tileBufferEnabled || m_tileBuffer.isNull())
+        return;
+    m_tileBufferDirty += m_tileBufferTransform.mapRect(tile->sceneBoundingRect()).toAlignedRect();
+    if(viewportUpdateMode() != QGraphicsView::NoViewportUpdate)
+        viewport()->update();
 }
 
 GraphicsMapThread::TileCacheNode::~TileCacheNode()
@@ -258,6 +1004,7 @@ GraphicsMapThread::TileCacheNode::~TileCacheNode()
 }
 
 GraphicsMapThread::GraphicsMapThread():
+    m_scheme(WebMercator256),
     m_bTMS(false)
 {
     m_tileCache.setMaxCost(1000);
@@ -353,6 +1100,51 @@ void GraphicsMapThread::requestPath(const QString &path)
     m_path = path;
 }
 
+/*!
+ * \brief GraphicsMapThread::requestFilter
+ * \note 已缓存的瓦片可能正显示在场景中，所以不能在本线程中析构，而是交给界面线程移出场景后删除
+ */
+void GraphicsMapThread::requestFilter(quint8 type, const MapColorFilter &filter)
+{
+    if(m_filters.value(type) == filter)
+        return;
+    if(filter.isIdentity())
+        m_filters.remove(type);
+    else
+        m_filters.insert(type, filter);
+    // discard the cached tiles which were processed by the old filter
+    discardTiles(type);
+}
+
+void GraphicsMapThread::requestScheme(MapScheme scheme)
+{
+    if(m_scheme == scheme)
+        return;
+    m_scheme = scheme;
+    discardTiles(0);
+}
+
+QImage GraphicsMapThread::loadTileImage(const QString &path, MapScheme scheme, const GraphicsMap::TileSpec &tileSpec, bool tms, const MapColorFilter &filter)
+{
+    quint32 rows = mapSchemeDispatch(scheme, [&](auto s) { return decltype(s)::rows(tileSpec.zoom); });
+    //
+    QString fileName = QString("%1/%2/%3/%4")
+            .arg(path)
+            .arg(tileSpec.zoom)
+            .arg(tileSpec.x)
+            .arg(tms ? rows - tileSpec.y - 1 : tileSpec.y);
+    if(QFileInfo::exists(fileName+".jpg"))
+        fileName += ".jpg";
+    else if(QFileInfo::exists(fileName+".png"))
+        fileName += ".png";
+    else
+        return QImage();
+
+    QImage image(fileName);
+    filter.apply(image);
+    return image;
+}
+
 void GraphicsMapThread::setTileCacheCount(const int &count)
 {
     m_tileCache.setMaxCost(count);
@@ -390,41 +1182,43 @@ void GraphicsMapThread::hideItem(const GraphicsMap::TileSpec &tileSpec)
 
 /*!
  * \brief MudMapThread::loadTileItem
- * \note QTransform的srt顺序对结果有影响，并且和三维矩阵用法不一样，
- * 在该函数实现中，先scale再translate，可以理解成将瓦片按照原始大小排列在矩形中(比如1层有四张瓦片，那么排列在256*4->256*4的矩形中)，
- * 然后这个矩形从右下角整个向左上角缩放达到和sceneRect()正好重合，以实现所有不同zoom的瓦片都重叠在sceneRect()上，也达到了缺省瓦片通过上层瓦片显示的效果。
- * 为了方便经纬度和场景坐标的转换，这里将经纬度（0，0）映射在了场景坐标的（0，0）处，所以注意xOff和yOff是先移动到以（0，0）为原点的位置，再向左上移动半个场景的宽度和高度
+ * \note 瓦片按照原始大小排列后(比如1层有四张瓦片，那么排列在256*2->256*2的矩形中)，整体缩放到和sceneRect()正好重合，
+ * 以实现所有不同zoom的瓦片都重叠在sceneRect()上，也达到了缺省瓦片通过上层瓦片显示的效果。
+ * 为了方便经纬度和场景坐标的转换，经纬度（0，0）映射在场景坐标的（0，0）处，所以瓦片矩阵的左上角位于场景的左上角，见MapTileScheme::tileTransform
  */
 QGraphicsPixmapItem *GraphicsMapThread::loadTileItem(const GraphicsMap::TileSpec &tileSpec)
 {
-    int tileCount = qPow(2, tileSpec.zoom);
-    //
-    QString fileName = QString("%1/%2/%3/%4")
-            .arg(m_path)
-            .arg(tileSpec.zoom)
-            .arg(tileSpec.x)
-            .arg(m_bTMS ? tileCount - tileSpec.y - 1 : tileSpec.y);
-    if(QFileInfo::exists(fileName+".jpg"))
-        fileName += ".jpg";
-    else if(QFileInfo::exists(fileName+".png"))
-        fileName += ".png";
-    else
+    auto image = loadTileImage(m_path, m_scheme, tileSpec, m_bTMS, m_filters.value(tileSpec.type));
+    if(image.isNull())
         return nullptr;
 
-    auto tileItem = new QGraphicsPixmapItem(fileName);
+    auto tileItem = new GraphicsMapTileItem(QPixmap::fromImage(image));
     tileItem->setZValue(tileSpec.zoom - 20);
-
-    //
-    double xOff = TILE_LEN * (tileSpec.x  - tileCount/2.0);     // see also: TILE_LEN * tileSpec.x - (TILE_LEN*tileCount) / 2;
-    double yOff = TILE_LEN * (tileSpec.y  - tileCount/2.0);     // see also: TILE_LEN * tileSpec.y - (TILE_LEN*tileCount) / 2;
-    double scaleFac = 1.0 / qPow(2, (tileSpec.zoom-ZOOM_BASE));
-    QTransform transform;
-    transform.scale(scaleFac, scaleFac)
-            .translate(xOff, yOff);
-    tileItem->setTransform(transform);
+    tileItem->setTransform(mapSchemeDispatch(m_scheme, [&](auto scheme) {
+        return decltype(scheme)::tileTransform(tileSpec.zoom, tileSpec.x, tileSpec.y);
+    }));
     return tileItem;
 }
 
+void GraphicsMapThread::discardTiles(quint8 type)
+{
+    const auto keys = m_tileCache.keys();
+    for(const auto &tileSpec : keys) {
+        if(type != 0 && tileSpec.type != type)
+            continue;
+        auto tileItem = m_tileCache.object(tileSpec);
+        // the item may be in the scene now, so it must be deleted by the GUI thread
+        if(tileItem->value) {
+            emit tileToDelete(tileItem->value);
+            tileItem->value = nullptr;
+        }
+        m_tileCache.remove(tileSpec);
+        m_tileShowedSet.remove(tileSpec);
+        m_tileTriedToShowdSet.remove(tileSpec);
+    }
+    m_tileRegion = GraphicsMap::TileRegion{};
+}
+
 void GraphicsMapThread::createAscendingTileCache(const GraphicsMap::TileSpec &tileSpec, QSet<GraphicsMap::TileSpec> &sets)
 {
     auto tileCacheItem = m_tileCache.object(tileSpec);
@@ -6,9 +6,17 @@
 #include <QWheelEvent>
 #include <QCache>
 #include <QGeoCoordinate>
+#include <QGeoRectangle>
 #include <QTimer>
+#include <QAtomicInt>
+#include <QSet>
+#include <QVariantAnimation>
+#include "mapcolorfilter.h"
+#include "mapprojection.h"
+#include "mapcoordinate.h"
 
 class GraphicsMapThread;
+class GraphicsMapExporter;
 /*!
  * \brief 基于Graphics View的地图
  * \details 其仅用于显示瓦片地图，要实现地图以外的功能可以继承该类
@@ -18,6 +26,7 @@ class GraphicsMapThread;
 class GraphicsMap : public QGraphicsView
 {
     Q_OBJECT
+    friend class GraphicsMapExporter;
 
 public:
     /// 瓦片参数描述结构体
@@ -56,9 +65,35 @@ public:
     void setFrameRate(int fps);
     /// 设置瓦片路径
     void setTilePath(const QString &path);
+    /*!
+     * \brief 设置瓦片方案，决定投影方式和瓦片划分，默认为WebMercator256
+     * \details 图元通过静态函数toScene/toCoordinate计算场景坐标，所以投影方式是全局的：
+     * 1.同时存在的多个地图只能使用相同投影的方案，瓦片大小可以不同，其他地图使用不同投影时拒绝设置；
+     * 2.新建的地图默认使用已有地图的方案，没有其他地图时为WebMercator256
+     * \return 与其他地图的投影冲突时返回false，方案不变
+     * \note 应该在添加图元之前设置，已有图元的场景坐标不会重新计算，MapRangeRingItem、MapGraticuleItem和MapFootprintEngine的缓存除外
+     * \note 瓦片方案属于地图实例，但投影由所有地图共用，这是静态坐标转换接口决定的有意取舍，并非按地图实例选择投影
+     */
+    bool setTileScheme(MapScheme scheme);
+    MapScheme tileScheme() const;
+    /// 静态坐标转换函数使用的瓦片方案，缓存了场景坐标的类可以据此判断是否需要重新计算
+    static inline MapScheme sceneScheme() { return MapScheme(m_sceneScheme.load()); }
+    /// 设置瓦片颜色滤镜，在瓦片加载线程中处理，处理后的瓦片进入缓存，传入默认构造的滤镜可以取消
+    void setTileFilter(const QString &path, const MapColorFilter &filter);
+    MapColorFilter tileFilter(const QString &path) const;
     /// 设置缩放等级
     void setZoomLevel(float zoom);
     const float &zoomLevel() const;
+    /// 设置平滑缩放模式，缩放过程中仅缩放当前画面的快照，缩放停止一段时间后才加载最终层级的瓦片
+    void setSmoothZoom(bool on);
+    bool isSmoothZoom() const;
+    /// 以动画方式缩放到指定层级，未开启平滑缩放时等同于setZoomLevel
+    void zoomTo(float zoom);
+    /// 获取缩放目标层级，缩放动画结束后与zoomLevel一致
+    float zoomTarget() const;
+    /// 设置瓦片层后台缓冲，平移地图时只需滚动缓冲区并补绘新露出的部分，缩放或旋转时缓冲区失效重绘
+    void setTileBufferEnabled(bool on);
+    bool isTileBufferEnabled() const;
     /// 设置缩放等级范围
     void setZoomRange(int min, int max);
     /// 设置朝向，正北为起始，向右为正，向左为负 \bug 由于QGraphicsView滚动条精度问题，会造成中心点抖动
@@ -76,40 +111,103 @@ public:
     QGeoCoordinate toCoordinate(const QPoint &point) const;
     /// 获取经纬度对应的窗口坐标
     QPoint toPoint(const QGeoCoordinate &coord) const;
+    /*!
+     * \brief 异步导出地图图片
+     * \details 使用指定层级的瓦片(而不是屏幕当前层级)，按瓦片行分条带在线程池中绘制，条带按顺序逐行编码写入文件，完成后发出exportFinished信号
+     * \param rect 导出的经纬度范围
+     * \param zoom 瓦片层级
+     * \param dpi 输出分辨率，96为瓦片原始大小
+     * \param withItems 是否叠加场景中的图元，图元部分需要在界面线程中逐条带绘制
+     * \return 正在导出、参数无效、格式不支持或者边长超过65500像素时返回false
+     * \note 文件格式由后缀名决定，支持png和jpg
+     * \note 结果图像不完整保存在内存中，内存峰值只有几个条带，与导出范围的高度无关；失败时不保留未完成的文件
+     */
+    bool exportImage(const QString &fileName, const QGeoRectangle &rect, int zoom, int dpi = 96, bool withItems = true);
+    /// 是否正在导出
+    bool isExporting() const;
 
 public:
     /// 获取场景坐标对应的经纬度
     static QGeoCoordinate toCoordinate(const QPointF &point);
+    /// 获取场景坐标对应的经纬度，不检查有效性，场景范围外的点经度可能超出[-180, 180]
+    static MapCoordinate toMapCoordinate(const QPointF &point);
     /// 获取经纬度对应的场景坐标
     static QPointF toScene(const QGeoCoordinate &coord);
+    /// 批量获取经纬度对应的场景坐标，使用SIMD指令计算 \param count 点数量，三个数组均至少需要count个元素
+    static void toScene(const double *lat, const double *lon, QPointF *points, int count);
+    static QVector<QPointF> toScene(const QVector<QGeoCoordinate> &coords);
+    static QPointF toScene(const MapCoordinate &coord);
+    static QVector<QPointF> toScene(const QVector<MapCoordinate> &coords);
     /// 通过资源路径，获取唯一对应的资源类型
     static quint8 mapType(const QString &path);
+    /// 获取显示该场景的地图，没有时返回nullptr
+    static GraphicsMap *fromScene(const QGraphicsScene *scene);
 
 
 signals:
     void zoomChanged(const float &zoom);
     void tileRequested(const TileRegion &region);
     void pathRequested(const QString &path);
+    void filterRequested(quint8 type, const MapColorFilter &filter);
+    void schemeRequested(MapScheme scheme);
+    void exportProgress(int finished, int total);
+    void exportFinished(const QString &fileName, bool ok);
 
 protected:
     virtual void resizeEvent(QResizeEvent *event) override; ///< 用于限制地图最小缩放等级
+    virtual void drawBackground(QPainter *painter, const QRectF &rect) override; ///< 记录可见范围，绘制平滑缩放快照或瓦片层缓冲
 
 private:
     void init();
+    /// 每帧刷新视口之前外推航位推算对象并更新可见范围，不在绘制过程中移动图元
+    void advanceFrame();
+    /// 可见范围改变时通知视图外延迟更新的对象
+    void updateDeferRect();
     void updateTile();
+    /// 按层级顺序绘制已显示的瓦片 \param viewTransform 场景到绘制设备的变换
+    void drawTiles(QPainter *painter, const QTransform &viewTransform, const QRectF &sceneRect);
+    /// 平滑缩放开始，缓存当前瓦片画面并隐藏瓦片
+    void beginZoomSnapshot();
+    /// 平滑缩放结束，最终层级的瓦片加载完成后恢复瓦片显示
+    void endZoomSnapshot();
+    void onZoomSettled();
+    /// 同步瓦片层缓冲区与当前视口变换，并补绘失效区域
+    void updateTileBuffer();
+    /// 标记瓦片所在的缓冲区域失效
+    void invalidateTileBuffer(QGraphicsItem *tile);
+    /// 瓦片由场景绘制还是由快照/缓冲区绘制
+    inline bool tileItemsVisible() const { return m_zoomSnapshot.isNull() && !m_tileBufferEnabled; }
 
 private:
     static QStringList m_mapTypes; ///< 资源路径类型
+    static QAtomicInt  m_sceneScheme;  ///< 静态坐标转换函数使用的瓦片方案，工作线程中也会读取
+    static QSet<GraphicsMap*> m_maps;  ///< 所有地图，用于检查投影冲突
 private:
     GraphicsMapThread    *m_mapThread;
+    GraphicsMapExporter  *m_exporter;      ///< 正在进行的导出任务
     QSet<QGraphicsItem*> m_tiles;          ///< 已显示瓦片
     quint8               m_type;           ///< 瓦片资源类型
+    MapScheme            m_scheme;         ///< 瓦片方案
     QTimer               m_updateTimer;    ///< 更新定时器
+    QRectF               m_deferRect;      ///< 上次通知MapObjectItem的可见场景范围
+    //
+    QVariantAnimation    m_zoomAnimation;     ///< 平滑缩放动画
+    QTimer               m_zoomSettleTimer;   ///< 缩放停止判定定时器，超时后才加载瓦片
+    QPixmap              m_zoomSnapshot;      ///< 缩放开始时的瓦片画面快照
+    QTransform           m_snapshotTransform; ///< 快照对应的视口变换
+    QPixmap              m_tileBuffer;          ///< 瓦片层后台缓冲，四周比视口多出一圈边距
+    QTransform           m_tileBufferTransform; ///< 场景到缓冲区的变换
+    QRegion              m_tileBufferDirty;     ///< 缓冲区待重绘区域
     //
     TileRegion m_tileRegion;    ///< 显示瓦片区域
+    QHash<quint8, MapColorFilter> m_tileFilters;    ///< 各类型瓦片的颜色滤镜
     //
     bool  m_isloading;          ///< 正在加载地图
     bool  m_hasPendingLoad;     ///< 是否有挂起的加载请求
+    bool  m_smoothZoom;         ///< 是否开启平滑缩放
+    bool  m_zoomSettling;       ///< 正在平滑缩放，瓦片加载被推迟
+    bool  m_tileBufferEnabled;  ///< 是否开启瓦片层后台缓冲
+    bool  m_bTMS;               ///< 是否为TMS瓦片协议
     float m_zoom;               ///< 当前层级
     float m_minZoom;            ///< 最小缩放层级，刚好适应窗口大小
     float m_maxZoom;            ///< 最大缩放层级，防止无限放大
@@ -118,6 +216,7 @@ private:
 };
 Q_DECLARE_METATYPE(GraphicsMap::TileSpec);
 Q_DECLARE_METATYPE(GraphicsMap::TileRegion);
+Q_DECLARE_METATYPE(MapScheme);
 
 inline uint qHash(const GraphicsMap::TileSpec &key, uint seed)
 {
@@ -150,8 +249,14 @@ public slots:
     void requestTile(const GraphicsMap::TileRegion &region);
     /// 请求更改瓦片资源来源
     void requestPath(const QString &path);
+    /// 请求更改瓦片颜色滤镜，该类型已缓存的瓦片会被丢弃并重新加载
+    void requestFilter(quint8 type, const MapColorFilter &filter);
+    /// 请求更改瓦片方案，已缓存的瓦片全部丢弃并重新加载
+    void requestScheme(MapScheme scheme);
 
 public:
+    /// 从磁盘加载瓦片图像并应用颜色滤镜，该函数是线程安全的，瓦片不存在时返回空图像
+    static QImage loadTileImage(const QString &path, MapScheme scheme, const GraphicsMap::TileSpec &tileSpec, bool tms, const MapColorFilter &filter);
     /// 设置瓦片缓存数量 默认1000张瓦片
     void setTileCacheCount(const int &count);
     /// 设置TMS瓦片协议 默认XYZ协议（在TMS协议中，y=0的瓦片是最南边的瓦片，而在XYZ模式(OGC WMTS也使用)中，y=0的瓦片是最北边的瓦片)
@@ -160,6 +265,7 @@ public:
 signals:
     void tileToAdd(QGraphicsItem *tile);
     void tileToRemove(QGraphicsItem *tile);
+    void tileToDelete(QGraphicsItem *tile);
     void requestFinished();
 
 private:
@@ -168,6 +274,8 @@ private:
     /// 从磁盘加载瓦片文件
     QGraphicsPixmapItem* loadTileItem(const GraphicsMap::TileSpec &tileSpec);
     void createAscendingTileCache(const GraphicsMap::TileSpec &tileSpec, QSet<GraphicsMap::TileSpec> &sets);
+    /// 丢弃指定类型的缓存瓦片，type为0时丢弃全部，瓦片图元交给界面线程删除
+    void discardTiles(quint8 type);
 
 private:
     QCache<GraphicsMap::TileSpec, TileCacheNode> m_tileCache; ///<已加载瓦片缓存
@@ -176,7 +284,10 @@ private:
     //
     GraphicsMap::TileRegion m_tileRegion;    ///< 请求的瓦片区域
     //
+    QHash<quint8, MapColorFilter> m_filters;  ///< 各类型瓦片的颜色滤镜，不含原图效果的滤镜
+    //
     QString          m_path;
+    MapScheme        m_scheme;
     bool             m_bTMS;
 };
 
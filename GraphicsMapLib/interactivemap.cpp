@@ -15,6 +15,20 @@ InteractiveMap::InteractiveMap(QWidget *parent) : GraphicsMap(parent),
 
 }
 
+void InteractiveMap::resetPooledItem(MapObjectItem *item, std::true_type)
+{
+    item->reset();
+}
+
+void InteractiveMap::setIndexEnabled(QGraphicsItem *item, bool enabled)
+{
+    MapSpatialIndex::instance()->setEnabled(item, enabled);
+    // childItems() shares the list of the item, no copy is made
+    for(auto child : item->childItems()) {
+        setIndexEnabled(child, enabled);
+    }
+}
+
 bool InteractiveMap::pushOperator(MapOperator *op)
 {
     if(!op)
@@ -111,10 +125,12 @@ void InteractiveMap::wheelEvent(QWheelEvent *e)
         return;
     }
     bool increase = e->angleDelta().y() > 0;
-    if(increase)
-        this->setZoomLevel(zoomLevel() + 0.2);
+    auto step = increase ? 0.2f : -0.2f;
+    // smooth zoom accumulates the steps on the animation target
+    if(isSmoothZoom())
+        this->zoomTo(zoomTarget() + step);
     else
-        this->setZoomLevel(zoomLevel() - 0.2);
+        this->setZoomLevel(zoomLevel() + step);
     e->accept();
 }
 
@@ -2,11 +2,22 @@
 #define INTERACTIVEMAP_H
 
 #include "graphicsmap.h"
+#include "mapspatialindex.h"
 #include <QStack>
+#include <QGeoRectangle>
+#include <typeindex>
+#include <typeinfo>
+#include <type_traits>
 
 class MapOperator;
 class MapObjectItem;
 
+/// Qt5没有为std::type_index提供qHash，对象池以实际类型为键
+inline uint qHash(const std::type_index &key, uint seed = 0)
+{
+    return qHash(key.hash_code(), seed);
+}
+
 /*!
  * \brief 可交互地图
  * \details 1.提供众多对地图元素添加、获取的模板接口
@@ -28,6 +39,46 @@ public:
     /// 清空该类管理的所有圆形
     template<class T>
     void clearMapItem();
+    /*!
+     * \brief 从对象池获取地图元素
+     * \details 池中有回收的实例时直接复用并恢复显示，没有时才创建，目标频繁出现和消失时不再反复构造和析构，
+     * 池容量稳定后获取和回收都不分配内存：回收的实例及其子图元(如航点)在MapSpatialIndex中的索引项只被暂停，获取时恢复，
+     * MapObjectItem则在下一次setCoordinate时恢复
+     * \note 池中的实例仍在场景和MapObjectItem::items()中，只是被隐藏，不会被空间查询找到
+     * \note 复用后设置到其他网格的位置时，与普通移动一样可能为新网格分配内存
+     */
+    template<class T>
+    T *acquireMapItem();
+    /*!
+     * \brief 回收地图元素到对象池
+     * \details 实例被隐藏并按实际类型放入对象池，MapObjectItem会通过reset恢复默认状态
+     * \note 回收前请断开外部的信号连接，并从聚合图层、电子围栏等处移除；回收后不要再调用removeMapItem
+     */
+    template<class T>
+    void releaseMapItem(T *item);
+    /// 预先创建实例放入对象池
+    template<class T>
+    void reserveMapItem(int count);
+    /// 删除对象池中该类型的所有实例
+    template<class T>
+    void clearMapItemPool();
+
+    /*!
+     * \brief 获取经纬度矩形内的图元
+     * \details 通过MapSpatialIndex查询，不依赖视图的当前范围，T为图元类型，默认为所有类型
+     * \note 只返回该地图场景中的图元，线状和面状图元按经纬度外接矩形判断
+     */
+    template<class T = QGraphicsItem>
+    QVector<T*> itemsInRect(const QGeoRectangle &rect) const;
+    /// 获取到中心点的距离不超过半径(单位米)的图元
+    template<class T = QGraphicsItem>
+    QVector<T*> itemsWithinRadius(const QGeoCoordinate &center, qreal meter) const;
+    /// 获取与多边形相交的图元
+    template<class T = QGraphicsItem>
+    QVector<T*> itemsInPolygon(const QVector<QGeoCoordinate> &polygon) const;
+    /// 获取距离最近的k个图元，由近到远排列
+    template<class T = QGraphicsItem>
+    QVector<T*> nearest(const QGeoCoordinate &coord, int k = 1) const;
 
     /// 设置事件交互操作器(不可重复)
     bool pushOperator(MapOperator *op);
@@ -51,6 +102,16 @@ protected:
 
 private:
     void onOperatorModeChanged();
+    template<class T>
+    MapSpatialIndex::Filter spatialFilter() const;
+    template<class T>
+    static QVector<T*> castItems(const QVector<QGraphicsItem*> &items);
+    /// 回收时重置MapObjectItem及其子类，其他类型只隐藏
+    static void resetPooledItem(MapObjectItem *item, std::true_type);
+    template<class T>
+    static void resetPooledItem(T *item, std::false_type);
+    /// 暂停或恢复图元及其子图元(如航点)的索引项，不分配内存
+    static void setIndexEnabled(QGraphicsItem *item, bool enabled);
 
 private:
     QStack<MapOperator*> m_operators;     ///< 操作器栈
@@ -59,6 +120,7 @@ private:
     QGraphicsView::ViewportAnchor m_anchor;          ///< 鼠标锚点(用于取消居中之后回到之前的模式)
     //
     bool  m_scaleable;  ///< 是否可以鼠标缩放
+    QHash<std::type_index, QVector<QGraphicsItem*>> m_itemPools;  ///< 各类型的对象池，以实际类型区分
 };
 
 template<class T>
@@ -76,6 +138,105 @@ void InteractiveMap::removeMapItem(T *item)
     delete item;
 }
 
+template<class T>
+T *InteractiveMap::acquireMapItem()
+{
+    auto &pool = m_itemPools[std::type_index(typeid(T))];
+    if(pool.isEmpty())
+        return addMapItem<T>();
+    // the pool of T only holds instances whose dynamic type is T
+    auto item = static_cast<T*>(pool.takeLast());
+    if(item->scene() != scene())
+        scene()->addItem(item);
+    item->setVisible(true);
+    setIndexEnabled(item, true);
+    // a reset MapObjectItem has no coordinate until it is set again
+    if(std::is_base_of<MapObjectItem, T>::value)
+        MapSpatialIndex::instance()->setEnabled(item, false);
+    return item;
+}
+
+template<class T>
+void InteractiveMap::releaseMapItem(T *item)
+{
+    if(!item)
+        return;
+    resetPooledItem(item, std::is_base_of<MapObjectItem, T>());
+    item->setVisible(false);
+    setIndexEnabled(item, false);
+    m_itemPools[std::type_index(typeid(*item))].append(item);
+}
+
+template<class T>
+void InteractiveMap::reserveMapItem(int count)
+{
+    auto &pool = m_itemPools[std::type_index(typeid(T))];
+    pool.reserve(pool.size() + count);
+    for(int i = 0; i < count; ++i) {
+        releaseMapItem(addMapItem<T>());
+    }
+}
+
+template<class T>
+void InteractiveMap::clearMapItemPool()
+{
+    const auto pool = m_itemPools.take(std::type_index(typeid(T)));
+    for(auto item : pool) {
+        removeMapItem(static_cast<T*>(item));
+    }
+}
+
+template<class T>
+void InteractiveMap::resetPooledItem(T *item, std::false_type)
+{
+    Q_UNUSED(item)
+}
+
+template<class T>
+QVector<T*> InteractiveMap::itemsInRect(const QGeoRectangle &rect) const
+{
+    return castItems<T>(MapSpatialIndex::instance()->intersects(rect.topLeft(), rect.bottomRight(), spatialFilter<T>()));
+}
+
+template<class T>
+QVector<T*> InteractiveMap::itemsWithinRadius(const QGeoCoordinate &center, qreal meter) const
+{
+    return castItems<T>(MapSpatialIndex::instance()->withinRadius(center, meter, spatialFilter<T>()));
+}
+
+template<class T>
+QVector<T*> InteractiveMap::itemsInPolygon(const QVector<QGeoCoordinate> &polygon) const
+{
+    return castItems<T>(MapSpatialIndex::instance()->intersects(MapCoordinate::fromGeoCoordinates(polygon), spatialFilter<T>()));
+}
+
+template<class T>
+QVector<T*> InteractiveMap::nearest(const QGeoCoordinate &coord, int k) const
+{
+    return castItems<T>(MapSpatialIndex::instance()->nearest(coord, k, spatialFilter<T>()));
+}
+
+/// 只保留该地图场景中指定类型的图元
+template<class T>
+MapSpatialIndex::Filter InteractiveMap::spatialFilter() const
+{
+    auto scene = this->scene();
+    return [scene](const QGraphicsItem *item) {
+        return item->scene() == scene && dynamic_cast<const T*>(item);
+    };
+}
+
+template<class T>
+QVector<T*> InteractiveMap::castItems(const QVector<QGraphicsItem*> &items)
+{
+    QVector<T*> result;
+    result.reserve(items.size());
+    for(auto item : items) {
+        result.append(dynamic_cast<T*>(item));
+    }
+    return result;
+}
+
 /*!
  * \brief 可交互操作器
  * \details InteractiveMap将会调用该类的事件接口，以提供固定的地图处理功能，比如创建一个圆形
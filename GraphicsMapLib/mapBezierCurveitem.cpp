@@ -1,6 +1,7 @@
 ﻿#include "mapBezierCurveitem.h"
 #include "graphicsmap.h"
 #include "mapobjectitem.h"
+#include "mappropertymenu.h"
 #include <QDebug>
 
 QSet<MapBezierCurveItem*> MapBezierCurveItem::m_items;
@@ -12,13 +13,6 @@ MapBezierCurveItem::MapBezierCurveItem() :
     pen.setWidth(1);
     pen.setStyle(Qt::DashLine);
 
-    m_menu = new QMenu;
-    m_action = new QAction;
-    m_menu->addAction(m_action);
-    m_action->setText(u8"右键属性");
-    connect(m_action, &QAction::triggered, this, [=](){
-        emit propertyRequset(this);
-    }, Qt::DirectConnection);
     m_items.insert(this);
 }
 
@@ -101,8 +95,8 @@ void MapBezierCurveItem::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
 
 void MapBezierCurveItem::contextMenuEvent(QGraphicsSceneContextMenuEvent *event)
 {
-    if(m_editable)
-        m_menu->exec(QCursor::pos());
+    if(m_editable && MapPropertyMenu::exec(this))
+        emit propertyRequset(this);
 }
 
 void MapBezierCurveItem::InsertBezierCurve(const QVector<QPointF> &vecSrc, QVector<QPointF> &vecBezier)
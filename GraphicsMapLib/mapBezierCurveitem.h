@@ -62,9 +62,6 @@ private:
     };
     bool                        m_editable;
     QVector<BezierPoint>        m_points;
-
-    QMenu   *m_menu;
-    QAction *m_action;
 };
 
 #endif // MAPBEZIERCURVEITEM_H
@@ -1,5 +1,6 @@
 ﻿#include "mapbrokenline.h"
 #include "graphicsmap.h"
+#include "mappropertymenu.h"
 #include <QDebug>
 
 QSet<MapBrokenLine*> MapBrokenLine::m_items;
@@ -13,14 +14,6 @@ MapBrokenLine::MapBrokenLine() :
     pen.setWidth(1);
 //    pen.setCosmetic(true);
     this->setPen(pen);
-
-    m_menu = new QMenu;
-    m_action = new QAction;
-    m_menu->addAction(m_action);
-    m_action->setText(u8"右键属性");
-    connect(m_action, &QAction::triggered, this, [=](){
-        emit propertyRequset(this);
-    }, Qt::DirectConnection);
     //
     m_items.insert(this);
     updateEditable();
@@ -100,11 +93,7 @@ void MapBrokenLine::setPoints(const QVector<QGeoCoordinate> &coords)
 
     // Change previous coords and points
     m_coords = coords;
-    m_points.clear();
-    for(auto &coord : coords) {
-        auto point = GraphicsMap::toScene(coord);
-        m_points.append(point);
-    }
+    m_points = GraphicsMap::toScene(coords);
     updatePolygon();
     //
     emit changed();
@@ -147,8 +136,8 @@ void MapBrokenLine::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
 
 void MapBrokenLine::contextMenuEvent(QGraphicsSceneContextMenuEvent *event)
 {
-    if(m_editable)
-        m_menu->exec(QCursor::pos());
+    if(m_editable && MapPropertyMenu::exec(this))
+        emit propertyRequset(this);
 }
 
 void MapBrokenLine::updatePolygon()
@@ -64,9 +64,6 @@ private:
     //
     QVector<QGeoCoordinate>      m_coords;     ///< 经纬点列表
     QVector<QPointF>             m_points;     ///< 场景坐标点列表
-
-    QMenu   *m_menu;
-    QAction *m_action;
 };
 
 #endif // MAPBROKENLINE_H
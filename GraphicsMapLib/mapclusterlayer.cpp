@@ -0,0 +1,461 @@
+﻿#include "mapclusterlayer.h"
+#include "graphicsmap.h"
+#include "mapobjectitem.h"
+#include <QGraphicsSceneMouseEvent>
+#include <QGraphicsView>
+#include <QStyleOptionGraphicsItem>
+#include <QtMath>
+
+#define CLUSTER_LEVELS 25       ///< 网格层级数量，覆盖0-24级
+#define MARKER_RADIUS 14        ///< 聚合标记的最小半径，像素
+#define ZOOM_MARGIN 0.8         ///< 缩放到对象时对象范围占视口的比例
+
+MapClusterLayer::MapClusterLayer() :
+    m_level(-1),
+    m_visibilityDirty(false),
+    m_distance(60),
+    m_minimumCount(2),
+    m_maximumZoom(16),
+    m_pen(QColor(255, 255, 255, 200), 2),
+    m_brush(QColor(30, 120, 220, 200)),
+    m_textColor(Qt::white)
+{
+    this->setFlag(ItemUsesExtendedStyleOption);
+    m_font.setFamily("Microsoft YaHei");
+    m_font.setPointSize(9);
+    m_font.setBold(true);
+    m_levels.resize(CLUSTER_LEVELS);
+    //
+    connect(MapObjectItem::notifier(), &MapObjectNotifier::batchUpdated, this, &MapClusterLayer::markMoved);
+    connect(&m_frameTimer, &QTimer::timeout, this, &MapClusterLayer::sync);
+    setFrameRate(10);
+}
+
+MapClusterLayer::~MapClusterLayer()
+{
+    clear();
+}
+
+void MapClusterLayer::add(MapObjectItem *item)
+{
+    if(!item || m_members.contains(item))
+        return;
+    const auto pos = memberPos(item);
+    m_members.insert(item, {pos, false});
+    for(int i = 0; i < m_levels.size(); ++i) {
+        if(m_levels.at(i).built)
+            insertCell(m_levels[i], i, pos);
+    }
+    auto mark = [=]() { m_moved.insert(item); };
+    connect(item, &MapObjectItem::coordinateChanged, this, mark);
+    connect(item, &MapObjectItem::coordinateDragged, this, mark);
+    // the destroyed signal comes after ~MapObjectItem, only the pointer value is used
+    connect(item, &QObject::destroyed, this, [=](){
+        removeMember(item, false);
+    });
+    m_visibilityDirty = true;
+    update();
+}
+
+void MapClusterLayer::add(const QVector<MapObjectItem *> &items)
+{
+    for(auto item : items) {
+        add(item);
+    }
+}
+
+void MapClusterLayer::remove(MapObjectItem *item)
+{
+    if(!m_members.contains(item))
+        return;
+    disconnect(item, nullptr, this, nullptr);
+    removeMember(item, true);
+}
+
+void MapClusterLayer::clear()
+{
+    for(auto iter = m_members.constBegin(); iter != m_members.constEnd(); ++iter) {
+        disconnect(iter.key(), nullptr, this, nullptr);
+        if(iter.value().clustered)
+            iter.key()->setVisible(true);
+    }
+    m_members.clear();
+    m_moved.clear();
+    resetLevels();
+    update();
+}
+
+int MapClusterLayer::count() const
+{
+    return m_members.size();
+}
+
+void MapClusterLayer::setDistance(int pixel)
+{
+    pixel = qMax(pixel, 1);
+    if(m_distance == pixel)
+        return;
+    m_distance = pixel;
+    resetLevels();
+    update();
+}
+
+int MapClusterLayer::distance() const
+{
+    return m_distance;
+}
+
+void MapClusterLayer::setMinimumCount(int count)
+{
+    count = qMax(count, 2);
+    if(m_minimumCount == count)
+        return;
+    m_minimumCount = count;
+    m_visibilityDirty = true;
+    sync();
+}
+
+int MapClusterLayer::minimumCount() const
+{
+    return m_minimumCount;
+}
+
+void MapClusterLayer::setMaximumZoom(int zoom)
+{
+    if(m_maximumZoom == zoom)
+        return;
+    m_maximumZoom = zoom;
+    if(auto map = GraphicsMap::fromScene(scene()))
+        updateZoom(map->zoomLevel());
+}
+
+int MapClusterLayer::maximumZoom() const
+{
+    return m_maximumZoom;
+}
+
+void MapClusterLayer::setFrameRate(int fps)
+{
+    m_frameTimer.setFrameRate(fps);
+}
+
+void MapClusterLayer::sync()
+{
+    // 1.move the reported members between cells of every built level
+    bool moved = false;
+    for(auto item : qAsConst(m_moved)) {
+        auto iter = m_members.find(item);
+        if(iter == m_members.end())
+            continue;
+        const auto pos = memberPos(item);
+        auto &member = iter.value();
+        if(member.pos == pos)
+            continue;
+        for(int i = 0; i < m_levels.size(); ++i) {
+            auto &level = m_levels[i];
+            if(!level.built)
+                continue;
+            const auto oldKey = cellKey(member.pos, i);
+            const auto newKey = cellKey(pos, i);
+            if(oldKey == newKey) {
+                level.cells[oldKey].sum += pos - member.pos;
+                continue;
+            }
+            takeCell(level, i, member.pos);
+            insertCell(level, i, pos);
+            if(i == m_level)
+                m_visibilityDirty = true;
+        }
+        member.pos = pos;
+        moved = true;
+    }
+    m_moved.clear();
+
+    // 2.show or hide the members only when the clusters changed
+    if(m_visibilityDirty)
+        updateVisibility();
+    if(moved)
+        update();
+}
+
+void MapClusterLayer::setPen(const QPen &pen)
+{
+    m_pen = pen;
+    update();
+}
+
+void MapClusterLayer::setBrush(const QBrush &brush)
+{
+    m_brush = brush;
+    update();
+}
+
+void MapClusterLayer::setFont(const QFont &font)
+{
+    m_font = font;
+    update();
+}
+
+void MapClusterLayer::setTextColor(const QColor &color)
+{
+    m_textColor = color;
+    update();
+}
+
+QVector<MapObjectItem *> MapClusterLayer::clusterAt(const QGraphicsView *view, const QPoint &pos) const
+{
+    QVector<MapObjectItem*> result;
+    if(!view || m_level < 0)
+        return result;
+    const auto transform = view->viewportTransform();
+    const auto &cells = m_levels.at(m_level).cells;
+    quint64 hitKey = 0;
+    bool hit = false;
+    for(auto iter = cells.constBegin(); iter != cells.constEnd(); ++iter) {
+        const auto &cell = iter.value();
+        if(cell.count < m_minimumCount)
+            continue;
+        const auto center = transform.map(cell.sum / cell.count);
+        const auto offset = center - QPointF(pos);
+        const qreal radius = markerRadius(cell.count);
+        if(QPointF::dotProduct(offset, offset) <= radius * radius) {
+            hitKey = iter.key();
+            hit = true;
+            break;
+        }
+    }
+    if(!hit)
+        return result;
+    for(auto iter = m_members.constBegin(); iter != m_members.constEnd(); ++iter) {
+        if(cellKey(iter.value().pos, m_level) == hitKey)
+            result.append(iter.key());
+    }
+    return result;
+}
+
+void MapClusterLayer::zoomTo(const QVector<MapObjectItem *> &items) const
+{
+    auto map = GraphicsMap::fromScene(scene());
+    if(!map || items.isEmpty())
+        return;
+    QRectF rect(memberPos(items.first()), QSizeF());
+    for(auto item : items) {
+        const auto pos = memberPos(item);
+        rect.setLeft(qMin(rect.left(), pos.x()));
+        rect.setRight(qMax(rect.right(), pos.x()));
+        rect.setTop(qMin(rect.top(), pos.y()));
+        rect.setBottom(qMax(rect.bottom(), pos.y()));
+    }
+    // the scene is 1:1 at ZoomBase, each level doubles the scale
+    const auto viewport = map->viewport()->size();
+    qreal scale = 0;
+    if(rect.width() > 0)
+        scale = viewport.width() * ZOOM_MARGIN / rect.width();
+    if(rect.height() > 0) {
+        const qreal scaleY = viewport.height() * ZOOM_MARGIN / rect.height();
+        scale = scale > 0 ? qMin(scale, scaleY) : scaleY;
+    }
+    // members at the same position, zoom in until they are shown one by one
+    float zoom = scale > 0 ? MapScene::ZoomBase + std::log2(scale) : m_maximumZoom;
+    // at least one level deeper, so that the cluster splits
+    zoom = qBound(float(m_level + 1), zoom, float(m_maximumZoom));
+    map->setZoomLevel(zoom);
+    map->centerOn(rect.center());
+}
+
+/// 覆盖两种瓦片方案的整个场景，聚合标记的裁剪在paint中完成
+QRectF MapClusterLayer::boundingRect() const
+{
+    return QRectF(-MapScene::Length, -MapScene::Length, MapScene::Length * 2, MapScene::Length * 2);
+}
+
+void MapClusterLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget)
+    if(m_level < 0)
+        return;
+    const auto world = painter->worldTransform();
+    const qreal scale = qSqrt(world.m11() * world.m11() + world.m12() * world.m12());
+    if(scale <= 0)
+        return;
+    const qreal margin = markerRadius(m_members.size()) / scale;
+    const QRectF visible = option->exposedRect.adjusted(-margin, -margin, margin, margin);
+
+    // draw markers in device coordinates so that they keep the screen size
+    painter->setWorldTransform(QTransform());
+    painter->setBrush(m_brush);
+    painter->setFont(m_font);
+    const auto &cells = m_levels.at(m_level).cells;
+    for(const auto &cell : cells) {
+        if(cell.count < m_minimumCount)
+            continue;
+        const auto center = cell.sum / cell.count;
+        if(!visible.contains(center))
+            continue;
+        const auto point = world.map(center);
+        const qreal radius = markerRadius(cell.count);
+        const QRectF rect(point.x() - radius, point.y() - radius, radius * 2, radius * 2);
+        painter->setPen(m_pen);
+        painter->drawEllipse(rect);
+        painter->setPen(m_textColor);
+        painter->drawText(rect, Qt::AlignCenter, QString::number(cell.count));
+    }
+    painter->setWorldTransform(world);
+}
+
+QVariant MapClusterLayer::itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value)
+{
+    if(change != ItemSceneHasChanged)
+        return QGraphicsItem::itemChange(change, value);
+
+    disconnect(m_zoomConnection);
+    if(auto map = GraphicsMap::fromScene(scene())) {
+        m_zoomConnection = connect(map, &GraphicsMap::zoomChanged, this, &MapClusterLayer::updateZoom);
+        updateZoom(map->zoomLevel());
+    }
+    return QGraphicsItem::itemChange(change, value);
+}
+
+void MapClusterLayer::mousePressEvent(QGraphicsSceneMouseEvent *event)
+{
+    // let the event go through to the items below if no cluster is pressed
+    auto view = event->widget() ? qobject_cast<QGraphicsView*>(event->widget()->parentWidget()) : nullptr;
+    const auto items = clusterAt(view, view ? view->mapFromScene(event->scenePos()) : QPoint());
+    if(items.isEmpty()) {
+        event->ignore();
+        return;
+    }
+    emit clusterClicked(items);
+    zoomTo(items);
+}
+
+void MapClusterLayer::updateZoom(const float &zoom)
+{
+    const int level = zoom >= m_maximumZoom ? -1 : qBound(0, qFloor(zoom), CLUSTER_LEVELS - 1);
+    if(m_level == level)
+        return;
+    m_level = level;
+    if(m_level >= 0)
+        buildLevel(m_level);
+    updateVisibility();
+    update();
+}
+
+void MapClusterLayer::removeMember(MapObjectItem *item, bool restore)
+{
+    auto iter = m_members.find(item);
+    if(iter == m_members.end())
+        return;
+    for(int i = 0; i < m_levels.size(); ++i) {
+        if(m_levels.at(i).built)
+            takeCell(m_levels[i], i, iter.value().pos);
+    }
+    if(restore && iter.value().clustered)
+        item->setVisible(true);
+    m_members.erase(iter);
+    m_moved.remove(item);
+    m_visibilityDirty = true;
+    update();
+}
+
+void MapClusterLayer::markMoved(const QVector<MapObjectItem *> &items)
+{
+    if(m_members.isEmpty())
+        return;
+    for(auto item : items) {
+        if(m_members.contains(item))
+            m_moved.insert(item);
+    }
+}
+
+/// 使用经纬度而不是图元位置，延迟更新和航位推算的对象也按最新的上报位置聚合
+QPointF MapClusterLayer::memberPos(const MapObjectItem *item)
+{
+    const auto &coord = item->mapCoordinate();
+    return coord.isValid() ? GraphicsMap::toScene(coord) : item->pos();
+}
+
+void MapClusterLayer::insertCell(Level &level, int index, const QPointF &pos)
+{
+    auto &cell = level.cells[cellKey(pos, index)];
+    ++cell.count;
+    cell.sum += pos;
+}
+
+void MapClusterLayer::takeCell(Level &level, int index, const QPointF &pos)
+{
+    auto iter = level.cells.find(cellKey(pos, index));
+    if(iter == level.cells.end())
+        return;
+    if(--iter.value().count == 0)
+        level.cells.erase(iter);
+    else
+        iter.value().sum -= pos;
+}
+
+/// 由更细一级的网格合并得到，每4个网格合并为1个，没有时遍历对象
+void MapClusterLayer::buildLevel(int index)
+{
+    auto &level = m_levels[index];
+    if(level.built)
+        return;
+    level.cells.clear();
+    if(index + 1 < m_levels.size() && m_levels.at(index + 1).built) {
+        const auto &finer = m_levels.at(index + 1).cells;
+        level.cells.reserve(finer.size());
+        for(auto iter = finer.constBegin(); iter != finer.constEnd(); ++iter) {
+            // arithmetic shift is the floor division for negative cells
+            const qint32 x = qint32(iter.key() >> 32) >> 1;
+            const qint32 y = qint32(iter.key() & 0xFFFFFFFF) >> 1;
+            auto &cell = level.cells[quint64(quint32(x)) << 32 | quint32(y)];
+            cell.count += iter.value().count;
+            cell.sum += iter.value().sum;
+        }
+    }
+    else {
+        for(const auto &member : qAsConst(m_members)) {
+            insertCell(level, index, member.pos);
+        }
+    }
+    level.built = true;
+}
+
+void MapClusterLayer::resetLevels()
+{
+    for(auto &level : m_levels) {
+        level.built = false;
+        level.cells.clear();
+    }
+    if(m_level >= 0)
+        buildLevel(m_level);
+    m_visibilityDirty = true;
+}
+
+void MapClusterLayer::updateVisibility()
+{
+    m_visibilityDirty = false;
+    const QHash<quint64, Cell> empty;
+    const auto &cells = m_level >= 0 ? m_levels.at(m_level).cells : empty;
+    for(auto iter = m_members.begin(); iter != m_members.end(); ++iter) {
+        auto &member = iter.value();
+        const bool clustered = m_level >= 0 && cells.value(cellKey(member.pos, m_level)).count >= m_minimumCount;
+        if(member.clustered == clustered)
+            continue;
+        member.clustered = clustered;
+        iter.key()->setVisible(!clustered);
+    }
+}
+
+/// 网格边长为聚合距离在该层级下对应的场景长度，相邻层级正好相差2倍
+quint64 MapClusterLayer::cellKey(const QPointF &pos, int level) const
+{
+    const qreal size = m_distance * qPow(2, MapScene::ZoomBase - level);
+    const auto x = qint32(qFloor(pos.x() / size));
+    const auto y = qint32(qFloor(pos.y() / size));
+    return quint64(quint32(x)) << 32 | quint32(y);
+}
+
+qreal MapClusterLayer::markerRadius(int count) const
+{
+    return MARKER_RADIUS + 4 * std::log10(qMax(count, 1));
+}
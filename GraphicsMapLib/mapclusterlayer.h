@@ -0,0 +1,127 @@
+﻿#ifndef MAPCLUSTERLAYER_H
+#define MAPCLUSTERLAYER_H
+
+#include <QObject>
+#include <QGraphicsItem>
+#include <QHash>
+#include <QPen>
+#include <QBrush>
+#include <QFont>
+#include "mapframetimer.h"
+#include <QSet>
+
+class QGraphicsView;
+class MapObjectItem;
+
+/*!
+ * \brief 对象聚合图层
+ * \details 在低缩放层级下把屏幕上距离过近的MapObjectItem合并为带数量的聚合标记：
+ * 1.每个整数层级一张网格，网格边长为聚合距离对应的场景长度，同一网格内的对象属于同一聚合，相邻层级的网格正好是2×2的关系；
+ * 2.网格只记录数量和坐标和，切换到新的层级时由已有的更细层级合并得到，没有时才遍历对象；
+ * 3.对象的coordinateChanged、coordinateDragged和MapObjectItem::applyBatch的批量通知只记录移动的对象，
+ * 每帧只把这些对象按新的经纬度移到各层级的网格中；
+ * 4.点击聚合标记时缩放到其包含的对象
+ * \note 聚合中的对象由图层隐藏，移出图层时恢复显示，因此不要在外部修改这些对象的可见性
+ */
+class MapClusterLayer : public QObject, public QGraphicsItem
+{
+    Q_OBJECT
+public:
+    MapClusterLayer();
+    ~MapClusterLayer();
+    /// 添加对象
+    void add(MapObjectItem *item);
+    void add(const QVector<MapObjectItem*> &items);
+    /// 移出对象，并恢复显示
+    void remove(MapObjectItem *item);
+    void clear();
+    /// 对象数量
+    int count() const;
+    /// 设置聚合距离，单位像素，默认60
+    void setDistance(int pixel);
+    int distance() const;
+    /// 设置聚合的最少对象数量，默认2
+    void setMinimumCount(int count);
+    int minimumCount() const;
+    /// 设置不再聚合的缩放层级，默认16
+    void setMaximumZoom(int zoom);
+    int maximumZoom() const;
+    /// 设置每秒处理移动对象的次数，默认10，0表示关闭，由外部调用sync
+    void setFrameRate(int fps);
+    /// 立即处理移动的对象
+    void sync();
+    /// 设置聚合标记的样式
+    void setPen(const QPen &pen);
+    void setBrush(const QBrush &brush);
+    void setFont(const QFont &font);
+    void setTextColor(const QColor &color);
+    /// 获取视图坐标处的聚合包含的对象
+    QVector<MapObjectItem*> clusterAt(const QGraphicsView *view, const QPoint &pos) const;
+    /// 缩放地图到对象
+    void zoomTo(const QVector<MapObjectItem*> &items) const;
+
+signals:
+    /// 点击聚合标记，随后地图会缩放到这些对象
+    void clusterClicked(const QVector<MapObjectItem*> &items);
+
+public:
+    virtual QRectF boundingRect() const override;
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+
+protected:
+    virtual QVariant itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value) override;
+    virtual void mousePressEvent(QGraphicsSceneMouseEvent *event) override;
+
+private:
+    /// 网格
+    struct Cell
+    {
+        int     count = 0;  ///< 对象数量
+        QPointF sum;        ///< 场景坐标和，用于计算聚合中心
+    };
+    /// 某个层级的所有网格
+    struct Level
+    {
+        bool                  built = false;
+        QHash<quint64, Cell>  cells;
+    };
+    /// 对象状态
+    struct Member
+    {
+        QPointF pos;        ///< 上次同步时经纬度对应的场景坐标
+        bool    clustered;  ///< 是否被聚合隐藏
+    };
+
+private:
+    void updateZoom(const float &zoom);
+    void removeMember(MapObjectItem *item, bool restore);
+    void markMoved(const QVector<MapObjectItem*> &items);
+    static QPointF memberPos(const MapObjectItem *item);
+    void insertCell(Level &level, int index, const QPointF &pos);
+    void takeCell(Level &level, int index, const QPointF &pos);
+    void buildLevel(int index);
+    void resetLevels();
+    void updateVisibility();
+    quint64 cellKey(const QPointF &pos, int level) const;
+    qreal markerRadius(int count) const;
+
+private:
+    QHash<MapObjectItem*, Member> m_members;    ///< 所有对象
+    QSet<MapObjectItem*>    m_moved;            ///< 上次同步后移动的对象
+    QVector<Level>  m_levels;           ///< 各层级的网格
+    int             m_level;            ///< 当前层级，-1表示不聚合
+    bool            m_visibilityDirty;  ///< 是否需要重新判断对象的显示
+    //
+    int     m_distance;
+    int     m_minimumCount;
+    int     m_maximumZoom;
+    QPen    m_pen;
+    QBrush  m_brush;
+    QFont   m_font;
+    QColor  m_textColor;
+    //
+    MapFrameTimer           m_frameTimer;       ///< 帧定时器
+    QMetaObject::Connection m_zoomConnection;   ///< 与所在地图缩放信号的连接
+};
+
+#endif // MAPCLUSTERLAYER_H
@@ -0,0 +1,365 @@
+﻿#include "mapcolorfilter.h"
+#include <QtMath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MAP_COLOR_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define MAP_COLOR_AVX2
+#define MAP_COLOR_AVX2_TARGET
+#include <immintrin.h>
+#elif defined(MAP_COLOR_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// build the AVX2 kernel anyway, and choose it when the CPU supports
+#define MAP_COLOR_AVX2
+#define MAP_COLOR_AVX2_RUNTIME
+#define MAP_COLOR_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+/// 3x4仿射颜色矩阵，out = A * in + b
+struct ColorMatrix {
+    double a[3][3];
+    double b[3];
+};
+
+static ColorMatrix identityMatrix()
+{
+    return {{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}, {0, 0, 0}};
+}
+
+/// 先应用first，再应用second
+static ColorMatrix combine(const ColorMatrix &first, const ColorMatrix &second)
+{
+    ColorMatrix result;
+    for(int row = 0; row < 3; ++row) {
+        for(int col = 0; col < 3; ++col) {
+            result.a[row][col] = second.a[row][0] * first.a[0][col]
+                    + second.a[row][1] * first.a[1][col]
+                    + second.a[row][2] * first.a[2][col];
+        }
+        result.b[row] = second.a[row][0] * first.b[0]
+                + second.a[row][1] * first.b[1]
+                + second.a[row][2] * first.b[2]
+                + second.b[row];
+    }
+    return result;
+}
+
+/// 按强度在原图和效果之间插值
+static ColorMatrix mix(const ColorMatrix &effect, qreal strength)
+{
+    auto identity = identityMatrix();
+    ColorMatrix result;
+    for(int row = 0; row < 3; ++row) {
+        for(int col = 0; col < 3; ++col) {
+            result.a[row][col] = identity.a[row][col] + (effect.a[row][col] - identity.a[row][col]) * strength;
+        }
+        result.b[row] = effect.b[row] * strength;
+    }
+    return result;
+}
+
+/// 亮度权重，和qGray一致
+static const double LUMA[3] = {11.0/32, 16.0/32, 5.0/32};
+
+static void colorMatrixScalar(quint32 *pixels, int count, const float m[12])
+{
+    for(int i = 0; i < count; ++i) {
+        quint32 pixel = pixels[i];
+        float r = (pixel >> 16) & 0xff;
+        float g = (pixel >> 8) & 0xff;
+        float b = pixel & 0xff;
+        float channels[3];
+        for(int row = 0; row < 3; ++row) {
+            float value = m[row*4] * r + m[row*4+1] * g + m[row*4+2] * b + m[row*4+3];
+            channels[row] = value < 0 ? 0 : (value > 255 ? 255 : value);
+        }
+        pixels[i] = (pixel & 0xff000000)
+                | (quint32(channels[0] + 0.5f) << 16)
+                | (quint32(channels[1] + 0.5f) << 8)
+                | quint32(channels[2] + 0.5f);
+    }
+}
+
+#ifdef MAP_COLOR_SSE2
+/// 每次处理4个像素
+static int colorMatrixSSE2(quint32 *pixels, int count, const float m[12])
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i alphaMask = _mm_set1_epi32(int(0xff000000));
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 max = _mm_set1_ps(255.0f);
+    __m128 coef[12];
+    for(int i = 0; i < 12; ++i)
+        coef[i] = _mm_set1_ps(m[i]);
+
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i pixel = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+        __m128 r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixel, 16), mask));
+        __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixel, 8), mask));
+        __m128 b = _mm_cvtepi32_ps(_mm_and_si128(pixel, mask));
+        __m128i channels[3];
+        for(int row = 0; row < 3; ++row) {
+            __m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(coef[row*4], r), _mm_mul_ps(coef[row*4+1], g)),
+                                      _mm_add_ps(_mm_mul_ps(coef[row*4+2], b), coef[row*4+3]));
+            value = _mm_min_ps(_mm_max_ps(value, zero), max);
+            channels[row] = _mm_cvtps_epi32(value);
+        }
+        __m128i result = _mm_or_si128(_mm_and_si128(pixel, alphaMask),
+                                      _mm_or_si128(_mm_slli_epi32(channels[0], 16),
+                                                   _mm_or_si128(_mm_slli_epi32(channels[1], 8), channels[2])));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i), result);
+    }
+    return i;
+}
+#endif
+
+#ifdef MAP_COLOR_AVX2
+/// 每次处理8个像素
+MAP_COLOR_AVX2_TARGET static int colorMatrixAVX2(quint32 *pixels, int count, const float m[12])
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256i alphaMask = _mm256_set1_epi32(int(0xff000000));
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 max = _mm256_set1_ps(255.0f);
+    __m256 coef[12];
+    for(int i = 0; i < 12; ++i)
+        coef[i] = _mm256_set1_ps(m[i]);
+
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i pixel = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + i));
+        __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixel, 16), mask));
+        __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixel, 8), mask));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(pixel, mask));
+        __m256i channels[3];
+        for(int row = 0; row < 3; ++row) {
+            __m256 value = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(coef[row*4], r), _mm256_mul_ps(coef[row*4+1], g)),
+                                         _mm256_add_ps(_mm256_mul_ps(coef[row*4+2], b), coef[row*4+3]));
+            value = _mm256_min_ps(_mm256_max_ps(value, zero), max);
+            channels[row] = _mm256_cvtps_epi32(value);
+        }
+        __m256i result = _mm256_or_si256(_mm256_and_si256(pixel, alphaMask),
+                                         _mm256_or_si256(_mm256_slli_epi32(channels[0], 16),
+                                                         _mm256_or_si256(_mm256_slli_epi32(channels[1], 8), channels[2])));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + i), result);
+    }
+    return i;
+}
+#endif
+
+/// 按CPU支持的最宽指令集处理，剩余不足一组的像素使用标量处理
+static void colorMatrix(quint32 *pixels, int count, const float m[12])
+{
+    int done = 0;
+#if defined(MAP_COLOR_AVX2_RUNTIME)
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    if(hasAVX2)
+        done = colorMatrixAVX2(pixels, count, m);
+    else
+        done = colorMatrixSSE2(pixels, count, m);
+#elif defined(MAP_COLOR_AVX2)
+    done = colorMatrixAVX2(pixels, count, m);
+#elif defined(MAP_COLOR_SSE2)
+    done = colorMatrixSSE2(pixels, count, m);
+#endif
+    colorMatrixScalar(pixels + done, count - done, m);
+}
+
+MapColorFilter::MapColorFilter() :
+    m_brightness(0),
+    m_contrast(1),
+    m_grayscale(0),
+    m_invert(false),
+    m_tintStrength(1),
+    m_colorizeStrength(1)
+{
+
+}
+
+void MapColorFilter::setBrightness(qreal value)
+{
+    m_brightness = qBound(-1.0, value, 1.0);
+}
+
+qreal MapColorFilter::brightness() const
+{
+    return m_brightness;
+}
+
+void MapColorFilter::setContrast(qreal value)
+{
+    m_contrast = qMax(0.0, value);
+}
+
+qreal MapColorFilter::contrast() const
+{
+    return m_contrast;
+}
+
+void MapColorFilter::setGrayscale(qreal strength)
+{
+    m_grayscale = qBound(0.0, strength, 1.0);
+}
+
+qreal MapColorFilter::grayscale() const
+{
+    return m_grayscale;
+}
+
+void MapColorFilter::setInvert(bool on)
+{
+    m_invert = on;
+}
+
+bool MapColorFilter::isInvert() const
+{
+    return m_invert;
+}
+
+void MapColorFilter::setTint(const QColor &color, qreal strength)
+{
+    m_tintColor = color;
+    m_tintStrength = qBound(0.0, strength, 1.0);
+}
+
+const QColor &MapColorFilter::tintColor() const
+{
+    return m_tintColor;
+}
+
+qreal MapColorFilter::tintStrength() const
+{
+    return m_tintStrength;
+}
+
+void MapColorFilter::setColorize(const QColor &color, qreal strength)
+{
+    m_colorizeColor = color;
+    m_colorizeStrength = qBound(0.0, strength, 1.0);
+}
+
+const QColor &MapColorFilter::colorizeColor() const
+{
+    return m_colorizeColor;
+}
+
+qreal MapColorFilter::colorizeStrength() const
+{
+    return m_colorizeStrength;
+}
+
+bool MapColorFilter::isIdentity() const
+{
+    return qFuzzyIsNull(m_brightness)
+            && qFuzzyCompare(m_contrast, 1.0)
+            && qFuzzyIsNull(m_grayscale)
+            && !m_invert
+            && (!m_tintColor.isValid() || qFuzzyIsNull(m_tintStrength))
+            && (!m_colorizeColor.isValid() || qFuzzyIsNull(m_colorizeStrength));
+}
+
+void MapColorFilter::apply(QImage &image) const
+{
+    if(image.isNull() || isIdentity())
+        return;
+    if(image.format() != QImage::Format_ARGB32 && image.format() != QImage::Format_RGB32)
+        image = image.convertToFormat(QImage::Format_ARGB32);
+
+    float m[12];
+    matrix(m);
+    const int width = image.width();
+    for(int y = 0; y < image.height(); ++y) {
+        colorMatrix(reinterpret_cast<quint32*>(image.scanLine(y)), width, m);
+    }
+}
+
+bool MapColorFilter::operator==(const MapColorFilter &rhs) const
+{
+    return m_brightness == rhs.m_brightness
+            && m_contrast == rhs.m_contrast
+            && m_grayscale == rhs.m_grayscale
+            && m_invert == rhs.m_invert
+            && m_tintColor == rhs.m_tintColor
+            && m_tintStrength == rhs.m_tintStrength
+            && m_colorizeColor == rhs.m_colorizeColor
+            && m_colorizeStrength == rhs.m_colorizeStrength;
+}
+
+MapColorFilter MapColorFilter::nightMode()
+{
+    MapColorFilter filter;
+    filter.setTint(QColor::fromRgb(255, 72, 40));
+    filter.setContrast(0.9);
+    filter.setBrightness(-0.15);
+    return filter;
+}
+
+void MapColorFilter::matrix(float m[12]) const
+{
+    auto result = identityMatrix();
+    // 1.grayscale
+    if(m_grayscale > 0) {
+        ColorMatrix gray;
+        for(int row = 0; row < 3; ++row) {
+            for(int col = 0; col < 3; ++col)
+                gray.a[row][col] = LUMA[col];
+            gray.b[row] = 0;
+        }
+        result = combine(result, mix(gray, m_grayscale));
+    }
+    // 2.colorize: screen blend the color over grayscale, the same as QPixmapColorizeFilter
+    if(m_colorizeColor.isValid() && m_colorizeStrength > 0) {
+        const double color[3] = {m_colorizeColor.redF(), m_colorizeColor.greenF(), m_colorizeColor.blueF()};
+        ColorMatrix colorize;
+        for(int row = 0; row < 3; ++row) {
+            for(int col = 0; col < 3; ++col)
+                colorize.a[row][col] = LUMA[col] * (1 - color[row]);
+            colorize.b[row] = 255 * color[row];
+        }
+        result = combine(result, mix(colorize, m_colorizeStrength));
+    }
+    // 3.tint: multiply the color with grayscale
+    if(m_tintColor.isValid() && m_tintStrength > 0) {
+        const double color[3] = {m_tintColor.redF(), m_tintColor.greenF(), m_tintColor.blueF()};
+        ColorMatrix tint;
+        for(int row = 0; row < 3; ++row) {
+            for(int col = 0; col < 3; ++col)
+                tint.a[row][col] = LUMA[col] * color[row];
+            tint.b[row] = 0;
+        }
+        result = combine(result, mix(tint, m_tintStrength));
+    }
+    // 4.contrast around the middle gray
+    if(!qFuzzyCompare(m_contrast, 1.0)) {
+        auto contrast = identityMatrix();
+        for(int row = 0; row < 3; ++row) {
+            contrast.a[row][row] = m_contrast;
+            contrast.b[row] = 127.5 * (1 - m_contrast);
+        }
+        result = combine(result, contrast);
+    }
+    // 5.brightness
+    if(!qFuzzyIsNull(m_brightness)) {
+        auto brightness = identityMatrix();
+        for(int row = 0; row < 3; ++row)
+            brightness.b[row] = 255 * m_brightness;
+        result = combine(result, brightness);
+    }
+    // 6.invert
+    if(m_invert) {
+        auto invert = identityMatrix();
+        for(int row = 0; row < 3; ++row) {
+            invert.a[row][row] = -1;
+            invert.b[row] = 255;
+        }
+        result = combine(result, invert);
+    }
+    //
+    for(int row = 0; row < 3; ++row) {
+        for(int col = 0; col < 3; ++col)
+            m[row*4+col] = float(result.a[row][col]);
+        m[row*4+3] = float(result.b[row]);
+    }
+}
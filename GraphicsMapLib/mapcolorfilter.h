@@ -0,0 +1,67 @@
+﻿#ifndef MAPCOLORFILTER_H
+#define MAPCOLORFILTER_H
+
+#include <QColor>
+#include <QImage>
+#include <QMetaType>
+
+/*!
+ * \brief 颜色滤镜
+ * \details 将灰度、着色、对比度、亮度、反色等效果组合成一个仿射颜色矩阵，每个像素只需计算一次矩阵乘法，
+ * 逐像素计算使用SSE2/AVX2向量化实现(编译器不支持时使用标量实现)
+ * 效果的应用顺序为：灰度->上色(Colorize)->着色(Tint)->对比度->亮度->反色
+ * \note 该类不依赖GUI线程，可以在瓦片加载线程中使用
+ */
+class MapColorFilter
+{
+public:
+    MapColorFilter();
+    /// 设置亮度 [-1, 1]，0为原图
+    void setBrightness(qreal value);
+    qreal brightness() const;
+    /// 设置对比度 [0, N]，1为原图
+    void setContrast(qreal value);
+    qreal contrast() const;
+    /// 设置灰度 [0, 1]，0为原图，1为完全灰度
+    void setGrayscale(qreal strength);
+    qreal grayscale() const;
+    /// 设置反色
+    void setInvert(bool on);
+    bool isInvert() const;
+    /// 设置着色，将灰度值与颜色相乘，适合夜间模式等整体偏色，传QColor()可以取消
+    void setTint(const QColor &color, qreal strength = 1.0);
+    const QColor &tintColor() const;
+    qreal tintStrength() const;
+    /// 设置上色，效果等同于QGraphicsColorizeEffect，传QColor()可以取消
+    void setColorize(const QColor &color, qreal strength = 1.0);
+    const QColor &colorizeColor() const;
+    qreal colorizeStrength() const;
+    /// 是否为原图效果
+    bool isIdentity() const;
+    /// 就地处理图像，非ARGB32/RGB32格式的图像会先被转换为ARGB32格式
+    void apply(QImage &image) const;
+
+    bool operator==(const MapColorFilter &rhs) const;
+    inline bool operator!=(const MapColorFilter &rhs) const { return !(*this == rhs); }
+
+public:
+    /// 夜间模式：降低亮度并整体偏红
+    static MapColorFilter nightMode();
+
+private:
+    /// 计算3x4仿射颜色矩阵，每行依次为R、G、B的系数和偏移，通道取值范围[0, 255]
+    void matrix(float m[12]) const;
+
+private:
+    qreal  m_brightness;
+    qreal  m_contrast;
+    qreal  m_grayscale;
+    bool   m_invert;
+    QColor m_tintColor;
+    qreal  m_tintStrength;
+    QColor m_colorizeColor;
+    qreal  m_colorizeStrength;
+};
+Q_DECLARE_METATYPE(MapColorFilter);
+
+#endif // MAPCOLORFILTER_H
@@ -0,0 +1,70 @@
+﻿#ifndef MAPCOORDINATE_H
+#define MAPCOORDINATE_H
+
+#include <QGeoCoordinate>
+#include <QtMath>
+#include <QVector>
+
+/*!
+ * \brief 轻量经纬度坐标
+ * \details QGeoCoordinate使用了私有实现(pimpl)，每个实例都需要一次堆内存分配，比较时也需要访问私有对象，
+ * 该类型只包含三个double，可以按值拷贝、放在QVector中连续存储，适合在图元内部和批量接口中使用，
+ * 仅在公开接口处与QGeoCoordinate相互转换
+ * \note 比较规则与QGeoCoordinate一致：经纬度模糊比较，高度同为NaN或者模糊相等
+ */
+struct MapCoordinate
+{
+    double latitude;    ///< 纬度，无效时为NaN
+    double longitude;   ///< 经度，无效时为NaN
+    double altitude;    ///< 高度，未设置时为NaN
+
+    inline MapCoordinate() : latitude(qQNaN()), longitude(qQNaN()), altitude(qQNaN()) {}
+    inline MapCoordinate(double lat, double lon, double alt = qQNaN()) : latitude(lat), longitude(lon), altitude(alt) {}
+    /// 从QGeoCoordinate隐式转换，便于原有接口直接使用
+    inline MapCoordinate(const QGeoCoordinate &coord) :
+        latitude(coord.latitude()), longitude(coord.longitude()), altitude(coord.altitude()) {}
+
+    /// 转换为QGeoCoordinate，会产生一次堆内存分配
+    inline QGeoCoordinate toGeoCoordinate() const {
+        if(!isValid())
+            return QGeoCoordinate();
+        return qIsNaN(altitude) ? QGeoCoordinate(latitude, longitude) : QGeoCoordinate(latitude, longitude, altitude);
+    }
+    /// 经纬度是否在有效范围内，与QGeoCoordinate::isValid一致
+    inline bool isValid() const {
+        return latitude >= -90 && latitude <= 90 && longitude >= -180 && longitude <= 180;
+    }
+
+    inline bool operator==(const MapCoordinate &rhs) const {
+        bool latEqual = (qIsNaN(latitude) && qIsNaN(rhs.latitude)) || qFuzzyCompare(latitude, rhs.latitude);
+        bool lonEqual = (qIsNaN(longitude) && qIsNaN(rhs.longitude)) || qFuzzyCompare(longitude, rhs.longitude);
+        bool altEqual = (qIsNaN(altitude) && qIsNaN(rhs.altitude)) || qFuzzyCompare(altitude, rhs.altitude);
+        // NOTE: the same as QGeoCoordinate, all longitudes are the same point at the poles
+        if(latEqual && (latitude == 90.0 || latitude == -90.0))
+            lonEqual = true;
+        return latEqual && lonEqual && altEqual;
+    }
+    inline bool operator!=(const MapCoordinate &rhs) const { return !(*this == rhs); }
+
+public:
+    /// 批量转换
+    static inline QVector<MapCoordinate> fromGeoCoordinates(const QVector<QGeoCoordinate> &coords) {
+        QVector<MapCoordinate> result;
+        result.reserve(coords.size());
+        for(const auto &coord : coords)
+            result.append(coord);
+        return result;
+    }
+    static inline QVector<QGeoCoordinate> toGeoCoordinates(const QVector<MapCoordinate> &coords) {
+        QVector<QGeoCoordinate> result;
+        result.reserve(coords.size());
+        for(const auto &coord : coords)
+            result.append(coord.toGeoCoordinate());
+        return result;
+    }
+};
+/// 默认构造为无效坐标，不能按Q_PRIMITIVE_TYPE用memset(0)构造，搬移时仍可直接复制内存
+Q_DECLARE_TYPEINFO(MapCoordinate, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(MapCoordinate);
+
+#endif // MAPCOORDINATE_H
@@ -1,5 +1,6 @@
 ﻿#include "mapellipseitem.h"
 #include "graphicsmap.h"
+#include "mapspatialindex.h"
 #include <QGraphicsSceneMouseEvent>
 #include <QGraphicsSceneHoverEvent>
 #include <QPen>
@@ -9,7 +10,10 @@ QSet<MapEllipseItem*> MapEllipseItem::m_items;
 MapEllipseItem::MapEllipseItem():
     m_editable(false),
     m_center(0,0),
-    m_size(1e3, 1e3)
+    m_size(1e3, 1e3),
+    m_rectCtrl(nullptr),
+    m_firstCtrl(nullptr),
+    m_secondCtrl(nullptr)
 {
     // keep the outline width of 1-pixel when item scales
     auto pen = this->pen();
@@ -17,30 +21,6 @@ MapEllipseItem::MapEllipseItem():
     pen.setCosmetic(true);
     this->setPen(pen);
     //
-    m_firstCtrl.setRect(-4, -4, 8, 8);
-    m_secondCtrl.setRect(-4, -4, 8, 8);
-    m_rectCtrl.setParentItem(this);
-    m_firstCtrl.setParentItem(this);
-    m_secondCtrl.setParentItem(this);
-    //
-    pen.setColor(Qt::lightGray);
-    pen.setStyle(Qt::DashLine);
-    m_rectCtrl.setPen(pen);
-    m_firstCtrl.setAcceptHoverEvents(true);
-    m_firstCtrl.setPen(QPen(Qt::gray));
-    m_firstCtrl.setBrush(Qt::lightGray);
-    m_firstCtrl.setCursor(Qt::DragMoveCursor);
-    m_firstCtrl.setFlag(QGraphicsItem::ItemIgnoresTransformations);
-    m_firstCtrl.setFlag(QGraphicsItem::ItemIsMovable);
-    m_firstCtrl.setCursor(Qt::DragMoveCursor);
-    m_secondCtrl.setAcceptHoverEvents(true);
-    m_secondCtrl.setPen(QPen(Qt::gray));
-    m_secondCtrl.setBrush(Qt::lightGray);
-    m_secondCtrl.setCursor(Qt::DragMoveCursor);
-    m_secondCtrl.setFlag(QGraphicsItem::ItemIgnoresTransformations);
-    m_secondCtrl.setFlag(QGraphicsItem::ItemIsMovable);
-    m_secondCtrl.setCursor(Qt::DragMoveCursor);
-    //
     m_items.insert(this);
     updateEditable();
 }
@@ -48,6 +28,7 @@ MapEllipseItem::MapEllipseItem():
 MapEllipseItem::~MapEllipseItem()
 {
     m_items.remove(this);
+    MapSpatialIndex::instance()->remove(this);
 }
 
 void MapEllipseItem::setEditable(const bool &editable)
@@ -161,17 +142,17 @@ const QSet<MapEllipseItem *> &MapEllipseItem::items()
 
 bool MapEllipseItem::sceneEventFilter(QGraphicsItem *watched, QEvent *event)
 {
-    if(!m_editable)
+    if(!m_editable || !m_firstCtrl)
         return false;
-    auto ctrlPoint = watched == &m_firstCtrl ? &m_firstCtrl : &m_secondCtrl;
+    auto ctrlPoint = watched == m_firstCtrl ? m_firstCtrl : m_secondCtrl;
     switch (event->type()) {
     case QEvent::GraphicsSceneMouseMove:
     case QEvent::GraphicsSceneMouseRelease:
     {
         // We should to compute center and size
         // and then update ellipse item rect
-        auto firstCtrl = watched == &m_firstCtrl ? &m_firstCtrl : &m_secondCtrl;
-        auto secondCtrl = firstCtrl == &m_firstCtrl ? &m_secondCtrl : &m_firstCtrl;
+        auto firstCtrl = watched == m_firstCtrl ? m_firstCtrl : m_secondCtrl;
+        auto secondCtrl = firstCtrl == m_firstCtrl ? m_secondCtrl : m_firstCtrl;
         // compute center
         auto centerPoint = (firstCtrl->pos() + secondCtrl->pos()) / 2;
         m_center = GraphicsMap::toCoordinate(centerPoint);
@@ -202,8 +183,9 @@ bool MapEllipseItem::sceneEventFilter(QGraphicsItem *watched, QEvent *event)
         m_size.setHeight(GraphicsMap::toCoordinate(topPoint).distanceTo(GraphicsMap::toCoordinate(bottomPoint)));
         auto topLeftPoint = QPointF(left, top);
         auto bottomRightPoint = QPointF(right, bottom);
-        m_rectCtrl.setRect({topLeftPoint, bottomRightPoint});
+        m_rectCtrl->setRect({topLeftPoint, bottomRightPoint});
         QGraphicsEllipseItem::setRect({topLeftPoint, bottomRightPoint});
+        updateIndex();
         //
         emit centerChanged(m_center);
         emit sizeChanged(m_size);
@@ -234,8 +216,10 @@ QVariant MapEllipseItem::itemChange(QGraphicsItem::GraphicsItemChange change, co
    if(change != ItemSceneHasChanged)
        return QGraphicsEllipseItem::itemChange(change, value);
 
-   m_firstCtrl.installSceneEventFilter(this);
-   m_secondCtrl.installSceneEventFilter(this);
+   if(m_firstCtrl && scene()) {
+       m_firstCtrl->installSceneEventFilter(this);
+       m_secondCtrl->installSceneEventFilter(this);
+   }
    return QGraphicsEllipseItem::itemChange(change, value);
 }
 
@@ -256,10 +240,13 @@ void MapEllipseItem::updateEllipse()
     auto bottomRightPoint = GraphicsMap::toScene(m_bottomRightCoord);
     // update ellipse outlook
     QGraphicsEllipseItem::setRect({topLeftPoint, bottomRightPoint});
+    updateIndex();
     // update ellipse's contorl points
-    m_firstCtrl.setPos(topLeftPoint);
-    m_secondCtrl.setPos(bottomRightPoint);
-    m_rectCtrl.setRect({topLeftPoint, bottomRightPoint});
+    if(!m_firstCtrl)
+        return;
+    m_firstCtrl->setPos(topLeftPoint);
+    m_secondCtrl->setPos(bottomRightPoint);
+    m_rectCtrl->setRect({topLeftPoint, bottomRightPoint});
 }
 
 void MapEllipseItem::updateEditable()
@@ -269,7 +256,51 @@ void MapEllipseItem::updateEditable()
     pen.setColor(m_editable ? Qt::white : Qt::lightGray);
     setPen(pen);
 
-    m_rectCtrl.setVisible(m_editable);
-    m_firstCtrl.setVisible(m_editable);
-    m_secondCtrl.setVisible(m_editable);
+    if(m_editable)
+        createCtrls();
+    if(!m_firstCtrl)
+        return;
+    m_rectCtrl->setVisible(m_editable);
+    m_firstCtrl->setVisible(m_editable);
+    m_secondCtrl->setVisible(m_editable);
+}
+
+/// 控制点只在第一次编辑时创建，大量不编辑的图形不再各自携带三个子图元
+void MapEllipseItem::createCtrls()
+{
+    if(m_firstCtrl)
+        return;
+    m_rectCtrl = new QGraphicsRectItem(this);
+    m_firstCtrl = new QGraphicsEllipseItem(-4, -4, 8, 8, this);
+    m_secondCtrl = new QGraphicsEllipseItem(-4, -4, 8, 8, this);
+    //
+    auto pen = this->pen();
+    pen.setWidth(1);
+    pen.setColor(Qt::lightGray);
+    pen.setStyle(Qt::DashLine);
+    m_rectCtrl->setPen(pen);
+    for(auto ctrl : {m_firstCtrl, m_secondCtrl}) {
+        ctrl->setAcceptHoverEvents(true);
+        ctrl->setPen(QPen(Qt::gray));
+        ctrl->setBrush(Qt::lightGray);
+        ctrl->setCursor(Qt::DragMoveCursor);
+        ctrl->setFlag(QGraphicsItem::ItemIgnoresTransformations);
+        ctrl->setFlag(QGraphicsItem::ItemIsMovable);
+        // the filter needs both items in the same scene, otherwise itemChange installs it
+        if(scene())
+            ctrl->installSceneEventFilter(this);
+    }
+    //
+    const auto rect = this->rect();
+    m_firstCtrl->setPos(rect.topLeft());
+    m_secondCtrl->setPos(rect.bottomRight());
+    m_rectCtrl->setRect(rect);
+}
+
+/// 按场景中的矩形更新空间索引，拖动控制点时左上和右下经纬度不会更新
+void MapEllipseItem::updateIndex()
+{
+    const auto rect = mapRectToScene(this->rect());
+    MapSpatialIndex::instance()->update(this, MapSpatialIndex::boundingRect({GraphicsMap::toMapCoordinate(rect.topLeft()),
+                                                                             GraphicsMap::toMapCoordinate(rect.bottomRight())}));
 }
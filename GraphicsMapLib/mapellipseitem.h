@@ -47,7 +47,9 @@ protected:
 
 private:
     void updateEllipse();
+    void updateIndex();
     void updateEditable();
+    void createCtrls();
 
 private:
     static QSet<MapEllipseItem*> m_items;         ///< 所有实例
@@ -61,9 +63,9 @@ private:
     QGeoCoordinate m_topLeftCoord;        ///< 左上经纬度
     QGeoCoordinate m_bottomRightCoord;    ///< 右下经纬度
     //
-    QGraphicsRectItem    m_rectCtrl;       ///< 包围矩形（辅助示意)
-    QGraphicsEllipseItem m_firstCtrl;      ///< 对角控制点1
-    QGraphicsEllipseItem m_secondCtrl;     ///< 对角控制点2
+    QGraphicsRectItem    *m_rectCtrl;       ///< 包围矩形（辅助示意)，第一次编辑时创建
+    QGraphicsEllipseItem *m_firstCtrl;      ///< 对角控制点1，第一次编辑时创建
+    QGraphicsEllipseItem *m_secondCtrl;     ///< 对角控制点2，第一次编辑时创建
 };
 
 #endif // MAPELLIPSEITEM_H
@@ -0,0 +1,368 @@
+﻿#include "mapfootprintengine.h"
+#include "graphicsmap.h"
+#include "mapgeodesic.h"
+#include "mapobjectitem.h"
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QtMath>
+
+#define LATITUDE_BAND 0.25      ///< 缩放系数的纬度带，带内误差小于0.8%(纬度60度)
+
+MapFootprintEngine::MapFootprintEngine() :
+    m_count(0),
+    m_scheme(GraphicsMap::sceneScheme())
+{
+    this->setFlag(ItemUsesExtendedStyleOption);
+    // the same default look as MapPieItem and MapTriTrapItem
+    m_piePen.setColor(Qt::lightGray);
+    m_piePen.setWidth(1);
+    m_piePen.setCosmetic(true);
+    m_trianglePen = m_piePen;
+    m_trianglePen.setStyle(Qt::DotLine);
+    m_trapezoidPen = m_piePen;
+    m_trapezoidPen.setColor(Qt::red);
+    //
+    connect(&m_frameTimer, &QTimer::timeout, this, &MapFootprintEngine::checkFrame);
+    setFrameRate(25);
+}
+
+MapFootprintEngine::~MapFootprintEngine()
+{
+
+}
+
+int MapFootprintEngine::add(Shape shape, qreal nearRange, qreal farRange, qreal span, qreal azimuth)
+{
+    Footprint footprint;
+    footprint.used = true;
+    footprint.visible = true;
+    footprint.shape = shape;
+    footprint.nearRange = nearRange;
+    footprint.farRange = farRange;
+    footprint.span = span;
+    footprint.azimuth = azimuth;
+    footprint.unitShape = unitShape(shape, nearRange, farRange, span);
+    footprint.attached = false;
+    footprint.heading = 0;
+    footprint.lastHeading = 0;
+    //
+    int id;
+    if(m_freeIds.isEmpty()) {
+        id = m_footprints.size();
+        m_footprints.append(footprint);
+    }
+    else {
+        id = m_freeIds.takeLast();
+        m_footprints[id] = footprint;
+    }
+    ++m_count;
+    return id;
+}
+
+void MapFootprintEngine::remove(int id)
+{
+    if(id < 0 || id >= m_footprints.size() || !m_footprints.at(id).used)
+        return;
+    releaseShape(m_footprints.at(id).unitShape);
+    m_footprints[id] = Footprint();
+    m_footprints[id].used = false;
+    m_freeIds.append(id);
+    --m_count;
+    update();
+}
+
+void MapFootprintEngine::clear()
+{
+    m_footprints.clear();
+    m_freeIds.clear();
+    m_count = 0;
+    m_shapes.clear();
+    m_shapeKeys.clear();
+    m_freeShapes.clear();
+    m_shapeIndex.clear();
+    update();
+}
+
+int MapFootprintEngine::count() const
+{
+    return m_count;
+}
+
+void MapFootprintEngine::attach(int id, MapObjectItem *platform)
+{
+    if(id < 0 || id >= m_footprints.size() || !m_footprints.at(id).used)
+        return;
+    auto &footprint = m_footprints[id];
+    footprint.attached = platform != nullptr;
+    footprint.platform = platform;
+    update();
+}
+
+void MapFootprintEngine::setPosition(int id, const MapCoordinate &coord, qreal heading)
+{
+    if(id < 0 || id >= m_footprints.size() || !m_footprints.at(id).used)
+        return;
+    auto &footprint = m_footprints[id];
+    footprint.attached = false;
+    footprint.platform = nullptr;
+    footprint.coord = coord;
+    footprint.scenePos = GraphicsMap::toScene(coord);
+    footprint.heading = heading;
+    update();
+}
+
+void MapFootprintEngine::setRange(int id, qreal nearRange, qreal farRange, qreal span)
+{
+    if(id < 0 || id >= m_footprints.size() || !m_footprints.at(id).used)
+        return;
+    auto &footprint = m_footprints[id];
+    footprint.nearRange = nearRange;
+    footprint.farRange = farRange;
+    footprint.span = span;
+    // take the new one first, so an unchanged shape is not released and built again
+    const int previous = footprint.unitShape;
+    footprint.unitShape = unitShape(footprint.shape, nearRange, farRange, span);
+    releaseShape(previous);
+    update();
+}
+
+void MapFootprintEngine::setAzimuth(int id, qreal azimuth)
+{
+    if(id < 0 || id >= m_footprints.size() || !m_footprints.at(id).used)
+        return;
+    m_footprints[id].azimuth = azimuth;
+    update();
+}
+
+void MapFootprintEngine::setFootprintVisible(int id, bool visible)
+{
+    if(id < 0 || id >= m_footprints.size() || !m_footprints.at(id).used)
+        return;
+    m_footprints[id].visible = visible;
+    update();
+}
+
+void MapFootprintEngine::setPen(Shape shape, const QPen &pen)
+{
+    if(shape == Pie)
+        m_piePen = pen;
+    else
+        m_trapezoidPen = pen;
+    update();
+}
+
+void MapFootprintEngine::setTrianglePen(const QPen &pen)
+{
+    m_trianglePen = pen;
+    update();
+}
+
+void MapFootprintEngine::setBrush(Shape shape, const QBrush &brush)
+{
+    if(shape == Pie)
+        m_pieBrush = brush;
+    else
+        m_trapezoidBrush = brush;
+    update();
+}
+
+void MapFootprintEngine::setFrameRate(int fps)
+{
+    m_frameTimer.setFrameRate(fps);
+}
+
+/// 覆盖两种瓦片方案的整个场景，威力区的裁剪在paint中完成
+QRectF MapFootprintEngine::boundingRect() const
+{
+    return QRectF(-MapScene::Length, -MapScene::Length, MapScene::Length * 2, MapScene::Length * 2);
+}
+
+void MapFootprintEngine::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget)
+
+    updateScheme();
+    // 1.apply the position and heading to every footprint in one pass
+    const QRectF exposed = option->exposedRect;
+    m_instances.clear();
+    for(auto &footprint : m_footprints) {
+        if(!footprint.used || !footprint.visible)
+            continue;
+        QPointF center;
+        double latitude;
+        qreal heading;
+        if(footprint.attached) {
+            auto platform = footprint.platform.data();
+            // a recycled platform has no position until it is set again
+            if(!platform || !platform->isVisible() || !platform->mapCoordinate().isValid())
+                continue;
+            center = platform->scenePos();
+            latitude = platform->mapCoordinate().latitude;
+            heading = platform->rotation();
+            footprint.lastPos = center;
+            footprint.lastHeading = heading;
+        }
+        else {
+            if(!footprint.coord.isValid())
+                continue;
+            center = footprint.scenePos;
+            latitude = footprint.coord.latitude;
+            heading = footprint.heading;
+        }
+        auto scale = latitudeScale(latitude);
+        // rotate in meters first, then scale to the scene, so it is also right for non-conformal projections
+        QTransform transform;
+        transform.translate(center.x(), center.y());
+        transform.scale(scale.x(), scale.y());
+        transform.rotate(heading + footprint.azimuth);
+        if(!transform.mapRect(m_shapes.at(footprint.unitShape).bounds).intersects(exposed))
+            continue;
+        m_instances.append({transform, footprint.unitShape, footprint.shape});
+    }
+    if(m_instances.isEmpty())
+        return;
+
+    // 2.draw by style, so the pen and brush are only set once for each batch
+    const auto base = painter->worldTransform();
+    painter->setPen(m_piePen);
+    painter->setBrush(m_pieBrush);
+    for(const auto &instance : qAsConst(m_instances)) {
+        if(instance.shape != Pie)
+            continue;
+        painter->setWorldTransform(instance.transform * base);
+        painter->drawPath(m_shapes.at(instance.unitShape).body);
+    }
+    painter->setPen(m_trianglePen);
+    painter->setBrush(Qt::NoBrush);
+    for(const auto &instance : qAsConst(m_instances)) {
+        if(instance.shape != TriTrap)
+            continue;
+        painter->setWorldTransform(instance.transform * base);
+        painter->drawPath(m_shapes.at(instance.unitShape).triangle);
+    }
+    painter->setPen(m_trapezoidPen);
+    painter->setBrush(m_trapezoidBrush);
+    for(const auto &instance : qAsConst(m_instances)) {
+        if(instance.shape != TriTrap)
+            continue;
+        painter->setWorldTransform(instance.transform * base);
+        painter->drawPath(m_shapes.at(instance.unitShape).body);
+    }
+    painter->setWorldTransform(base);
+}
+
+/// 获取单位形状，相同参数的威力区共用
+int MapFootprintEngine::unitShape(Shape shape, qreal nearRange, qreal farRange, qreal span)
+{
+    const ShapeKey key{shape, shape == Pie ? 0 : nearRange, farRange, span};
+    auto iter = m_shapeIndex.constFind(key);
+    if(iter != m_shapeIndex.constEnd()) {
+        ++m_shapes[iter.value()].refs;
+        return iter.value();
+    }
+    //
+    UnitShape unit;
+    unit.refs = 1;
+    if(shape == Pie) {
+        // qt angle: 90 degrees is north, counterclockwise is positive
+        unit.body.moveTo(0, 0);
+        unit.body.arcTo(QRectF(-farRange, -farRange, farRange * 2, farRange * 2), 90 - span / 2, span);
+        unit.body.closeSubpath();
+    }
+    else {
+        // azimuth: clockwise from north, y is downward
+        auto direction = [](qreal degree, qreal length) {
+            auto radian = qDegreesToRadians(degree);
+            return QPointF(qSin(radian) * length, -qCos(radian) * length);
+        };
+        const auto nearBegin = direction(-span / 2, nearRange);
+        const auto nearEnd = direction(span / 2, nearRange);
+        unit.triangle.addPolygon(QPolygonF({QPointF(0, 0), nearBegin, nearEnd}));
+        unit.triangle.closeSubpath();
+        unit.body.addPolygon(QPolygonF({nearBegin, nearEnd, direction(span / 2, farRange), direction(-span / 2, farRange)}));
+        unit.body.closeSubpath();
+    }
+    unit.bounds = unit.body.controlPointRect().united(unit.triangle.controlPointRect());
+    int index;
+    if(m_freeShapes.isEmpty()) {
+        index = m_shapes.size();
+        m_shapes.append(unit);
+        m_shapeKeys.append(key);
+    }
+    else {
+        index = m_freeShapes.takeLast();
+        m_shapes[index] = unit;
+        m_shapeKeys[index] = key;
+    }
+    m_shapeIndex.insert(key, index);
+    return index;
+}
+
+/// 没有威力区使用时释放单位形状，连续变化的距离不会使形状无限增长
+void MapFootprintEngine::releaseShape(int index)
+{
+    if(index < 0 || index >= m_shapes.size() || m_shapes.at(index).refs <= 0)
+        return;
+    auto &unit = m_shapes[index];
+    if(--unit.refs > 0)
+        return;
+    unit = UnitShape();
+    m_shapeIndex.remove(m_shapeKeys.at(index));
+    m_freeShapes.append(index);
+}
+
+/// 瓦片方案改变后，缩放系数和未依附平台的场景位置都需要重新计算
+void MapFootprintEngine::updateScheme()
+{
+    const auto scheme = GraphicsMap::sceneScheme();
+    if(scheme == m_scheme)
+        return;
+    m_scheme = scheme;
+    m_scales.clear();
+    for(auto &footprint : m_footprints) {
+        if(footprint.used && !footprint.attached && footprint.coord.isValid())
+            footprint.scenePos = GraphicsMap::toScene(footprint.coord);
+    }
+}
+
+/// 纬度带中心处每米对应的场景长度，x为东向，y为南向
+QPointF MapFootprintEngine::latitudeScale(double latitude)
+{
+    const int band = qRound(latitude / LATITUDE_BAND);
+    auto iter = m_scales.constFind(band);
+    if(iter != m_scales.constEnd())
+        return iter.value();
+    //
+    const MapCoordinate center(band * LATITUDE_BAND, 0);
+    const double distances[2] = {1e3, 1e3};
+    const double azimuths[2] = {90, 0};
+    MapCoordinate coords[2];
+    MapGeodesic::destinations(center, distances, azimuths, coords, 2);
+    auto centerPoint = GraphicsMap::toScene(center);
+    QPointF scale((GraphicsMap::toScene(coords[0]).x() - centerPoint.x()) / 1e3,
+                  (centerPoint.y() - GraphicsMap::toScene(coords[1]).y()) / 1e3);
+    m_scales.insert(band, scale);
+    return scale;
+}
+
+/// 只比较平台的场景位置和朝向，有变化时才重绘
+void MapFootprintEngine::checkFrame()
+{
+    bool changed = false;
+    for(auto &footprint : m_footprints) {
+        if(!footprint.used || !footprint.visible || !footprint.attached)
+            continue;
+        auto platform = footprint.platform.data();
+        if(!platform) {
+            // the platform is destroyed, stop following it
+            footprint.attached = false;
+            changed = true;
+        }
+        else if(platform->scenePos() != footprint.lastPos || platform->rotation() != footprint.lastHeading) {
+            changed = true;
+            break;
+        }
+    }
+    if(changed)
+        update();
+}
@@ -0,0 +1,153 @@
+﻿#ifndef MAPFOOTPRINTENGINE_H
+#define MAPFOOTPRINTENGINE_H
+
+#include <QObject>
+#include <QGraphicsItem>
+#include <QHash>
+#include <QPainterPath>
+#include <QPen>
+#include <QPointer>
+#include "mapframetimer.h"
+#include "mapcoordinate.h"
+#include "mapprojection.h"
+
+class MapObjectItem;
+
+/*!
+ * \brief 传感器威力区引擎
+ * \details 在一个图元中批量绘制大量扇形和三角形梯形威力区，代替逐个创建MapPieItem/MapTriTrapItem：
+ * 1.相同(近距, 远距, 张角)的威力区共用一个以米为单位、正北朝上的单位形状，只生成一次，没有威力区使用时释放；
+ * 2.米到场景坐标的缩放系数按纬度带(0.25度)缓存，瓦片方案改变时重新计算；
+ * 3.每帧在一次遍历中读取平台的场景位置和朝向，得到每个威力区的变换矩阵，再按样式分批绘制，不需要连接平台的信号
+ * \note 形状在平台所在位置的切平面上计算，距离在数百千米以内时与大地测量的结果差别可以忽略
+ */
+class MapFootprintEngine : public QObject, public QGraphicsItem
+{
+    Q_OBJECT
+public:
+    enum Shape {
+        Pie,        ///< 扇形
+        TriTrap     ///< 三角形梯形，近距以内为三角形，近距和远距之间为梯形
+    };
+
+    MapFootprintEngine();
+    ~MapFootprintEngine();
+    /*!
+     * \brief 添加威力区
+     * \param nearRange 近距，单位米，扇形忽略该值
+     * \param farRange 远距，单位米
+     * \param span 张角，单位度
+     * \param azimuth 相对平台朝向的方位，单位度，以右偏为正
+     * \return 威力区编号，删除后会被复用
+     */
+    int add(Shape shape, qreal nearRange, qreal farRange, qreal span, qreal azimuth = 0);
+    /// 删除威力区
+    void remove(int id);
+    /// 删除所有威力区
+    void clear();
+    /// 威力区数量
+    int count() const;
+    /// 依附到平台，每帧跟随平台的位置和朝向，平台析构后不再绘制
+    void attach(int id, MapObjectItem *platform);
+    /// 设置未依附平台的威力区的位置和朝向
+    void setPosition(int id, const MapCoordinate &coord, qreal heading);
+    /// 修改形状参数
+    void setRange(int id, qreal nearRange, qreal farRange, qreal span);
+    /// 修改相对平台朝向的方位
+    void setAzimuth(int id, qreal azimuth);
+    /// 设置威力区是否显示
+    void setFootprintVisible(int id, bool visible);
+    /// 设置画笔，扇形和梯形使用各自的画笔，三角形使用setTrianglePen
+    void setPen(Shape shape, const QPen &pen);
+    void setTrianglePen(const QPen &pen);
+    /// 设置画刷
+    void setBrush(Shape shape, const QBrush &brush);
+    /*!
+     * \brief 设置检查平台位置的帧率，默认25
+     * \details 每帧只比较平台的场景位置和朝向，有变化时才重绘，0表示关闭，由外部调用update
+     */
+    void setFrameRate(int fps);
+
+public:
+    virtual QRectF boundingRect() const override;
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+
+private:
+    /// 单位形状，以米为单位，x向东，y向南，朝向正北
+    struct UnitShape
+    {
+        QPainterPath body;      ///< 扇形或者梯形
+        QPainterPath triangle;  ///< 三角形，扇形为空
+        QRectF       bounds;
+        int          refs = 0;  ///< 使用该形状的威力区数量，为0时可以复用
+    };
+    struct ShapeKey
+    {
+        Shape shape;
+        qreal nearRange;
+        qreal farRange;
+        qreal span;
+        inline bool operator==(const ShapeKey &rhs) const {
+            return shape == rhs.shape && nearRange == rhs.nearRange && farRange == rhs.farRange && span == rhs.span;
+        }
+        friend inline uint qHash(const ShapeKey &key, uint seed = 0) {
+            return qHash(key.nearRange, seed) ^ qHash(key.farRange, seed) * 31 ^ qHash(key.span, seed) * 17 ^ uint(key.shape);
+        }
+    };
+    struct Footprint
+    {
+        bool      used;
+        bool      visible;
+        Shape     shape;
+        qreal     nearRange;
+        qreal     farRange;
+        qreal     span;
+        qreal     azimuth;
+        int       unitShape;    ///< m_shapes的下标
+        //
+        bool                    attached;
+        QPointer<MapObjectItem> platform;
+        MapCoordinate           coord;      ///< 未依附平台时的位置
+        QPointF                 scenePos;   ///< 未依附平台时的场景位置
+        qreal                   heading;    ///< 未依附平台时的朝向
+        //
+        QPointF                 lastPos;        ///< 上一帧平台的场景位置
+        qreal                   lastHeading;    ///< 上一帧平台的朝向
+    };
+    /// 每帧可见的威力区
+    struct Instance
+    {
+        QTransform transform;
+        int        unitShape;
+        Shape      shape;
+    };
+
+private:
+    int unitShape(Shape shape, qreal nearRange, qreal farRange, qreal span);
+    void releaseShape(int index);
+    void updateScheme();
+    QPointF latitudeScale(double latitude);
+    void checkFrame();
+
+private:
+    QVector<Footprint>      m_footprints;   ///< 威力区，下标即编号
+    QVector<int>            m_freeIds;      ///< 已删除可复用的编号
+    int                     m_count;        ///< 威力区数量
+    QVector<UnitShape>      m_shapes;       ///< 单位形状
+    QVector<ShapeKey>       m_shapeKeys;    ///< 单位形状的参数，与m_shapes对应
+    QVector<int>            m_freeShapes;   ///< 没有威力区使用、可复用的单位形状
+    QHash<ShapeKey, int>    m_shapeIndex;   ///< 形状参数到单位形状的索引
+    QHash<int, QPointF>     m_scales;       ///< 纬度带到缩放系数(场景单位/米)的缓存
+    MapScheme               m_scheme;       ///< 缩放系数和场景位置对应的瓦片方案
+    QVector<Instance>       m_instances;    ///< 每帧复用的可见实例
+    //
+    QPen    m_piePen;
+    QBrush  m_pieBrush;
+    QPen    m_trianglePen;
+    QPen    m_trapezoidPen;
+    QBrush  m_trapezoidBrush;
+    //
+    MapFrameTimer m_frameTimer;   ///< 检查平台位置变化的定时器
+};
+
+#endif // MAPFOOTPRINTENGINE_H
@@ -0,0 +1,9 @@
+﻿#include "mapframetimer.h"
+
+void MapFrameTimer::setFrameRate(int fps)
+{
+    if(fps <= 0)
+        stop();
+    else
+        start(1000/fps);
+}
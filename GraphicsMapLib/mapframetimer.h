@@ -0,0 +1,18 @@
+﻿#ifndef MAPFRAMETIMER_H
+#define MAPFRAMETIMER_H
+
+#include <QTimer>
+
+/*!
+ * \brief 帧定时器
+ * \details 按帧率启动和停止，供每帧批量处理改变的图层和引擎共用
+ */
+class MapFrameTimer : public QTimer
+{
+public:
+    using QTimer::QTimer;
+    /// 设置帧率，0表示停止
+    void setFrameRate(int fps);
+};
+
+#endif // MAPFRAMETIMER_H
@@ -0,0 +1,33 @@
+﻿#include "mapframeworker.h"
+#include <QThread>
+
+MapFrameWorker::MapFrameWorker(QObject *worker, const QString &name, QObject *parent) : QObject(parent),
+    m_worker(worker),
+    m_busy(false)
+{
+    QThread *thread = new QThread;
+    thread->setObjectName(name);
+    m_worker->moveToThread(thread);
+    thread->start();
+    //
+    connect(&m_frameTimer, &QTimer::timeout, this, &MapFrameWorker::frame);
+}
+
+MapFrameWorker::~MapFrameWorker()
+{
+    auto thread = m_worker->thread();
+    thread->quit();
+    thread->wait();
+    delete m_worker;
+    delete thread;
+}
+
+void MapFrameWorker::setFrameRate(int fps)
+{
+    m_frameTimer.setFrameRate(fps);
+}
+
+bool MapFrameWorker::isBusy() const
+{
+    return m_busy;
+}
@@ -0,0 +1,62 @@
+﻿#ifndef MAPFRAMEWORKER_H
+#define MAPFRAMEWORKER_H
+
+#include "mapframetimer.h"
+#include <QObject>
+
+/*!
+ * \brief 按帧批量提交的工作线程
+ * \details MapGeofenceEngine和MapProximityEngine共用的调度：
+ * 1.检测器被移到独立的工作线程中，析构时退出线程并删除检测器；
+ * 2.帧定时器每帧发出frame信号，使用者在其中汇总本帧的改变并通过post提交；
+ * 3.post把任务排到工作线程执行，结果排回主线程交给回调，期间isBusy为true，使用者应继续累积改变
+ * \note 回调在主线程执行，MapFrameWorker析构后尚未执行的回调被丢弃
+ */
+class MapFrameWorker : public QObject
+{
+    Q_OBJECT
+public:
+    /// worker 在工作线程中运行的检测器，不能有父对象，所有权转移给MapFrameWorker；name 线程名
+    MapFrameWorker(QObject *worker, const QString &name, QObject *parent = nullptr);
+    ~MapFrameWorker();
+    /// 设置帧率，0表示停止，默认不启动
+    void setFrameRate(int fps);
+    /// 工作线程是否正在处理post提交的任务
+    bool isBusy() const;
+    /// 在工作线程中执行task，不影响繁忙状态
+    template<class Task>
+    void run(Task task);
+    /// 在工作线程中执行task，完成后在主线程中以其结果调用done
+    template<class Task, class Done>
+    void post(Task task, Done done);
+
+signals:
+    /// 每帧发出
+    void frame();
+
+private:
+    QObject       *m_worker;       ///< 工作线程中的检测器
+    MapFrameTimer  m_frameTimer;   ///< 帧定时器
+    bool           m_busy;         ///< 工作线程是否正在处理
+};
+
+template<class Task>
+void MapFrameWorker::run(Task task)
+{
+    QMetaObject::invokeMethod(m_worker, task, Qt::QueuedConnection);
+}
+
+template<class Task, class Done>
+void MapFrameWorker::post(Task task, Done done)
+{
+    m_busy = true;
+    QMetaObject::invokeMethod(m_worker, [this, task, done]() {
+        auto result = task();
+        QMetaObject::invokeMethod(this, [this, done, result]() {
+            m_busy = false;
+            done(result);
+        }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+}
+
+#endif // MAPFRAMEWORKER_H
@@ -1,6 +1,8 @@
 ﻿#include "mapfreepathobject.h"
 #include "graphicsmap.h"
+#include "mapspatialindex.h"
 #include "mapobjectitem.h"
+#include "mappropertymenu.h"
 
 QSet<MapFreePathItem*> MapFreePathItem::m_items;
 MapFreePathItem::MapFreePathItem() :
@@ -11,19 +13,13 @@ MapFreePathItem::MapFreePathItem() :
     pen.setWidth(1);
     pen.setStyle(Qt::DashLine);
 
-    m_menu = new QMenu;
-    m_action = new QAction;
-    m_menu->addAction(m_action);
-    m_action->setText(u8"右键属性");
-    connect(m_action, &QAction::triggered, this, [=](){
-        emit propertyRequset(this);
-    }, Qt::DirectConnection);
     m_items.insert(this);
 }
 
 MapFreePathItem::~MapFreePathItem()
 {
     m_items.remove(this);
+    MapSpatialIndex::instance()->remove(this);
 }
 
 void MapFreePathItem::setEditable(bool editable)
@@ -57,12 +53,32 @@ void MapFreePathItem::append(const QGeoCoordinate &coord)
     emit added(m_coords.indexOf(coord), coord);
 }
 
+void MapFreePathItem::appendMapPoints(const QVector<MapCoordinate> &coords)
+{
+    const int first = m_coords.size();
+    for(const auto &coord : coords) {
+        if(!m_coords.contains(coord))
+            m_coords.append(coord);
+    }
+    if(m_coords.size() == first)
+        return;
+    updateFreePath(m_coords.last().toGeoCoordinate());
+    for(int i = first; i < m_coords.size(); ++i) {
+        emit added(i, m_coords.at(i).toGeoCoordinate());
+    }
+}
+
 void MapFreePathItem::remove(const QGeoCoordinate &coord)
 {
 
 }
 
-const QVector<QGeoCoordinate> &MapFreePathItem::points() const
+QVector<QGeoCoordinate> MapFreePathItem::points() const
+{
+    return MapCoordinate::toGeoCoordinates(m_coords);
+}
+
+const QVector<MapCoordinate> &MapFreePathItem::mapPoints() const
 {
     return m_coords;
 }
@@ -80,20 +96,17 @@ void MapFreePathItem::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
 
 void MapFreePathItem::contextMenuEvent(QGraphicsSceneContextMenuEvent *event)
 {
-    if(m_editable)
-        m_menu->exec(QCursor::pos());
+    if(m_editable && MapPropertyMenu::exec(this))
+        emit propertyRequset(this);
 }
 
 void MapFreePathItem::updateFreePath(const QGeoCoordinate &coord)
 {
-    auto path = this->path();
-    auto fPoint = GraphicsMap::toScene(m_coords.first());
-    path.moveTo(fPoint);
-    for(auto &item : qAsConst(m_coords)){
-        path.lineTo(GraphicsMap::toScene(item));
-    }
-
+    // rebuild the whole path, appending to the old one would duplicate all the previous segments
+    QPainterPath path;
+    path.addPolygon(GraphicsMap::toScene(m_coords));
     this->setPath(path);
+    MapSpatialIndex::instance()->update(this, MapSpatialIndex::boundingRect(m_coords));
 }
 
 void MapFreePathItem::updateEditable()
@@ -4,6 +4,7 @@
 #include <QGraphicsPathItem>
 #include <QGeoCoordinate>
 #include <QMenu>
+#include "mapcoordinate.h"
 
 class MapObjectItem;
 /*!
@@ -22,10 +23,13 @@ public:
     void toggleEditable();
     /// 添加经纬点
     void append(const QGeoCoordinate &coord);
+    /// 批量添加经纬点，只更新一次路径
+    void appendMapPoints(const QVector<MapCoordinate> &coords);
     /// 删除经纬点
     void remove(const QGeoCoordinate &coord);
-    /// 获取自由绘画的经纬点
-    const QVector<QGeoCoordinate> &points() const;
+    /// 获取自由绘画的经纬点，大量点时请使用mapPoints以免逐个构造QGeoCoordinate
+    QVector<QGeoCoordinate> points() const;
+    const QVector<MapCoordinate> &mapPoints() const;
     /// 获取所有的实例
     static const QSet<MapFreePathItem *> &items();
 signals:
@@ -44,10 +48,7 @@ private:
     static QSet<MapFreePathItem*> m_items;         ///< 所有实例
 private:
     bool                            m_editable;     ///< 鼠标是否可交互编辑
-    QVector<QGeoCoordinate>         m_coords;       ///< 场景的点集合
-
-    QMenu   *m_menu;
-    QAction *m_action;
+    QVector<MapCoordinate>          m_coords;       ///< 场景的点集合
 };
 
 #endif // MAPFREEPATHOBJECT_H
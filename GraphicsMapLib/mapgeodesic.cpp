@@ -0,0 +1,266 @@
+﻿#include "mapgeodesic.h"
+#include <QtMath>
+#include <algorithm>
+
+#define WGS84_A 6378137.0               ///< WGS84长半轴
+#define WGS84_F (1 / 298.257223563)     ///< WGS84扁率
+#define WGS84_B (WGS84_A * (1 - WGS84_F))
+#define VINCENTY_EPS 1e-12              ///< Vincenty迭代的收敛阈值(弧度)，约0.006mm
+#define VINCENTY_ITERATIONS 200         ///< Vincenty迭代的最大次数
+
+namespace {
+
+inline double wrapLongitude(double lon)
+{
+    if(lon > 180)
+        return lon - 360;
+    if(lon < -180)
+        return lon + 360;
+    return lon;
+}
+
+inline double wrapAzimuth(double degree)
+{
+    degree = std::fmod(degree, 360.0);
+    return degree < 0 ? degree + 360 : degree;
+}
+
+/// 起点相关的量，批量计算时只需要算一次
+struct SphericalOrigin
+{
+    double lat, lon, sinLat, cosLat;
+    explicit SphericalOrigin(const MapCoordinate &coord) :
+        lat(qDegreesToRadians(coord.latitude)),
+        lon(qDegreesToRadians(coord.longitude)),
+        sinLat(std::sin(lat)),
+        cosLat(std::cos(lat)) {}
+};
+
+inline void sphericalDestination(const SphericalOrigin &origin, double altitude, double distance, double azimuth,
+                                 MapCoordinate &result)
+{
+    // the same formula as QGeoCoordinate::atDistanceAndAzimuth
+    double az = qDegreesToRadians(azimuth);
+    double ratio = distance / MapGeodesic::earthRadius();
+    double cosRatio = std::cos(ratio);
+    double sinRatio = std::sin(ratio);
+    double lat = std::asin(origin.sinLat * cosRatio + origin.cosLat * sinRatio * std::cos(az));
+    double lon = origin.lon + std::atan2(std::sin(az) * sinRatio * origin.cosLat, cosRatio - origin.sinLat * std::sin(lat));
+    result.latitude = qRadiansToDegrees(lat);
+    result.longitude = wrapLongitude(qRadiansToDegrees(lon));
+    result.altitude = altitude;
+}
+
+inline double sphericalDistance(const SphericalOrigin &origin, const MapCoordinate &to)
+{
+    // haversine, the same as QGeoCoordinate::distanceTo
+    double lat = qDegreesToRadians(to.latitude);
+    double dlat = lat - origin.lat;
+    double dlon = qDegreesToRadians(to.longitude) - origin.lon;
+    double havDlat = std::sin(dlat / 2);
+    double havDlon = std::sin(dlon / 2);
+    double y = havDlat * havDlat + origin.cosLat * std::cos(lat) * havDlon * havDlon;
+    return 2 * std::asin(std::sqrt(y)) * MapGeodesic::earthRadius();
+}
+
+inline double sphericalAzimuth(const SphericalOrigin &origin, const MapCoordinate &to)
+{
+    double lat = qDegreesToRadians(to.latitude);
+    double dlon = qDegreesToRadians(to.longitude) - origin.lon;
+    double y = std::sin(dlon) * std::cos(lat);
+    double x = origin.cosLat * std::sin(lat) - origin.sinLat * std::cos(lat) * std::cos(dlon);
+    return wrapAzimuth(qRadiansToDegrees(std::atan2(y, x)));
+}
+
+/// 起点在辅助球上的归化纬度
+struct EllipsoidalOrigin
+{
+    double lon, sinU, cosU, tanU;
+    explicit EllipsoidalOrigin(const MapCoordinate &coord) :
+        lon(qDegreesToRadians(coord.longitude)),
+        tanU((1 - WGS84_F) * std::tan(qDegreesToRadians(coord.latitude)))
+    {
+        cosU = 1 / std::sqrt(1 + tanU * tanU);
+        sinU = tanU * cosU;
+    }
+};
+
+/// \see T. Vincenty, Direct and inverse solutions of geodesics on the ellipsoid, 1975
+inline void vincentyDestination(const EllipsoidalOrigin &origin, double altitude, double distance, double azimuth,
+                                MapCoordinate &result)
+{
+    double az = qDegreesToRadians(azimuth);
+    double sinAz = std::sin(az);
+    double cosAz = std::cos(az);
+    double sigma1 = std::atan2(origin.tanU, cosAz);
+    double sinAlpha = origin.cosU * sinAz;
+    double cosSqAlpha = 1 - sinAlpha * sinAlpha;
+    double uSq = cosSqAlpha * (WGS84_A * WGS84_A - WGS84_B * WGS84_B) / (WGS84_B * WGS84_B);
+    double A = 1 + uSq / 16384 * (4096 + uSq * (-768 + uSq * (320 - 175 * uSq)));
+    double B = uSq / 1024 * (256 + uSq * (-128 + uSq * (74 - 47 * uSq)));
+    //
+    double sigma = distance / (WGS84_B * A);
+    double sinSigma = 0, cosSigma = 0, cos2SigmaM = 0;
+    for(int i = 0; i < VINCENTY_ITERATIONS; ++i) {
+        cos2SigmaM = std::cos(2 * sigma1 + sigma);
+        sinSigma = std::sin(sigma);
+        cosSigma = std::cos(sigma);
+        double deltaSigma = B * sinSigma * (cos2SigmaM + B / 4 * (cosSigma * (-1 + 2 * cos2SigmaM * cos2SigmaM)
+                            - B / 6 * cos2SigmaM * (-3 + 4 * sinSigma * sinSigma) * (-3 + 4 * cos2SigmaM * cos2SigmaM)));
+        double last = sigma;
+        sigma = distance / (WGS84_B * A) + deltaSigma;
+        if(std::abs(sigma - last) < VINCENTY_EPS)
+            break;
+    }
+    cos2SigmaM = std::cos(2 * sigma1 + sigma);
+    sinSigma = std::sin(sigma);
+    cosSigma = std::cos(sigma);
+    //
+    double x = origin.sinU * sinSigma - origin.cosU * cosSigma * cosAz;
+    double lat = std::atan2(origin.sinU * cosSigma + origin.cosU * sinSigma * cosAz,
+                            (1 - WGS84_F) * std::sqrt(sinAlpha * sinAlpha + x * x));
+    double lambda = std::atan2(sinSigma * sinAz, origin.cosU * cosSigma - origin.sinU * sinSigma * cosAz);
+    double C = WGS84_F / 16 * cosSqAlpha * (4 + WGS84_F * (4 - 3 * cosSqAlpha));
+    double L = lambda - (1 - C) * WGS84_F * sinAlpha
+               * (sigma + C * sinSigma * (cos2SigmaM + C * cosSigma * (-1 + 2 * cos2SigmaM * cos2SigmaM)));
+    result.latitude = qRadiansToDegrees(lat);
+    result.longitude = wrapLongitude(qRadiansToDegrees(origin.lon + L));
+    result.altitude = altitude;
+}
+
+/// 返回false表示不收敛(近对跖点)
+inline bool vincentyInverse(const EllipsoidalOrigin &origin, const MapCoordinate &to, double *distance, double *azimuth)
+{
+    double tanU2 = (1 - WGS84_F) * std::tan(qDegreesToRadians(to.latitude));
+    double cosU2 = 1 / std::sqrt(1 + tanU2 * tanU2);
+    double sinU2 = tanU2 * cosU2;
+    double L = qDegreesToRadians(to.longitude) - origin.lon;
+    //
+    double lambda = L;
+    double sinLambda = 0, cosLambda = 0;
+    double sinSigma = 0, cosSigma = 0, sigma = 0;
+    double cosSqAlpha = 0, cos2SigmaM = 0;
+    bool converged = false;
+    for(int i = 0; i < VINCENTY_ITERATIONS; ++i) {
+        sinLambda = std::sin(lambda);
+        cosLambda = std::cos(lambda);
+        double t = origin.cosU * sinU2 - origin.sinU * cosU2 * cosLambda;
+        double sinSqSigma = cosU2 * sinLambda * cosU2 * sinLambda + t * t;
+        if(sinSqSigma == 0) {
+            // coincident points
+            if(distance)
+                *distance = 0;
+            if(azimuth)
+                *azimuth = 0;
+            return true;
+        }
+        sinSigma = std::sqrt(sinSqSigma);
+        cosSigma = origin.sinU * sinU2 + origin.cosU * cosU2 * cosLambda;
+        sigma = std::atan2(sinSigma, cosSigma);
+        double sinAlpha = origin.cosU * cosU2 * sinLambda / sinSigma;
+        cosSqAlpha = 1 - sinAlpha * sinAlpha;
+        // equatorial line: cosSqAlpha = 0
+        cos2SigmaM = cosSqAlpha != 0 ? cosSigma - 2 * origin.sinU * sinU2 / cosSqAlpha : 0;
+        double C = WGS84_F / 16 * cosSqAlpha * (4 + WGS84_F * (4 - 3 * cosSqAlpha));
+        double last = lambda;
+        lambda = L + (1 - C) * WGS84_F * sinAlpha
+                 * (sigma + C * sinSigma * (cos2SigmaM + C * cosSigma * (-1 + 2 * cos2SigmaM * cos2SigmaM)));
+        if(std::abs(lambda) > M_PI * 2)
+            break;
+        if(std::abs(lambda - last) < VINCENTY_EPS) {
+            converged = true;
+            break;
+        }
+    }
+    if(!converged)
+        return false;
+    //
+    if(distance) {
+        double uSq = cosSqAlpha * (WGS84_A * WGS84_A - WGS84_B * WGS84_B) / (WGS84_B * WGS84_B);
+        double A = 1 + uSq / 16384 * (4096 + uSq * (-768 + uSq * (320 - 175 * uSq)));
+        double B = uSq / 1024 * (256 + uSq * (-128 + uSq * (74 - 47 * uSq)));
+        double deltaSigma = B * sinSigma * (cos2SigmaM + B / 4 * (cosSigma * (-1 + 2 * cos2SigmaM * cos2SigmaM)
+                            - B / 6 * cos2SigmaM * (-3 + 4 * sinSigma * sinSigma) * (-3 + 4 * cos2SigmaM * cos2SigmaM)));
+        *distance = WGS84_B * A * (sigma - deltaSigma);
+    }
+    if(azimuth) {
+        double az = std::atan2(cosU2 * sinLambda, origin.cosU * sinU2 - origin.sinU * cosU2 * cosLambda);
+        *azimuth = wrapAzimuth(qRadiansToDegrees(az));
+    }
+    return true;
+}
+
+}
+
+double MapGeodesic::distance(const MapCoordinate &from, const MapCoordinate &to, Model model)
+{
+    double result = 0;
+    distances(from, &to, &result, 1, model);
+    return result;
+}
+
+double MapGeodesic::azimuth(const MapCoordinate &from, const MapCoordinate &to, Model model)
+{
+    if(!from.isValid() || !to.isValid())
+        return 0;
+    if(model == Ellipsoidal) {
+        double result = 0;
+        if(vincentyInverse(EllipsoidalOrigin(from), to, nullptr, &result))
+            return result;
+    }
+    return sphericalAzimuth(SphericalOrigin(from), to);
+}
+
+MapCoordinate MapGeodesic::destination(const MapCoordinate &from, double distance, double azimuth, Model model)
+{
+    MapCoordinate result;
+    destinations(from, &distance, &azimuth, &result, 1, model);
+    return result;
+}
+
+void MapGeodesic::destinations(const MapCoordinate &origin, const double *distances, const double *azimuths,
+                               MapCoordinate *result, int count, Model model)
+{
+    if(!origin.isValid()) {
+        std::fill(result, result + count, MapCoordinate());
+        return;
+    }
+    if(model == Ellipsoidal) {
+        const EllipsoidalOrigin ellipsoidal(origin);
+        for(int i = 0; i < count; ++i)
+            vincentyDestination(ellipsoidal, origin.altitude, distances[i], azimuths[i], result[i]);
+        return;
+    }
+    const SphericalOrigin spherical(origin);
+    for(int i = 0; i < count; ++i)
+        sphericalDestination(spherical, origin.altitude, distances[i], azimuths[i], result[i]);
+}
+
+void MapGeodesic::destinations(const MapCoordinate *origins, const double *distances, const double *azimuths,
+                               MapCoordinate *result, int count, Model model)
+{
+    for(int i = 0; i < count; ++i)
+        destinations(origins[i], distances + i, azimuths + i, result + i, 1, model);
+}
+
+void MapGeodesic::distances(const MapCoordinate &origin, const MapCoordinate *targets,
+                            double *result, int count, Model model)
+{
+    if(!origin.isValid()) {
+        std::fill(result, result + count, 0.0);
+        return;
+    }
+    const SphericalOrigin spherical(origin);
+    if(model == Ellipsoidal) {
+        const EllipsoidalOrigin ellipsoidal(origin);
+        for(int i = 0; i < count; ++i) {
+            if(!targets[i].isValid())
+                result[i] = 0;
+            else if(!vincentyInverse(ellipsoidal, targets[i], result + i, nullptr))
+                result[i] = sphericalDistance(spherical, targets[i]);
+        }
+        return;
+    }
+    for(int i = 0; i < count; ++i)
+        result[i] = targets[i].isValid() ? sphericalDistance(spherical, targets[i]) : 0;
+}
@@ -0,0 +1,50 @@
+﻿#ifndef MAPGEODESIC_H
+#define MAPGEODESIC_H
+
+#include "mapcoordinate.h"
+
+/*!
+ * \brief 大地测量计算(距离、方位角、目标点)
+ * \details 提供两种精度：
+ * Spherical 球面模型，半径与QGeoCoordinate相同(6371007.2m)，结果与QGeoCoordinate::distanceTo、
+ * azimuthTo、atDistanceAndAzimuth一致，但不需要构造QGeoCoordinate；
+ * Ellipsoidal WGS84椭球模型，使用Vincenty公式迭代计算，精度约0.5mm，近对跖点不收敛时退回球面模型
+ * \note 批量接口将起点的三角函数计算提到循环外，并避免了逐点的堆内存分配，适合绘制时一次计算多个点
+ * \note 所有函数均可在任意线程中调用
+ */
+class MapGeodesic
+{
+public:
+    enum Model {
+        Spherical,      ///< 球面模型，速度快，误差约0.5%
+        Ellipsoidal     ///< WGS84椭球模型，Vincenty公式
+    };
+
+    /// 球面模型的地球半径，与QGeoCoordinate一致
+    static constexpr double earthRadius() { return 6371007.2; }
+
+    /// 两点间的距离，单位米，任一点无效时返回0
+    static double distance(const MapCoordinate &from, const MapCoordinate &to, Model model = Spherical);
+    /// from到to的方位角，单位度 [0, 360)，任一点无效时返回0
+    static double azimuth(const MapCoordinate &from, const MapCoordinate &to, Model model = Spherical);
+    /// 从from出发沿azimuth方向行进distance米后的位置，保留from的高度
+    static MapCoordinate destination(const MapCoordinate &from, double distance, double azimuth, Model model = Spherical);
+
+public:
+    /*!
+     * \brief 批量计算同一起点的目标点，例如距离圈、扇区的各个顶点
+     * \param distances 距离数组，单位米
+     * \param azimuths 方位角数组，单位度
+     * \param result 输出数组，三个数组均至少需要count个元素
+     */
+    static void destinations(const MapCoordinate &origin, const double *distances, const double *azimuths,
+                             MapCoordinate *result, int count, Model model = Spherical);
+    /// 批量计算多个起点的目标点，每个起点使用对应的距离和方位角
+    static void destinations(const MapCoordinate *origins, const double *distances, const double *azimuths,
+                             MapCoordinate *result, int count, Model model = Spherical);
+    /// 批量计算同一起点到多个点的距离，单位米
+    static void distances(const MapCoordinate &origin, const MapCoordinate *targets,
+                          double *result, int count, Model model = Spherical);
+};
+
+#endif // MAPGEODESIC_H
@@ -0,0 +1,147 @@
+﻿#include "mapgeodesicpath.h"
+#include "graphicsmap.h"
+#include <QtMath>
+
+#define MAX_SEGMENT_ANGLE 5.0       ///< 大于该角度(度)的航段总是被细分，避免S形的大圆在中点处恰好与弦重合
+#define MAX_SUBDIVISION 16          ///< 最大细分深度，每个航段最多65536段
+
+namespace {
+
+/// 单位球上的向量
+struct Vector3
+{
+    double x, y, z;
+};
+
+inline Vector3 toVector(double lat, double lon)
+{
+    double radLat = qDegreesToRadians(lat);
+    double radLon = qDegreesToRadians(lon);
+    double cosLat = std::cos(radLat);
+    return {cosLat * std::cos(radLon), cosLat * std::sin(radLon), std::sin(radLat)};
+}
+
+inline double dot(const Vector3 &a, const Vector3 &b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+/// 经度展开到refLon附近，保证航段连续
+inline double unwrap(double lon, double refLon)
+{
+    return lon + 360.0 * qRound((refLon - lon) / 360.0);
+}
+
+/// 点到线段的距离
+inline qreal segmentDistance(const QPointF &p, const QPointF &a, const QPointF &b)
+{
+    auto ab = b - a;
+    auto ap = p - a;
+    qreal length2 = QPointF::dotProduct(ab, ab);
+    if(length2 <= 0)
+        return qSqrt(QPointF::dotProduct(ap, ap));
+    qreal t = qBound(0.0, QPointF::dotProduct(ap, ab) / length2, 1.0);
+    auto d = ap - ab * t;
+    return qSqrt(QPointF::dotProduct(d, d));
+}
+
+struct Subdivision
+{
+    double refLon;
+    qreal tolerance;
+    double minDot;
+    QPolygonF *polygon;
+
+    /// 追加(a, b]之间的顶点
+    void run(const Vector3 &a, const Vector3 &b, const QPointF &pa, const QPointF &pb, int depth)
+    {
+        // the great circle midpoint is the normalized sum
+        Vector3 m{a.x + b.x, a.y + b.y, a.z + b.z};
+        double norm = std::sqrt(dot(m, m));
+        if(depth >= MAX_SUBDIVISION || norm < 1e-12) {
+            polygon->append(pb);
+            return;
+        }
+        m = {m.x / norm, m.y / norm, m.z / norm};
+        double lat = qRadiansToDegrees(std::atan2(m.z, std::hypot(m.x, m.y)));
+        double lon = unwrap(qRadiansToDegrees(std::atan2(m.y, m.x)), refLon);
+        auto pm = GraphicsMap::toScene(MapCoordinate(lat, lon));
+        if(dot(a, b) >= minDot && segmentDistance(pm, pa, pb) <= tolerance) {
+            polygon->append(pb);
+            return;
+        }
+        run(a, m, pa, pm, depth + 1);
+        run(m, b, pm, pb, depth + 1);
+    }
+};
+
+}
+
+MapGeodesicPath::MapGeodesicPath() :
+    m_tolerance(0.5)
+{
+
+}
+
+void MapGeodesicPath::setPoints(const QVector<MapCoordinate> &coords)
+{
+    m_coords = coords;
+    m_paths.clear();
+}
+
+const QVector<MapCoordinate> &MapGeodesicPath::points() const
+{
+    return m_coords;
+}
+
+void MapGeodesicPath::setTolerance(qreal pixel)
+{
+    if(m_tolerance == pixel)
+        return;
+    m_tolerance = pixel;
+    m_paths.clear();
+}
+
+qreal MapGeodesicPath::tolerance() const
+{
+    return m_tolerance;
+}
+
+const QPainterPath &MapGeodesicPath::path(float zoom) const
+{
+    // round up, so the error is also within the tolerance at the higher end of the bucket
+    const int bucket = MapGeodesicPath::bucket(zoom);
+    auto iter = m_paths.find(bucket);
+    if(iter != m_paths.end())
+        return iter.value();
+    //
+    const qreal sceneTolerance = m_tolerance / qPow(2, bucket - MapScene::ZoomBase);
+    QPainterPath path;
+    if(!m_coords.isEmpty())
+        path.moveTo(GraphicsMap::toScene(m_coords.first()));
+    for(int i = 1; i < m_coords.size(); ++i) {
+        auto polygon = densify(m_coords.at(i-1), m_coords.at(i), sceneTolerance);
+        // the previous leg crossed the antimeridian
+        if(path.currentPosition() != polygon.first())
+            path.moveTo(polygon.first());
+        for(int j = 1; j < polygon.size(); ++j)
+            path.lineTo(polygon.at(j));
+    }
+    return m_paths.insert(bucket, path).value();
+}
+
+QPolygonF MapGeodesicPath::densify(const MapCoordinate &from, const MapCoordinate &to, qreal tolerance)
+{
+    QPolygonF polygon;
+    const double toLon = unwrap(to.longitude, from.longitude);
+    auto pa = GraphicsMap::toScene(from);
+    auto pb = GraphicsMap::toScene(MapCoordinate(to.latitude, toLon));
+    polygon.append(pa);
+    if(!from.isValid() || !to.isValid()) {
+        polygon.append(pb);
+        return polygon;
+    }
+    Subdivision subdivision{from.longitude, tolerance, qCos(qDegreesToRadians(MAX_SEGMENT_ANGLE)), &polygon};
+    subdivision.run(toVector(from.latitude, from.longitude), toVector(to.latitude, to.longitude), pa, pb, 0);
+    return polygon;
+}
@@ -0,0 +1,45 @@
+﻿#ifndef MAPGEODESICPATH_H
+#define MAPGEODESICPATH_H
+
+#include <QHash>
+#include <QPainterPath>
+#include <QPolygonF>
+#include "mapcoordinate.h"
+
+/*!
+ * \brief 大圆航线路径
+ * \details 将相邻经纬点之间的航段沿大圆加密为场景折线，加密程度由当前缩放层级下的屏幕误差决定(默认0.5像素)，
+ * 短航段或者低层级下只保留两个端点，结果按整数缩放层级缓存，缩放时只需查表，经纬点改变时清空缓存
+ * \note 跨越180度经线的航段会延伸到场景范围之外以保持连续，下一个航段从真实位置重新开始
+ */
+class MapGeodesicPath
+{
+public:
+    MapGeodesicPath();
+    /// 设置经纬点，会清空缓存
+    void setPoints(const QVector<MapCoordinate> &coords);
+    const QVector<MapCoordinate> &points() const;
+    /// 设置屏幕误差，单位像素
+    void setTolerance(qreal pixel);
+    qreal tolerance() const;
+    /// 获取缩放层级对应的场景路径，同一整数层级只计算一次
+    const QPainterPath &path(float zoom) const;
+
+public:
+    /// 缩放层级所在的缓存层级，同一缓存层级的路径相同
+    static inline int bucket(float zoom) { return qCeil(zoom); }
+
+    /*!
+     * \brief 将一个航段沿大圆加密为场景折线
+     * \param tolerance 场景坐标下的最大误差
+     * \return 包含两个端点的折线，终点的经度可能超出[-180, 180]
+     */
+    static QPolygonF densify(const MapCoordinate &from, const MapCoordinate &to, qreal tolerance);
+
+private:
+    QVector<MapCoordinate>           m_coords;       ///< 经纬点
+    qreal                            m_tolerance;    ///< 屏幕误差
+    mutable QHash<int, QPainterPath> m_paths;        ///< 各层级的路径缓存
+};
+
+#endif // MAPGEODESICPATH_H
@@ -0,0 +1,435 @@
+﻿#include "mapgeofenceengine.h"
+#include "mapprojection.h"
+#include "graphicsmap.h"
+#include "mapobjectitem.h"
+#include "mappolygonitem.h"
+#include "mapellipseitem.h"
+#include "maprectitem.h"
+#include <QtMath>
+#include <algorithm>
+
+#define GRID_SIZE (MapScene::Length / 4096.0)   ///< 网格边长，场景单位，约为赤道上10千米
+#define MAX_ZONE_CELLS 256                      ///< 区域覆盖的网格超过该值时作为大区域单独判断
+
+/*!
+ * \brief 电子围栏检测器
+ * \details 运行在工作线程中，保存区域网格和每个对象当前所在的区域，只由MapGeofenceEngine调用
+ */
+class MapGeofenceWorker : public QObject
+{
+public:
+    typedef MapGeofenceEngine::ZoneShape   ZoneShape;
+    typedef MapGeofenceEngine::ZoneUpdate  ZoneUpdate;
+    typedef MapGeofenceEngine::TrackUpdate TrackUpdate;
+    typedef MapGeofenceEngine::RawEvent    RawEvent;
+
+    /// 先更新区域，再更新对象位置，最后对形状改变的区域重新判断所有对象
+    QVector<RawEvent> process(const QVector<ZoneUpdate> &zones, const QVector<TrackUpdate> &tracks)
+    {
+        QVector<RawEvent> events;
+        QVector<int> changedZones;
+        for(const auto &update : zones) {
+            // a changed zone keeps its members, so that only the difference is reported
+            removeZone(update.id, update.removed);
+            if(update.removed)
+                continue;
+            insertZone(update);
+            changedZones.append(update.id);
+        }
+        // 1.moved tracks are tested against all candidate zones
+        QVector<int> inside;
+        for(const auto &update : tracks) {
+            if(update.removed) {
+                m_tracks.remove(update.id);
+                continue;
+            }
+            auto &track = m_tracks[update.id];
+            track.pos = update.pos;
+            inside.clear();
+            auto test = [&](int id) {
+                if(contains(m_zones.value(id), track.pos))
+                    inside.append(id);
+            };
+            auto iter = m_cells.constFind(cellKey(cellOf(track.pos.x()), cellOf(track.pos.y())));
+            if(iter != m_cells.constEnd()) {
+                for(int id : iter.value()) {
+                    test(id);
+                }
+            }
+            for(int id : qAsConst(m_largeZones)) {
+                test(id);
+            }
+            std::sort(inside.begin(), inside.end());
+            diff(update.id, track.zones, inside, events);
+            track.zones = inside;
+        }
+        // 2.changed zones are tested against all tracks, the moved ones have no difference now
+        for(int id : qAsConst(changedZones)) {
+            const auto zone = m_zones.value(id);
+            for(auto iter = m_tracks.begin(); iter != m_tracks.end(); ++iter) {
+                auto &track = iter.value();
+                auto member = std::lower_bound(track.zones.begin(), track.zones.end(), id);
+                const bool wasInside = member != track.zones.end() && *member == id;
+                const bool isInside = contains(zone, track.pos);
+                if(wasInside == isInside)
+                    continue;
+                if(isInside)
+                    track.zones.insert(member, id);
+                else
+                    track.zones.erase(member);
+                events.append({iter.key(), id, isInside});
+            }
+        }
+        return events;
+    }
+
+    void clear()
+    {
+        m_zones.clear();
+        m_cells.clear();
+        m_largeZones.clear();
+        m_tracks.clear();
+    }
+
+private:
+    struct Zone
+    {
+        ZoneShape shape;
+        QPolygonF polygon;
+        QRectF    rect;
+        QRectF    bounds;
+    };
+    struct Track
+    {
+        QPointF      pos;
+        QVector<int> zones;     ///< 所在的区域，从小到大排列
+    };
+
+private:
+    static int cellOf(qreal value)
+    {
+        return qFloor(value / GRID_SIZE);
+    }
+
+    static quint64 cellKey(int x, int y)
+    {
+        return quint64(quint32(x)) << 32 | quint32(y);
+    }
+
+    static bool contains(const Zone &zone, const QPointF &pos)
+    {
+        if(!zone.bounds.contains(pos))
+            return false;
+        switch (zone.shape) {
+        case MapGeofenceEngine::Polygon:
+            return zone.polygon.containsPoint(pos, Qt::OddEvenFill);
+        case MapGeofenceEngine::Ellipse: {
+            const auto center = zone.rect.center();
+            const qreal dx = (pos.x() - center.x()) / (zone.rect.width() / 2);
+            const qreal dy = (pos.y() - center.y()) / (zone.rect.height() / 2);
+            return dx * dx + dy * dy <= 1;
+        }
+        default:
+            return true;
+        }
+    }
+
+    /// 比较前后两次所在的区域，生成进出事件
+    static void diff(int track, const QVector<int> &before, const QVector<int> &after, QVector<RawEvent> &events)
+    {
+        int i = 0, j = 0;
+        while(i < before.size() || j < after.size()) {
+            if(j == after.size() || (i < before.size() && before.at(i) < after.at(j)))
+                events.append({track, before.at(i++), false});
+            else if(i == before.size() || after.at(j) < before.at(i))
+                events.append({track, after.at(j++), true});
+            else {
+                ++i;
+                ++j;
+            }
+        }
+    }
+
+    void insertZone(const ZoneUpdate &update)
+    {
+        Zone zone;
+        zone.shape = update.shape;
+        zone.polygon = update.polygon;
+        zone.rect = update.rect.normalized();
+        zone.bounds = update.shape == MapGeofenceEngine::Polygon ? update.polygon.boundingRect() : zone.rect;
+        if(zone.bounds.isEmpty())
+            return;
+        m_zones.insert(update.id, zone);
+        const int left = cellOf(zone.bounds.left()), right = cellOf(zone.bounds.right());
+        const int top = cellOf(zone.bounds.top()), bottom = cellOf(zone.bounds.bottom());
+        if(qint64(right - left + 1) * (bottom - top + 1) > MAX_ZONE_CELLS) {
+            m_largeZones.append(update.id);
+            return;
+        }
+        for(int y = top; y <= bottom; ++y) {
+            for(int x = left; x <= right; ++x) {
+                m_cells[cellKey(x, y)].append(update.id);
+            }
+        }
+    }
+
+    /// 删除区域，forget为true时同时从对象所在的区域中移除(不产生离开事件)
+    void removeZone(int id, bool forget)
+    {
+        if(forget) {
+            for(auto &track : m_tracks) {
+                auto member = std::lower_bound(track.zones.begin(), track.zones.end(), id);
+                if(member != track.zones.end() && *member == id)
+                    track.zones.erase(member);
+            }
+        }
+        auto iter = m_zones.find(id);
+        if(iter == m_zones.end())
+            return;
+        const auto bounds = iter.value().bounds;
+        m_zones.erase(iter);
+        if(m_largeZones.removeOne(id))
+            return;
+        const int left = cellOf(bounds.left()), right = cellOf(bounds.right());
+        const int top = cellOf(bounds.top()), bottom = cellOf(bounds.bottom());
+        for(int y = top; y <= bottom; ++y) {
+            for(int x = left; x <= right; ++x) {
+                auto cell = m_cells.find(cellKey(x, y));
+                if(cell == m_cells.end())
+                    continue;
+                cell.value().removeOne(id);
+                if(cell.value().isEmpty())
+                    m_cells.erase(cell);
+            }
+        }
+    }
+
+private:
+    QHash<int, Zone>                m_zones;        ///< 区域
+    QHash<quint64, QVector<int>>    m_cells;        ///< 网格到区域的索引
+    QVector<int>                    m_largeZones;   ///< 覆盖网格过多的区域
+    QHash<int, Track>               m_tracks;       ///< 对象
+};
+
+MapGeofenceEngine::MapGeofenceEngine(QObject *parent) : QObject(parent),
+    m_nextId(0),
+    m_worker(new MapGeofenceWorker),
+    m_frames(m_worker, "GeofenceThread")
+{
+    connect(MapObjectItem::notifier(), &MapObjectNotifier::batchUpdated, this, &MapGeofenceEngine::markTracks);
+    connect(&m_frames, &MapFrameWorker::frame, this, &MapGeofenceEngine::postFrame);
+    setFrameRate(10);
+}
+
+void MapGeofenceEngine::addZone(MapPolygonItem *zone)
+{
+    if(!zone || m_zoneIds.contains(zone))
+        return;
+    const int id = registerZone(zone, zone, Polygon);
+    auto mark = [this, id]() { markZone(id); };
+    connect(zone, &MapPolygonItem::added, this, mark);
+    connect(zone, &MapPolygonItem::removed, this, mark);
+    connect(zone, &MapPolygonItem::updated, this, mark);
+    connect(zone, &MapPolygonItem::changed, this, mark);
+}
+
+void MapGeofenceEngine::addZone(MapEllipseItem *zone)
+{
+    if(!zone || m_zoneIds.contains(zone))
+        return;
+    const int id = registerZone(zone, zone, Ellipse);
+    auto mark = [this, id]() { markZone(id); };
+    connect(zone, &MapEllipseItem::centerChanged, this, mark);
+    connect(zone, &MapEllipseItem::sizeChanged, this, mark);
+}
+
+void MapGeofenceEngine::addZone(MapRectItem *zone)
+{
+    if(!zone || m_zoneIds.contains(zone))
+        return;
+    const int id = registerZone(zone, zone, Rect);
+    auto mark = [this, id]() { markZone(id); };
+    connect(zone, &MapRectItem::centerChanged, this, mark);
+    connect(zone, &MapRectItem::sizeChanged, this, mark);
+}
+
+void MapGeofenceEngine::removeZone(QGraphicsItem *zone)
+{
+    auto iter = m_zoneIds.constFind(zone);
+    if(iter != m_zoneIds.constEnd())
+        removeZoneId(iter.value());
+}
+
+void MapGeofenceEngine::addTrack(MapObjectItem *track)
+{
+    if(!track || m_trackIds.contains(track))
+        return;
+    const int id = m_nextId++;
+    m_tracks.insert(id, {track, track});
+    m_trackIds.insert(track, id);
+    auto mark = [this, id]() { markTrack(id); };
+    connect(track, &MapObjectItem::coordinateChanged, this, mark);
+    connect(track, &MapObjectItem::coordinateDragged, this, mark);
+    connect(track, &QObject::destroyed, this, [this, id]() { removeTrackId(id); });
+    markTrack(id);
+}
+
+void MapGeofenceEngine::removeTrack(MapObjectItem *track)
+{
+    auto iter = m_trackIds.constFind(track);
+    if(iter != m_trackIds.constEnd())
+        removeTrackId(iter.value());
+}
+
+void MapGeofenceEngine::clear()
+{
+    for(const auto &zone : qAsConst(m_zones)) {
+        if(zone.object)
+            disconnect(zone.object.data(), nullptr, this, nullptr);
+    }
+    for(const auto &track : qAsConst(m_tracks)) {
+        if(track.item)
+            disconnect(track.item.data(), nullptr, this, nullptr);
+    }
+    m_zones.clear();
+    m_zoneIds.clear();
+    m_tracks.clear();
+    m_trackIds.clear();
+    m_dirtyZones.clear();
+    m_dirtyTracks.clear();
+    m_removedZones.clear();
+    // results of the frame in process are dropped as the ids are unknown now
+    auto worker = m_worker;
+    m_frames.run([worker]() { worker->clear(); });
+}
+
+void MapGeofenceEngine::refreshZones()
+{
+    for(auto iter = m_zones.constBegin(); iter != m_zones.constEnd(); ++iter) {
+        m_dirtyZones.insert(iter.key());
+    }
+}
+
+void MapGeofenceEngine::setFrameRate(int fps)
+{
+    m_frames.setFrameRate(fps);
+}
+
+int MapGeofenceEngine::registerZone(QGraphicsItem *zone, QObject *object, ZoneShape shape)
+{
+    const int id = m_nextId++;
+    m_zones.insert(id, {zone, object, shape});
+    m_zoneIds.insert(zone, id);
+    connect(object, &QObject::destroyed, this, [this, id]() { removeZoneId(id); });
+    markZone(id);
+    return id;
+}
+
+void MapGeofenceEngine::removeZoneId(int id)
+{
+    auto iter = m_zones.find(id);
+    if(iter == m_zones.end())
+        return;
+    if(iter.value().object)
+        disconnect(iter.value().object.data(), nullptr, this, nullptr);
+    m_zoneIds.remove(iter.value().item);
+    m_zones.erase(iter);
+    m_dirtyZones.remove(id);
+    m_removedZones.append(id);
+}
+
+void MapGeofenceEngine::removeTrackId(int id)
+{
+    auto iter = m_tracks.find(id);
+    if(iter == m_tracks.end())
+        return;
+    if(iter.value().item)
+        disconnect(iter.value().item.data(), nullptr, this, nullptr);
+    m_trackIds.remove(iter.value().key);
+    m_tracks.erase(iter);
+    m_dirtyTracks.insert(id, {id, true, QPointF()});
+}
+
+void MapGeofenceEngine::markZone(int id)
+{
+    m_dirtyZones.insert(id);
+}
+
+/// 只记录场景位置，检测在下一帧进行
+void MapGeofenceEngine::markTrack(int id)
+{
+    auto track = m_tracks.value(id).item.data();
+    // scenePos() is the extrapolated display position of a dead-reckoned object, use the reported one
+    if(track && track->mapCoordinate().isValid())
+        m_dirtyTracks.insert(id, {id, false, GraphicsMap::toScene(track->mapCoordinate())});
+}
+
+void MapGeofenceEngine::markTracks(const QVector<MapObjectItem *> &items)
+{
+    if(m_trackIds.isEmpty())
+        return;
+    for(auto item : items) {
+        auto iter = m_trackIds.constFind(item);
+        if(iter != m_trackIds.constEnd())
+            markTrack(iter.value());
+    }
+}
+
+void MapGeofenceEngine::postFrame()
+{
+    // keep accumulating while the worker is busy
+    if(m_frames.isBusy() || (m_dirtyZones.isEmpty() && m_dirtyTracks.isEmpty() && m_removedZones.isEmpty()))
+        return;
+    QVector<ZoneUpdate> zones;
+    zones.reserve(m_removedZones.size() + m_dirtyZones.size());
+    for(int id : qAsConst(m_removedZones)) {
+        zones.append({id, true, Polygon, QPolygonF(), QRectF()});
+    }
+    for(int id : qAsConst(m_dirtyZones)) {
+        const auto zone = m_zones.value(id);
+        if(!zone.object)
+            continue;
+        ZoneUpdate update{id, false, zone.shape, QPolygonF(), QRectF()};
+        if(zone.shape == Polygon) {
+            auto item = static_cast<MapPolygonItem*>(zone.item);
+            update.polygon = item->mapToScene(item->polygon());
+        }
+        else if(zone.shape == Ellipse) {
+            auto item = static_cast<MapEllipseItem*>(zone.item);
+            update.rect = item->mapRectToScene(item->rect());
+        }
+        else {
+            auto item = static_cast<MapRectItem*>(zone.item);
+            update.rect = item->mapRectToScene(item->rect());
+        }
+        zones.append(update);
+    }
+    QVector<TrackUpdate> tracks;
+    tracks.reserve(m_dirtyTracks.size());
+    for(const auto &update : qAsConst(m_dirtyTracks)) {
+        tracks.append(update);
+    }
+    m_removedZones.clear();
+    m_dirtyZones.clear();
+    m_dirtyTracks.clear();
+    //
+    auto worker = m_worker;
+    m_frames.post([worker, zones, tracks]() { return worker->process(zones, tracks); },
+                  [this](const QVector<RawEvent> &events) { onProcessed(events); });
+}
+
+/// 编号转换为图元，忽略已经删除的对象和区域
+void MapGeofenceEngine::onProcessed(const QVector<RawEvent> &events)
+{
+    QVector<Event> result;
+    result.reserve(events.size());
+    for(const auto &event : events) {
+        auto track = m_tracks.value(event.track).item.data();
+        auto zone = m_zones.constFind(event.zone);
+        if(!track || zone == m_zones.constEnd() || !zone.value().object)
+            continue;
+        result.append({track, zone.value().item, event.entered});
+    }
+    if(!result.isEmpty())
+        emit triggered(result);
+}
@@ -0,0 +1,131 @@
+﻿#ifndef MAPGEOFENCEENGINE_H
+#define MAPGEOFENCEENGINE_H
+
+#include "mapframeworker.h"
+#include <QObject>
+#include <QHash>
+#include <QPointer>
+#include <QSet>
+#include <QPolygonF>
+#include <QVector>
+
+class QGraphicsItem;
+class MapObjectItem;
+class MapPolygonItem;
+class MapEllipseItem;
+class MapRectItem;
+class MapGeofenceWorker;
+
+/*!
+ * \brief 电子围栏引擎
+ * \details 监视大量地图对象进出多边形、椭圆和矩形区域，检测在工作线程中完成：
+ * 1.区域按场景外接矩形登记到网格中，对象只与所在网格内的区域做精确判断，覆盖网格过多的大区域单独逐个判断外接矩形；
+ * 2.对象的coordinateChanged和MapObjectItem的批量通知只记录新的场景位置，每帧把变化的对象和区域一次性交给工作线程，工作线程繁忙时继续累积；
+ * 3.进出事件按帧汇总后通过triggered信号在主线程发出
+ * \note 判断在场景坐标中进行，与区域的显示形状一致；切换瓦片方案后请调用refreshZones
+ * \note 区域或对象被删除时不产生离开事件
+ */
+class MapGeofenceEngine : public QObject
+{
+    Q_OBJECT
+public:
+    /// 进出事件
+    struct Event
+    {
+        MapObjectItem *track;   ///< 对象
+        QGraphicsItem *zone;    ///< 区域
+        bool           entered; ///< true为进入，false为离开
+    };
+
+    explicit MapGeofenceEngine(QObject *parent = nullptr);
+    /// 添加区域，形状改变时自动更新
+    void addZone(MapPolygonItem *zone);
+    void addZone(MapEllipseItem *zone);
+    void addZone(MapRectItem *zone);
+    /// 删除区域
+    void removeZone(QGraphicsItem *zone);
+    /// 添加对象，位置改变时自动更新
+    void addTrack(MapObjectItem *track);
+    /// 删除对象
+    void removeTrack(MapObjectItem *track);
+    /// 删除所有区域和对象
+    void clear();
+    /// 重新读取所有区域的形状
+    void refreshZones();
+    /// 设置检测的帧率，默认10
+    void setFrameRate(int fps);
+
+signals:
+    /// 一帧内所有的进出事件
+    void triggered(const QVector<MapGeofenceEngine::Event> &events);
+
+public:
+    /// 区域形状
+    enum ZoneShape {
+        Polygon,
+        Ellipse,
+        Rect
+    };
+    /// 发往工作线程的区域快照
+    struct ZoneUpdate
+    {
+        int       id;
+        bool      removed;
+        ZoneShape shape;
+        QPolygonF polygon;          ///< 多边形顶点，场景坐标
+        QRectF    rect;             ///< 椭圆和矩形的范围，场景坐标
+    };
+    /// 发往工作线程的对象位置
+    struct TrackUpdate
+    {
+        int     id;
+        bool    removed;
+        QPointF pos;    ///< 场景坐标
+    };
+    /// 工作线程产生的事件
+    struct RawEvent
+    {
+        int  track;
+        int  zone;
+        bool entered;
+    };
+
+private:
+    int registerZone(QGraphicsItem *zone, QObject *object, ZoneShape shape);
+    void removeZoneId(int id);
+    void removeTrackId(int id);
+    void markZone(int id);
+    void markTrack(int id);
+    void markTracks(const QVector<MapObjectItem*> &items);
+    void postFrame();
+    void onProcessed(const QVector<RawEvent> &events);
+
+private:
+    struct Zone
+    {
+        QGraphicsItem     *item;
+        QPointer<QObject>  object;  ///< 区域析构后为空
+        ZoneShape          shape;
+    };
+    struct Track
+    {
+        MapObjectItem          *key;    ///< m_trackIds的键，对象析构后仍可用于删除
+        QPointer<MapObjectItem> item;
+    };
+
+private:
+    QHash<int, Zone>            m_zones;        ///< 区域编号到区域
+    QHash<QGraphicsItem*, int>  m_zoneIds;      ///< 区域到编号
+    QHash<int, Track>           m_tracks;       ///< 对象编号到对象
+    QHash<MapObjectItem*, int>  m_trackIds;     ///< 对象到编号
+    int                         m_nextId;       ///< 下一个编号，编号不复用
+    //
+    QSet<int>                   m_dirtyZones;       ///< 本帧形状改变的区域
+    QHash<int, TrackUpdate>     m_dirtyTracks;      ///< 本帧位置改变的对象
+    QVector<int>                m_removedZones;     ///< 本帧删除的区域
+    //
+    MapGeofenceWorker *m_worker;        ///< 工作线程中的检测器，由m_frames删除
+    MapFrameWorker     m_frames;        ///< 工作线程和帧定时器
+};
+
+#endif // MAPGEOFENCEENGINE_H
@@ -0,0 +1,382 @@
+﻿#include "mapgraticuleitem.h"
+#include "graphicsmap.h"
+#include <QGraphicsScene>
+#include <QGraphicsView>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QVarLengthArray>
+#include <QtMath>
+#include <algorithm>
+
+#define MAX_CACHED_LINES 4096   ///< 经线或纬线缓存的最大数量，超过后清空
+#define MAX_CACHED_TEXTS 1024   ///< 标注文字缓存的最大数量，超过后清空
+#define UTM_LABEL_PIXEL 40      ///< UTM格网在屏幕上的宽度大于该值时才显示标识
+
+/// 可选的网格间距，单位秒，从大到小
+static const int SPACINGS[] = {162000, 108000, 54000, 36000, 18000, 7200, 3600,
+                               1800, 900, 600, 300, 120, 60, 30, 15, 10, 5, 2, 1};
+
+/// 格式化为度分秒，如 120°30'E
+static QString formatDegree(qint64 arcsec, bool latitude)
+{
+    QString hemisphere;
+    if(arcsec > 0)
+        hemisphere = latitude ? "N" : "E";
+    else if(arcsec < 0)
+        hemisphere = latitude ? "S" : "W";
+    arcsec = qAbs(arcsec);
+    if(!latitude && arcsec == 180 * 3600)
+        hemisphere.clear();
+    auto text = QString::number(arcsec / 3600) + QChar(0x00B0);
+    int minute = arcsec / 60 % 60;
+    int second = arcsec % 60;
+    if(minute || second)
+        text += QString("%1'").arg(minute, 2, 10, QChar('0'));
+    if(second)
+        text += QString("%1\"").arg(second, 2, 10, QChar('0'));
+    return text + hemisphere;
+}
+
+/// 竖直或水平线段与矩形是否相交(QRectF::intersects对宽度为0的矩形总是返回false)
+static bool lineIntersects(const QLineF &line, const QRectF &rect)
+{
+    return qMax(line.x1(), line.x2()) >= rect.left() && qMin(line.x1(), line.x2()) <= rect.right()
+            && qMax(line.y1(), line.y2()) >= rect.top() && qMin(line.y1(), line.y2()) <= rect.bottom();
+}
+
+MapGraticuleItem::MapGraticuleItem() :
+    m_textColor(Qt::white),
+    m_utmVisible(false),
+    m_labelVisible(true),
+    m_minimumSpacing(100),
+    m_spacing(0),
+    m_scheme(GraphicsMap::sceneScheme())
+{
+    m_pen.setColor(QColor(255, 255, 255, 160));
+    m_pen.setWidth(1);
+    m_pen.setCosmetic(true);
+    m_utmPen.setColor(QColor::fromRgb(241, 196, 15));
+    m_utmPen.setWidth(1);
+    m_utmPen.setCosmetic(true);
+    m_utmPen.setStyle(Qt::DashLine);
+    m_font.setFamily("Microsoft YaHei");
+    m_font.setPointSizeF(9);
+}
+
+MapGraticuleItem::~MapGraticuleItem()
+{
+
+}
+
+void MapGraticuleItem::setPen(const QPen &pen)
+{
+    if(m_pen == pen)
+        return;
+    m_pen = pen;
+    update();
+}
+
+QPen MapGraticuleItem::pen() const
+{
+    return m_pen;
+}
+
+void MapGraticuleItem::setUtmPen(const QPen &pen)
+{
+    if(m_utmPen == pen)
+        return;
+    m_utmPen = pen;
+    update();
+}
+
+QPen MapGraticuleItem::utmPen() const
+{
+    return m_utmPen;
+}
+
+void MapGraticuleItem::setUtmVisible(bool visible)
+{
+    if(m_utmVisible == visible)
+        return;
+    m_utmVisible = visible;
+    update();
+}
+
+bool MapGraticuleItem::isUtmVisible() const
+{
+    return m_utmVisible;
+}
+
+void MapGraticuleItem::setLabelVisible(bool visible)
+{
+    if(m_labelVisible == visible)
+        return;
+    m_labelVisible = visible;
+    update();
+}
+
+bool MapGraticuleItem::isLabelVisible() const
+{
+    return m_labelVisible;
+}
+
+void MapGraticuleItem::setFont(const QFont &font)
+{
+    if(m_font == font)
+        return;
+    m_font = font;
+    m_texts.clear();
+    update();
+}
+
+QFont MapGraticuleItem::font() const
+{
+    return m_font;
+}
+
+void MapGraticuleItem::setTextColor(const QColor &color)
+{
+    if(m_textColor == color)
+        return;
+    m_textColor = color;
+    update();
+}
+
+QColor MapGraticuleItem::textColor() const
+{
+    return m_textColor;
+}
+
+void MapGraticuleItem::setMinimumSpacing(int pixel)
+{
+    if(m_minimumSpacing == pixel)
+        return;
+    m_minimumSpacing = pixel;
+    update();
+}
+
+int MapGraticuleItem::minimumSpacing() const
+{
+    return m_minimumSpacing;
+}
+
+/// 覆盖两种瓦片方案的整个场景，只绘制视图内的部分
+QRectF MapGraticuleItem::boundingRect() const
+{
+    return QRectF(-MapScene::Length, -MapScene::Length, MapScene::Length * 2, MapScene::Length * 2);
+}
+
+void MapGraticuleItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    // the whole view, not only the exposed part, so the labels stay at the border
+    QRectF visible = option->exposedRect;
+    if(widget) {
+        if(auto view = qobject_cast<QGraphicsView*>(widget->parentWidget()))
+            visible = view->mapToScene(view->viewport()->rect()).boundingRect();
+    }
+    if(scene())
+        visible &= scene()->sceneRect();
+    if(visible.isEmpty())
+        return;
+    const auto world = painter->worldTransform();
+    const qreal scale = qSqrt(world.m11() * world.m11() + world.m12() * world.m12());
+    const qreal pixelPerDegree = MapScene::Length / 360.0 * scale;
+    if(pixelPerDegree <= 0)
+        return;
+    updateScheme();
+
+    // 1.choose the spacing by zoom
+    int spacing = SPACINGS[0];
+    for(int value : SPACINGS) {
+        if(value / 3600.0 * pixelPerDegree < m_minimumSpacing)
+            break;
+        spacing = value;
+    }
+    setSpacing(spacing);
+
+    // 2.lines in the view, only the newly visible ones are projected
+    const auto topLeft = GraphicsMap::toMapCoordinate(visible.topLeft());
+    const auto bottomRight = GraphicsMap::toMapCoordinate(visible.bottomRight());
+    const int lonBegin = qCeil(topLeft.longitude * 3600 / spacing);
+    const int lonEnd = qFloor(bottomRight.longitude * 3600 / spacing);
+    const int latBegin = qCeil(bottomRight.latitude * 3600 / spacing);
+    const int latEnd = qFloor(topLeft.latitude * 3600 / spacing);
+    if(m_meridians.size() > MAX_CACHED_LINES)
+        m_meridians.clear();
+    if(m_parallels.size() > MAX_CACHED_LINES)
+        m_parallels.clear();
+    QVarLengthArray<int, 64> index;
+    QVarLengthArray<double, 64> lat;
+    QVarLengthArray<double, 64> lon;
+    for(int i = lonBegin; i <= lonEnd; ++i) {
+        if(m_meridians.contains(i))
+            continue;
+        index.append(i);
+        lat.append(0);
+        lon.append(qint64(i) * spacing / 3600.0);
+    }
+    const int meridianCount = index.size();
+    for(int i = latBegin; i <= latEnd; ++i) {
+        if(m_parallels.contains(i))
+            continue;
+        index.append(i);
+        lat.append(qint64(i) * spacing / 3600.0);
+        lon.append(0);
+    }
+    if(!index.isEmpty()) {
+        QVarLengthArray<QPointF, 64> points(index.size());
+        GraphicsMap::toScene(lat.constData(), lon.constData(), points.data(), index.size());
+        for(int i = 0; i < index.size(); ++i) {
+            if(i < meridianCount)
+                m_meridians.insert(index[i], points[i].x());
+            else
+                m_parallels.insert(index[i], points[i].y());
+        }
+    }
+    QVector<QLineF> lines;
+    lines.reserve(qMax(0, lonEnd - lonBegin + 1) + qMax(0, latEnd - latBegin + 1));
+    for(int i = lonBegin; i <= lonEnd; ++i) {
+        auto x = m_meridians.value(i);
+        lines.append(QLineF(x, visible.top(), x, visible.bottom()));
+    }
+    for(int i = latBegin; i <= latEnd; ++i) {
+        auto y = m_parallels.value(i);
+        lines.append(QLineF(visible.left(), y, visible.right(), y));
+    }
+    painter->setPen(m_pen);
+    painter->drawLines(lines);
+
+    // 3.utm zones
+    QVector<const UtmCell*> utmCells;
+    if(m_utmVisible) {
+        if(m_utmLines.isEmpty())
+            updateUtm();
+        lines.clear();
+        for(const auto &line : qAsConst(m_utmLines)) {
+            if(lineIntersects(line, visible))
+                lines.append(line);
+        }
+        painter->setPen(m_utmPen);
+        painter->drawLines(lines);
+        for(const auto &cell : qAsConst(m_utmCells)) {
+            if(cell.rect.width() * scale > UTM_LABEL_PIXEL && cell.rect.intersects(visible))
+                utmCells.append(&cell);
+        }
+    }
+
+    // 4.labels in device coordinates, keep the screen size
+    if(!m_labelVisible)
+        return;
+    painter->save();
+    painter->setWorldTransform(QTransform());
+    painter->setFont(m_font);
+    painter->setPen(m_textColor);
+    for(int i = lonBegin; i <= lonEnd; ++i) {
+        auto pos = world.map(QPointF(m_meridians.value(i), visible.top()));
+        painter->drawStaticText(pos + QPointF(3, 3), staticText(formatDegree(qint64(i) * spacing, false)));
+    }
+    for(int i = latBegin; i <= latEnd; ++i) {
+        const auto &text = staticText(formatDegree(qint64(i) * spacing, true));
+        auto pos = world.map(QPointF(visible.left(), m_parallels.value(i)));
+        painter->drawStaticText(pos + QPointF(3, -text.size().height() - 3), text);
+    }
+    for(auto cell : qAsConst(utmCells)) {
+        const auto &text = staticText(cell->label);
+        auto pos = world.map(cell->rect.intersected(visible).center());
+        painter->drawStaticText(pos - QPointF(text.size().width() / 2, text.size().height() / 2), text);
+    }
+    painter->restore();
+}
+
+void MapGraticuleItem::setSpacing(int arcsec)
+{
+    if(m_spacing == arcsec)
+        return;
+    m_spacing = arcsec;
+    m_meridians.clear();
+    m_parallels.clear();
+}
+
+/// 瓦片方案改变后，缓存的经纬线和UTM格网的场景坐标都需要重新计算
+void MapGraticuleItem::updateScheme()
+{
+    const auto scheme = GraphicsMap::sceneScheme();
+    if(scheme == m_scheme)
+        return;
+    m_scheme = scheme;
+    m_meridians.clear();
+    m_parallels.clear();
+    m_utmLines.clear();
+    m_utmCells.clear();
+}
+
+/// 生成UTM分带线和格网，只需生成一次
+void MapGraticuleItem::updateUtm()
+{
+    static const char BANDS[] = "CDEFGHJKLMNPQRSTUVWX";
+    QVector<double> lat;
+    QVector<double> lon;
+    // cells are stored as two corners
+    QVector<QString> labels;
+    QVector<double> cellLat;
+    QVector<double> cellLon;
+    for(int band = 0; band < 20; ++band) {
+        const double lat0 = -80 + band * 8;
+        const double lat1 = band == 19 ? 84 : lat0 + 8;
+        QVector<int> boundaries;
+        for(int boundary = -180; boundary <= 180; boundary += 6)
+            boundaries.append(boundary);
+        if(BANDS[band] == 'V') {
+            // zone 32V is widened to the west
+            boundaries.replace(boundaries.indexOf(6), 3);
+        }
+        else if(BANDS[band] == 'X') {
+            // Svalbard: 31X, 33X, 35X, 37X
+            for(int boundary : {6, 12, 18, 24, 30, 36})
+                boundaries.removeOne(boundary);
+            for(int boundary : {9, 21, 33})
+                boundaries.append(boundary);
+            std::sort(boundaries.begin(), boundaries.end());
+        }
+        for(int i = 0; i < boundaries.size(); ++i) {
+            lat << lat0 << lat1;
+            lon << boundaries.at(i) << boundaries.at(i);
+            if(i == 0)
+                continue;
+            const double west = boundaries.at(i-1);
+            const double east = boundaries.at(i);
+            int zone = qFloor(((west + east) / 2 + 180) / 6) + 1;
+            labels.append(QString::number(zone) + QLatin1Char(BANDS[band]));
+            cellLat << lat1 << lat0;
+            cellLon << west << east;
+        }
+        lat << lat0 << lat0;
+        lon << -180 << 180;
+    }
+    lat << 84 << 84;
+    lon << -180 << 180;
+    //
+    QVector<QPointF> points(lat.size());
+    GraphicsMap::toScene(lat.constData(), lon.constData(), points.data(), lat.size());
+    m_utmLines.clear();
+    for(int i = 0; i < points.size(); i += 2)
+        m_utmLines.append(QLineF(points.at(i), points.at(i+1)));
+    QVector<QPointF> corners(cellLat.size());
+    GraphicsMap::toScene(cellLat.constData(), cellLon.constData(), corners.data(), cellLat.size());
+    m_utmCells.clear();
+    for(int i = 0; i < labels.size(); ++i)
+        m_utmCells.append({QRectF(corners.at(i*2), corners.at(i*2+1)), labels.at(i)});
+}
+
+const QStaticText &MapGraticuleItem::staticText(const QString &text)
+{
+    auto iter = m_texts.find(text);
+    if(iter != m_texts.end())
+        return iter.value();
+    if(m_texts.size() > MAX_CACHED_TEXTS)
+        m_texts.clear();
+    QStaticText staticText(text);
+    staticText.setTextFormat(Qt::PlainText);
+    staticText.prepare(QTransform(), m_font);
+    return m_texts.insert(text, staticText).value();
+}
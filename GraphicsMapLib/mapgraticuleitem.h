@@ -0,0 +1,85 @@
+﻿#ifndef MAPGRATICULEITEM_H
+#define MAPGRATICULEITEM_H
+
+#include <QGraphicsItem>
+#include <QHash>
+#include <QPen>
+#include <QFont>
+#include <QStaticText>
+#include "mapprojection.h"
+
+/*!
+ * \brief 经纬网格/UTM分带图层
+ * \details 一个图元绘制整个网格，不需要为每条线创建MapLineItem：
+ * 1.网格间距根据缩放层级从45度到1秒的序列中选择，保证相邻网格线在屏幕上的间距不小于minimumSpacing；
+ * 2.只计算当前视图内的经线和纬线，各条线的场景坐标按间距缓存，平移时只需批量投影新出现的线；
+ * 3.所有线段一次drawLines绘制，标注文字使用QStaticText缓存并保持屏幕大小
+ * \note 两种投影下经线和纬线在场景中都是直线，因此每条线只需要投影一个坐标
+ * \note UTM分带线包括6度分带(含挪威和斯瓦尔巴的例外)和8度纬度带，显示为"32U"形式的格网标识，
+ * MGRS的100千米方格需要逐带进行UTM投影，暂未实现
+ */
+class MapGraticuleItem : public QGraphicsItem
+{
+public:
+    MapGraticuleItem();
+    ~MapGraticuleItem();
+    /// 设置经纬网格画笔
+    void setPen(const QPen &pen);
+    QPen pen() const;
+    /// 设置UTM分带线画笔
+    void setUtmPen(const QPen &pen);
+    QPen utmPen() const;
+    /// 设置是否显示UTM分带线，默认不显示
+    void setUtmVisible(bool visible);
+    bool isUtmVisible() const;
+    /// 设置是否显示标注
+    void setLabelVisible(bool visible);
+    bool isLabelVisible() const;
+    /// 设置标注字体
+    void setFont(const QFont &font);
+    QFont font() const;
+    /// 设置标注颜色
+    void setTextColor(const QColor &color);
+    QColor textColor() const;
+    /// 设置相邻网格线在屏幕上的最小间距，单位像素，默认100
+    void setMinimumSpacing(int pixel);
+    int minimumSpacing() const;
+
+public:
+    virtual QRectF boundingRect() const override;
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+
+private:
+    /// UTM格网，场景坐标
+    struct UtmCell
+    {
+        QRectF  rect;
+        QString label;
+    };
+
+private:
+    void setSpacing(int arcsec);
+    void updateUtm();
+    void updateScheme();
+    const QStaticText &staticText(const QString &text);
+
+private:
+    QPen    m_pen;
+    QPen    m_utmPen;
+    QFont   m_font;
+    QColor  m_textColor;
+    bool    m_utmVisible;
+    bool    m_labelVisible;
+    int     m_minimumSpacing;
+    //
+    int                 m_spacing;      ///< 当前间距，单位秒
+    MapScheme           m_scheme;       ///< 缓存的场景坐标对应的瓦片方案
+    QHash<int, qreal>   m_meridians;    ///< 经线编号到场景x坐标的缓存
+    QHash<int, qreal>   m_parallels;    ///< 纬线编号到场景y坐标的缓存
+    QHash<QString, QStaticText> m_texts;    ///< 标注文字缓存
+    //
+    QVector<QLineF>     m_utmLines;     ///< UTM分带线，场景坐标
+    QVector<UtmCell>    m_utmCells;     ///< UTM格网
+};
+
+#endif // MAPGRATICULEITEM_H
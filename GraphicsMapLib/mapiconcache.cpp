@@ -0,0 +1,27 @@
+﻿#include "mapiconcache.h"
+#include "mapcolorfilter.h"
+#include <QPixmapCache>
+
+QPixmap MapIconCache::tinted(const QPixmap &icon, const QColor &color, qreal strength)
+{
+    if(icon.isNull() || !color.isValid())
+        return icon;
+    const auto key = QString("MapIconCache:%1:%2:%3").arg(icon.cacheKey()).arg(color.rgba()).arg(qRound(strength * 1000));
+    QPixmap pixmap;
+    if(QPixmapCache::find(key, &pixmap))
+        return pixmap;
+    pixmap = QPixmap::fromImage(tinted(icon.toImage(), color, strength));
+    QPixmapCache::insert(key, pixmap);
+    return pixmap;
+}
+
+QImage MapIconCache::tinted(const QImage &icon, const QColor &color, qreal strength)
+{
+    QImage image = icon;
+    if(image.isNull() || !color.isValid())
+        return image;
+    MapColorFilter filter;
+    filter.setColorize(color, strength);
+    filter.apply(image);
+    return image;
+}
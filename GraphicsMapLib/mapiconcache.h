@@ -0,0 +1,24 @@
+﻿#ifndef MAPICONCACHE_H
+#define MAPICONCACHE_H
+
+#include <QColor>
+#include <QImage>
+#include <QPixmap>
+
+/*!
+ * \brief 图标着色缓存
+ * \details 代替QGraphicsColorizeEffect：每个(图标, 颜色, 强度)只通过MapColorFilter的向量化上色计算一次，
+ * 结果保存在QPixmapCache中，所有图元共用，绘制时直接使用着色后的图片，不再需要离屏渲染
+ * \note 以QPixmap::cacheKey区分图标，请复用同一个QPixmap对象(如MapObjectItem::defaultIcon)以提高命中率
+ * \warning 只能在主线程使用tinted(QPixmap)，tinted(QImage)不使用缓存，可以在任意线程调用
+ */
+class MapIconCache
+{
+public:
+    /// 获取着色后的图标，效果等同于QGraphicsColorizeEffect，无效颜色返回原图
+    static QPixmap tinted(const QPixmap &icon, const QColor &color, qreal strength = 1.0);
+    /// 计算着色后的图像，不使用缓存
+    static QImage tinted(const QImage &icon, const QColor &color, qreal strength = 1.0);
+};
+
+#endif // MAPICONCACHE_H
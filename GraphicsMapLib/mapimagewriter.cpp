@@ -0,0 +1,323 @@
+﻿#include "mapimagewriter.h"
+#include <QFileInfo>
+#include <csetjmp>
+#include <cstdio>
+#include <png.h>
+#include <jpeglib.h>
+#include <jerror.h>
+
+#define JPEG_BUFFER_SIZE 65536  ///< JPEG编码输出缓冲区的字节数
+
+/*!
+ * \brief 编码器接口
+ * \note libpng和libjpeg通过longjmp报告错误，调用它们的函数中不能有需要析构的局部对象
+ */
+class MapImageWriter::Encoder
+{
+public:
+    virtual ~Encoder() {}
+    virtual bool start(const QSize &size, int dpi, int quality) = 0;
+    virtual bool write(const QImage &rows) = 0;
+    virtual bool finish() = 0;
+    QString error;
+};
+
+namespace {
+
+class PngEncoder : public MapImageWriter::Encoder
+{
+public:
+    explicit PngEncoder(QFile *file) :
+        m_file(file),
+        m_png(nullptr),
+        m_info(nullptr)
+    {
+        m_png = png_create_write_struct(PNG_LIBPNG_VER_STRING, this, &PngEncoder::onError, &PngEncoder::onWarning);
+        if(m_png)
+            m_info = png_create_info_struct(m_png);
+    }
+    ~PngEncoder()
+    {
+        png_destroy_write_struct(&m_png, &m_info);
+    }
+
+    bool start(const QSize &size, int dpi, int) override
+    {
+        if(!m_png || !m_info) {
+            error = "out of memory";
+            return false;
+        }
+        if(setjmp(png_jmpbuf(m_png)))
+            return false;
+        png_set_write_fn(m_png, m_file, &PngEncoder::onWrite, &PngEncoder::onFlush);
+        png_set_IHDR(m_png, m_info, png_uint_32(size.width()), png_uint_32(size.height()), 8, PNG_COLOR_TYPE_RGB,
+                     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        const png_uint_32 ppm = png_uint_32(dpi / 0.0254 + 0.5);
+        png_set_pHYs(m_png, m_info, ppm, ppm, PNG_RESOLUTION_METER);
+        png_write_info(m_png, m_info);
+        return true;
+    }
+
+    bool write(const QImage &rows) override
+    {
+        if(setjmp(png_jmpbuf(m_png)))
+            return false;
+        for(int y = 0; y < rows.height(); ++y) {
+            png_write_row(m_png, rows.constScanLine(y));
+        }
+        return true;
+    }
+
+    bool finish() override
+    {
+        if(setjmp(png_jmpbuf(m_png)))
+            return false;
+        png_write_end(m_png, nullptr);
+        return true;
+    }
+
+private:
+    static void onError(png_structp png, png_const_charp message)
+    {
+        static_cast<PngEncoder*>(png_get_error_ptr(png))->error = QString::fromLatin1(message);
+        png_longjmp(png, 1);
+    }
+    static void onWarning(png_structp, png_const_charp)
+    {
+    }
+    static void onWrite(png_structp png, png_bytep data, png_size_t length)
+    {
+        auto file = static_cast<QFile*>(png_get_io_ptr(png));
+        if(file->write(reinterpret_cast<const char*>(data), qint64(length)) != qint64(length))
+            png_error(png, "write error");
+    }
+    static void onFlush(png_structp)
+    {
+    }
+
+private:
+    QFile      *m_file;
+    png_structp m_png;
+    png_infop   m_info;
+};
+
+class JpegEncoder : public MapImageWriter::Encoder
+{
+public:
+    explicit JpegEncoder(QFile *file) :
+        m_file(file)
+    {
+        m_cinfo.err = jpeg_std_error(&m_error.pub);
+        m_error.pub.error_exit = &JpegEncoder::onError;
+        m_error.pub.output_message = &JpegEncoder::onMessage;
+        m_error.encoder = this;
+        jpeg_create_compress(&m_cinfo);
+        m_destination.init_destination = &JpegEncoder::onInit;
+        m_destination.empty_output_buffer = &JpegEncoder::onEmpty;
+        m_destination.term_destination = &JpegEncoder::onTerm;
+        m_cinfo.dest = &m_destination;
+        m_cinfo.client_data = this;
+    }
+    ~JpegEncoder()
+    {
+        jpeg_destroy_compress(&m_cinfo);
+    }
+
+    bool start(const QSize &size, int dpi, int quality) override
+    {
+        if(setjmp(m_error.jump))
+            return false;
+        m_cinfo.image_width = JDIMENSION(size.width());
+        m_cinfo.image_height = JDIMENSION(size.height());
+        m_cinfo.input_components = 3;
+        m_cinfo.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&m_cinfo);
+        jpeg_set_quality(&m_cinfo, quality, TRUE);
+        // dots per inch
+        m_cinfo.density_unit = 1;
+        m_cinfo.X_density = UINT16(dpi);
+        m_cinfo.Y_density = UINT16(dpi);
+        jpeg_start_compress(&m_cinfo, TRUE);
+        return true;
+    }
+
+    bool write(const QImage &rows) override
+    {
+        if(setjmp(m_error.jump))
+            return false;
+        for(int y = 0; y < rows.height(); ++y) {
+            JSAMPROW row = const_cast<JSAMPROW>(rows.constScanLine(y));
+            jpeg_write_scanlines(&m_cinfo, &row, 1);
+        }
+        return true;
+    }
+
+    bool finish() override
+    {
+        if(setjmp(m_error.jump))
+            return false;
+        jpeg_finish_compress(&m_cinfo);
+        return true;
+    }
+
+private:
+    struct ErrorManager {
+        jpeg_error_mgr pub;
+        JpegEncoder   *encoder;
+        jmp_buf        jump;
+    };
+
+    static void onError(j_common_ptr cinfo)
+    {
+        auto manager = reinterpret_cast<ErrorManager*>(cinfo->err);
+        char message[JMSG_LENGTH_MAX];
+        (*cinfo->err->format_message)(cinfo, message);
+        manager->encoder->error = QString::fromLatin1(message);
+        longjmp(manager->jump, 1);
+    }
+    static void onMessage(j_common_ptr)
+    {
+    }
+    static void onInit(j_compress_ptr cinfo)
+    {
+        auto encoder = static_cast<JpegEncoder*>(cinfo->client_data);
+        encoder->m_destination.next_output_byte = encoder->m_buffer;
+        encoder->m_destination.free_in_buffer = JPEG_BUFFER_SIZE;
+    }
+    static boolean onEmpty(j_compress_ptr cinfo)
+    {
+        // the whole buffer is full, free_in_buffer is not reliable here
+        auto encoder = static_cast<JpegEncoder*>(cinfo->client_data);
+        if(encoder->m_file->write(reinterpret_cast<const char*>(encoder->m_buffer), JPEG_BUFFER_SIZE) != JPEG_BUFFER_SIZE)
+            ERREXIT(cinfo, JERR_FILE_WRITE);
+        onInit(cinfo);
+        return TRUE;
+    }
+    static void onTerm(j_compress_ptr cinfo)
+    {
+        auto encoder = static_cast<JpegEncoder*>(cinfo->client_data);
+        const qint64 length = JPEG_BUFFER_SIZE - qint64(encoder->m_destination.free_in_buffer);
+        if(encoder->m_file->write(reinterpret_cast<const char*>(encoder->m_buffer), length) != length)
+            ERREXIT(cinfo, JERR_FILE_WRITE);
+    }
+
+private:
+    QFile                *m_file;
+    jpeg_compress_struct  m_cinfo;
+    ErrorManager          m_error;
+    jpeg_destination_mgr  m_destination;
+    JOCTET                m_buffer[JPEG_BUFFER_SIZE];
+};
+
+}
+
+MapImageWriter::MapImageWriter() :
+    m_encoder(nullptr),
+    m_written(0)
+{
+
+}
+
+MapImageWriter::~MapImageWriter()
+{
+    abort();
+}
+
+bool MapImageWriter::open(const QString &fileName, const QSize &size, int dpi, int quality)
+{
+    abort();
+    m_error.clear();
+    if(size.isEmpty()) {
+        m_error = "invalid image size";
+        return false;
+    }
+    const auto suffix = QFileInfo(fileName).suffix().toLower();
+    if(suffix != "png" && suffix != "jpg" && suffix != "jpeg") {
+        m_error = "unsupported image format: " + suffix;
+        return false;
+    }
+    m_file.setFileName(fileName);
+    if(!m_file.open(QIODevice::WriteOnly)) {
+        m_error = m_file.errorString();
+        return false;
+    }
+    if(suffix == "png")
+        m_encoder = new PngEncoder(&m_file);
+    else
+        m_encoder = new JpegEncoder(&m_file);
+    m_size = size;
+    m_written = 0;
+    if(!m_encoder->start(size, dpi, quality)) {
+        m_error = m_encoder->error;
+        abort();
+        return false;
+    }
+    return true;
+}
+
+bool MapImageWriter::write(const QImage &rows)
+{
+    if(!m_encoder)
+        return false;
+    // e.g. an empty strip at the border
+    if(rows.isNull())
+        return true;
+    if(rows.format() != QImage::Format_RGB888 || rows.width() != m_size.width() || m_written + rows.height() > m_size.height()) {
+        m_error = "rows do not match the image";
+        abort();
+        return false;
+    }
+    if(!m_encoder->write(rows)) {
+        m_error = m_encoder->error;
+        abort();
+        return false;
+    }
+    m_written += rows.height();
+    return true;
+}
+
+bool MapImageWriter::close()
+{
+    if(!m_encoder)
+        return false;
+    if(m_written != m_size.height()) {
+        m_error = QString("%1 of %2 rows written").arg(m_written).arg(m_size.height());
+        abort();
+        return false;
+    }
+    if(!m_encoder->finish()) {
+        m_error = m_encoder->error;
+        abort();
+        return false;
+    }
+    delete m_encoder;
+    m_encoder = nullptr;
+    m_file.close();
+    if(m_file.error() != QFileDevice::NoError) {
+        m_error = m_file.errorString();
+        m_file.remove();
+        return false;
+    }
+    return true;
+}
+
+int MapImageWriter::writtenRows() const
+{
+    return m_written;
+}
+
+QString MapImageWriter::errorString() const
+{
+    return m_error;
+}
+
+void MapImageWriter::abort()
+{
+    if(!m_encoder)
+        return;
+    delete m_encoder;
+    m_encoder = nullptr;
+    // an unfinished file is of no use
+    m_file.close();
+    m_file.remove();
+}
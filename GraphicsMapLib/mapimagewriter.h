@@ -0,0 +1,46 @@
+﻿#ifndef MAPIMAGEWRITER_H
+#define MAPIMAGEWRITER_H
+
+#include <QFile>
+#include <QImage>
+
+/*!
+ * \brief 逐行写入的图像文件
+ * \details 基于libpng和libjpeg按行编码，图像不需要完整保存在内存中，用于导出超大图片：
+ * 1.open根据后缀名选择格式(png、jpg/jpeg)并写入文件头；
+ * 2.write按从上到下的顺序写入若干行；
+ * 3.写满open时的高度后调用close完成文件
+ * \note 同一时刻只能在一个线程中使用，open和write可以在不同线程中调用
+ * \note 未完成或者失败的文件会被删除
+ */
+class MapImageWriter
+{
+public:
+    MapImageWriter();
+    ~MapImageWriter();
+    /// 根据后缀名打开文件并写入文件头，不支持的格式返回false
+    bool open(const QString &fileName, const QSize &size, int dpi = 96, int quality = 90);
+    /// 写入RGB888格式的若干行，宽度需要与open时一致，空图像被忽略
+    bool write(const QImage &rows);
+    /// 完成文件，写入的行数不足时返回false
+    bool close();
+    /// 已写入的行数
+    int writtenRows() const;
+    /// 最后一次错误的描述
+    QString errorString() const;
+
+    /// 编码器，由实现文件按格式定义
+    class Encoder;
+
+private:
+    void abort();
+
+private:
+    QFile    m_file;
+    Encoder *m_encoder;     ///< 按格式选择的编码器
+    QSize    m_size;        ///< 图像大小
+    int      m_written;     ///< 已写入的行数
+    QString  m_error;
+};
+
+#endif // MAPIMAGEWRITER_H
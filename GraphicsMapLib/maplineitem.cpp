@@ -1,10 +1,14 @@
 ﻿#include "maplineitem.h"
 #include "graphicsmap.h"
+#include "mapspatialindex.h"
 #include <QDebug>
+#include <QPainter>
 
 QSet<MapLineItem*> MapLineItem::m_items;
 
-MapLineItem::MapLineItem()
+MapLineItem::MapLineItem() :
+    m_geodesic(true),
+    m_zoom(MapScene::ZoomBase)
 {
     //
     m_items.insert(this);
@@ -36,6 +40,7 @@ MapLineItem::MapLineItem()
 MapLineItem::~MapLineItem()
 {
     m_items.remove(this);
+    MapSpatialIndex::instance()->remove(this);
 }
 
 void MapLineItem::setCheckable(bool checkable)
@@ -182,6 +187,19 @@ const QPair<QGeoCoordinate, QGeoCoordinate> &MapLineItem::endings()
     return m_endings;
 }
 
+void MapLineItem::setGeodesic(bool on)
+{
+    if(m_geodesic == on)
+        return;
+    m_geodesic = on;
+    updateEndings();
+}
+
+bool MapLineItem::isGeodesic() const
+{
+    return m_geodesic;
+}
+
 void MapLineItem::attach(MapObjectItem *obj, MapLabelItem *label)
 {
 
@@ -192,6 +210,34 @@ const QSet<MapLineItem *> &MapLineItem::items()
     return m_items;
 }
 
+QRectF MapLineItem::boundingRect() const
+{
+    if(m_path.isEmpty())
+        return QGraphicsLineItem::boundingRect();
+    qreal halfpw = pen().style() == Qt::NoPen ? qreal(0) : pen().widthF() / 2;
+    return m_path.controlPointRect().adjusted(-halfpw, -halfpw, halfpw, halfpw);
+}
+
+QPainterPath MapLineItem::shape() const
+{
+    if(m_path.isEmpty())
+        return QGraphicsLineItem::shape();
+    QPainterPathStroker stroker;
+    stroker.setWidth(qMax(pen().widthF(), 0.00000001));
+    return stroker.createStroke(m_path);
+}
+
+void MapLineItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    if(m_path.isEmpty()) {
+        QGraphicsLineItem::paint(painter, option, widget);
+        return;
+    }
+    painter->setPen(pen());
+    painter->setBrush(Qt::NoBrush);
+    painter->drawPath(m_path);
+}
+
 void MapLineItem::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
 {
     QGraphicsLineItem::mouseDoubleClickEvent(event);
@@ -210,4 +256,48 @@ void MapLineItem::updateEndings()
     //
     m_startIcon.setPos(p0);
     m_endIcon.setPos(p1);
+    //
+    if(m_geodesic)
+        m_geodesicPath.setPoints({m_endings.first, m_endings.second});
+    else
+        m_geodesicPath.setPoints({});
+    updatePath();
+    MapSpatialIndex::instance()->update(this, MapSpatialIndex::boundingRect({m_endings.first, m_endings.second}));
+}
+
+/// 缩放层级改变时从缓存中取出对应层级的大圆路径，只有两个端点时仍按直线绘制
+void MapLineItem::updateZoom(const float &zoom)
+{
+    // the path only changes between buckets, not on every frame of a smooth zoom
+    const bool same = MapGeodesicPath::bucket(zoom) == MapGeodesicPath::bucket(m_zoom);
+    m_zoom = zoom;
+    if(!same)
+        updatePath();
+}
+
+void MapLineItem::updatePath()
+{
+    QPainterPath path;
+    if(m_geodesicPath.points().size() == 2) {
+        const auto &scenePath = m_geodesicPath.path(m_zoom);
+        if(scenePath.elementCount() > 2)
+            path = scenePath.translated(-pos());
+    }
+    if(path == m_path)
+        return;
+    prepareGeometryChange();
+    m_path = path;
+}
+
+QVariant MapLineItem::itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value)
+{
+    if(change != ItemSceneHasChanged)
+        return QGraphicsLineItem::itemChange(change, value);
+
+    disconnect(m_zoomConnection);
+    if(auto map = GraphicsMap::fromScene(scene())) {
+        m_zoomConnection = connect(map, &GraphicsMap::zoomChanged, this, &MapLineItem::updateZoom);
+        updateZoom(map->zoomLevel());
+    }
+    return QGraphicsLineItem::itemChange(change, value);
 }
@@ -6,6 +6,7 @@
 #include <QTimer>
 #include <QGraphicsPixmapItem>
 #include "mapobjectitem.h"
+#include "mapgeodesicpath.h"
 
 class MapObjectItem;
 class MapLabelItem;
@@ -41,6 +42,9 @@ public:
     void setEndIcon(const QPixmap &pixmap, Qt::Alignment align = Qt::AlignCenter);
 	/// 获取线段两点位置
     const QPair<QGeoCoordinate, QGeoCoordinate> &endings();
+    /// 设置线段沿大圆绘制(默认开启)，关闭后为场景中的直线
+    void setGeodesic(bool on);
+    bool isGeodesic() const;
     /// 依附到地图对象和标签对象，将会自动更新位置
     void attach(MapObjectItem *obj, MapLabelItem *label);
     /// 取消依附地图对象，后续手动更新位置
@@ -53,10 +57,19 @@ public:
 signals:
     void doubleClicked();
 
+public:
+    virtual QRectF boundingRect() const override;
+    virtual QPainterPath shape() const override;
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+
 protected:
     virtual void mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event) override;
+    virtual QVariant itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value) override;
 private:
     void updateEndings();
+    void updateZoom(const float &zoom);
+    /// 取出当前层级的大圆路径
+    void updatePath();
 
 //    void onCoordinateDragged(const QGeoCoordinate &coord);
 private:
@@ -69,6 +82,11 @@ private:
     QGraphicsPixmapItem      m_endIcon;    ///<末端图标
     bool m_checkable;    ///< 勘测点可选中性
     QPair<QGeoCoordinate, QGeoCoordinate> m_endings;   ///<线段两点
+    bool                     m_geodesic;        ///< 沿大圆绘制
+    MapGeodesicPath          m_geodesicPath;    ///< 大圆路径及各层级缓存
+    QPainterPath             m_path;            ///< 当前层级的大圆路径(图元坐标)，为空时按直线绘制
+    float                    m_zoom;            ///< 所在地图的缩放层级
+    QMetaObject::Connection  m_zoomConnection;  ///< 与所在地图缩放信号的连接
 };
 
 #endif // MAPLINEITEM_H
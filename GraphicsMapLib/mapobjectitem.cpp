@@ -1,11 +1,24 @@
 ﻿#include "mapobjectitem.h"
 #include "graphicsmap.h"
+#include "mapspatialindex.h"
+#include "mapiconcache.h"
 #include "maptableitem.h"
 #include "mapscutcheonitem.h"
-#include <QGraphicsColorizeEffect>
+#include "mappropertymenu.h"
+#include "mapgeodesic.h"
+#include "maprouteitem.h"
+#include <QGraphicsScene>
 #include <QGraphicsSceneEvent>
+#include <QMetaMethod>
+#include <QElapsedTimer>
+#include <QtMath>
+#include <cmath>
 #include <QDebug>
 
+#define MOTION_TIMEOUT_MS 5000     ///< 超过该时间没有新的位置时停止外推
+#define MOTION_CORRECTION_MS 500   ///< 收到新的位置后消除显示误差的时长
+#define MOTION_MAX_LATITUDE 89.0   ///< 换算经度变化时使用的纬度上限，避免在极点附近经度变化趋于无穷
+
 /* XPM */
 static const char *default_xpm[] = {
 /* columns rows colors chars-per-pixel */
@@ -55,12 +68,51 @@ static const char *default_xpm[] = {
 };
 
 QSet<MapObjectItem*> MapObjectItem::m_items;
+QSet<MapObjectItem*> MapObjectItem::m_motionItems;
+QHash<const QGraphicsScene*, qint64> MapObjectItem::m_motionTimes;
+QSet<MapObjectItem*> MapObjectItem::m_pendingItems;
+QHash<const QGraphicsScene*, QHash<const QGraphicsView*, QRectF>> MapObjectItem::m_viewports;
+QHash<const QGraphicsScene*, QRectF> MapObjectItem::m_activeRects;
+
+struct MapObjectItem::Motion
+{
+    MapCoordinate base;     ///< 外推起点
+    qint64        time;     ///< 外推起点的时刻，毫秒
+    QPointF       error;    ///< 重新外推时显示位置与起点的差，场景坐标
+};
+
+/// 航位推算使用的单调时钟，单位毫秒
+static qint64 motionClock()
+{
+    static QElapsedTimer timer;
+    if(!timer.isValid())
+        timer.start();
+    return timer.elapsed();
+}
+
+/// 沿航向匀速外推，每次外推的距离较短，按局部平面计算
+static MapCoordinate extrapolate(const MapCoordinate &base, double speed, double heading, qint64 msecs)
+{
+    if(speed == 0 || msecs <= 0)
+        return base;
+    const double angle = speed * qMin(msecs, qint64(MOTION_TIMEOUT_MS)) / 1000.0 / MapGeodesic::earthRadius();
+    const double radHeading = qDegreesToRadians(heading);
+    const double cosLat = std::cos(qDegreesToRadians(qMin(qAbs(base.latitude), MOTION_MAX_LATITUDE)));
+    const double lat = base.latitude + qRadiansToDegrees(angle * std::cos(radHeading));
+    const double lon = base.longitude + qRadiansToDegrees(angle * std::sin(radHeading) / cosLat);
+    // keep the result valid when crossing the antimeridian or running into a pole
+    return MapCoordinate(qBound(-90.0, lat, 90.0), std::remainder(lon, 360.0));
+}
 
 MapObjectItem::MapObjectItem(const QGeoCoordinate &coord)
 {
-    auto font = m_text.font();
-    font.setFamily("Microsoft YaHei");
-    font.setPointSize(10);
+    // one font shared by all objects
+    static const QFont font = [](){
+        QFont font;
+        font.setFamily("Microsoft YaHei");
+        font.setPointSize(10);
+        return font;
+    }();
     m_text.setFont(font);
     m_text.setBrush(Qt::black);
     m_text.setParentItem(this);
@@ -71,15 +123,8 @@ MapObjectItem::MapObjectItem(const QGeoCoordinate &coord)
     this->setFlag(QGraphicsItem::ItemIgnoresTransformations, true);
     this->setFlag(QGraphicsItem::ItemSendsGeometryChanges, true);
     this->setTransformationMode(Qt::SmoothTransformation);
-    setIcon(QString());
-
-    m_menu = new QMenu;
-    m_action = new QAction;
-    m_menu->addAction(m_action);
-    m_action->setText(u8"右键属性");
-    connect(m_action, &QAction::triggered, this, [=](){
-        emit propertyRequset(this);
-    }, Qt::DirectConnection);
+    // shared with all default objects instead of parsing the xpm again
+    setIcon(defaultIcon());
     //
     m_items.insert(this);
 
@@ -90,19 +135,45 @@ MapObjectItem::MapObjectItem(const QGeoCoordinate &coord)
 MapObjectItem::~MapObjectItem()
 {
     m_items.remove(this);
+    m_motionItems.remove(this);
+    m_pendingItems.remove(this);
+    delete m_motion;
+    MapSpatialIndex::instance()->remove(this);
 }
 
 void MapObjectItem::setCoordinate(const QGeoCoordinate &coord)
+{
+    setMapCoordinate(coord);
+}
+
+void MapObjectItem::setMapCoordinate(const MapCoordinate &coord)
 {
     if(m_coord == coord)
         return;
 
     m_coord = coord;
-    this->setPos(GraphicsMap::toScene(coord));
-    emit coordinateChanged(coord);
+    MapSpatialIndex::instance()->update(this, m_coord);
+    const auto point = GraphicsMap::toScene(coord);
+    if(shouldDefer(point)) {
+        m_pendingPos = point;
+        defer(PendingCoordinate);
+        notifyDeferred();
+        return;
+    }
+    if(m_motion)
+        rebaseMotion(coord, point);
+    else
+        this->setPos(point);
+    clearPending(PendingCoordinate);
+    emit coordinateChanged(coord.toGeoCoordinate());
+}
+
+QGeoCoordinate MapObjectItem::coordinate() const
+{
+    return m_coord.toGeoCoordinate();
 }
 
-const QGeoCoordinate &MapObjectItem::coordinate() const
+const MapCoordinate &MapObjectItem::mapCoordinate() const
 {
     return m_coord;
 }
@@ -112,8 +183,19 @@ void MapObjectItem::setEuler(const QVector3D &euler)
     if(m_euler == euler)
         return;
 
+    // keep going from where the old heading has brought the object
+    if(m_motion) {
+        const auto coord = motionCoordinate();
+        rebaseMotion(coord, GraphicsMap::toScene(coord));
+    }
     m_euler = euler;
+    if(shouldDefer(this->pos())) {
+        defer(PendingEuler);
+        notifyDeferred();
+        return;
+    }
     this->setRotation(euler.x());
+    clearPending(PendingEuler);
     emit eulerChanged(euler);
 }
 
@@ -124,34 +206,18 @@ const QVector3D &MapObjectItem::euler() const
 
 void MapObjectItem::setIcon(const QPixmap &pixmap)
 {
-    this->setOffset(0, 0);
     // Reset to default icon
-    if(pixmap.isNull()) {
-        this->setPixmap(QPixmap(default_xpm));
-    }
-    else {
-        this->setPixmap(pixmap);
-    }
-    // make sure that the center of icon is positioned at current position
-    auto boundRect = this->boundingRect();
-    setOffset(-boundRect.center());
+    m_icon = pixmap.isNull() ? defaultIcon() : pixmap;
+    updateIcon();
 }
 
 void MapObjectItem::setIconColor(const QColor &color, qreal strength)
 {
-    // We should to unset previous color
-    if(!color.isValid()) {
-        this->setGraphicsEffect(nullptr);
+    if(m_iconColor == color && m_iconStrength == strength)
         return;
-    }
-
-    auto effect = dynamic_cast<QGraphicsColorizeEffect*>(graphicsEffect());
-    if(!effect) {
-        effect = new QGraphicsColorizeEffect;
-        this->setGraphicsEffect(effect);
-    }
-    effect->setColor(color);
-    effect->setStrength(strength);
+    m_iconColor = color;
+    m_iconStrength = strength;
+    updateIcon();
 }
 
 void MapObjectItem::setText(const QString &text, Qt::Alignment align)
@@ -248,6 +314,10 @@ MapRouteItem *MapObjectItem::route() const
 
 void MapObjectItem::setSpeed(double speed)
 {
+    if(m_motion) {
+        const auto coord = motionCoordinate();
+        rebaseMotion(coord, GraphicsMap::toScene(coord));
+    }
     m_speed = speed;
 }
 
@@ -256,16 +326,325 @@ const double MapObjectItem::getSpeed() const
     return m_speed;
 }
 
+void MapObjectItem::setDeadReckoning(bool on)
+{
+    if(isDeadReckoning() == on)
+        return;
+    if(on) {
+        flush();
+        m_motion = new Motion;
+        rebaseMotion(m_coord, GraphicsMap::toScene(m_coord));
+        m_motionItems.insert(this);
+    }
+    else {
+        m_motionItems.remove(this);
+        delete m_motion;
+        m_motion = nullptr;
+        this->setPos(GraphicsMap::toScene(m_coord));
+    }
+}
+
+bool MapObjectItem::isDeadReckoning() const
+{
+    return m_motion;
+}
+
+void MapObjectItem::setDeferredUpdate(bool on)
+{
+    if(m_deferrable == on)
+        return;
+    m_deferrable = on;
+    if(!on)
+        flush();
+}
+
+bool MapObjectItem::isDeferredUpdate() const
+{
+    return m_deferrable;
+}
+
+void MapObjectItem::flush()
+{
+    if(!m_pending)
+        return;
+    const auto pending = m_pending;
+    clearPending(m_pending);
+    if(pending & PendingCoordinate) {
+        this->setPos(m_pendingPos);
+        emit coordinateChanged(m_coord.toGeoCoordinate());
+    }
+    if(pending & PendingEuler) {
+        this->setRotation(m_euler.x());
+        emit eulerChanged(m_euler);
+    }
+}
+
+void MapObjectItem::reset()
+{
+    // drop the pending state instead of applying it
+    clearPending(m_pending);
+    m_deferrable = false;
+    setDeadReckoning(false);
+    //
+    m_iconColor = QColor();
+    m_iconStrength = 1.0;
+    setIcon(defaultIcon());
+    m_text.setText(QString());
+    m_text.setPen(Qt::NoPen);
+    m_text.setBrush(Qt::black);
+    setCheckable(false);
+    setMoveable(false);
+    m_enableMouse = true;
+    // leave the route, which would otherwise delete the pooled instance
+    if(auto route = dynamic_cast<MapRouteItem*>(parentItem()))
+        route->take(this);
+    if(m_route)
+        m_route->take(this);
+    setRoute(nullptr);
+    m_Suct = nullptr;
+    m_speed = 0;
+    m_euler = QVector3D();
+    this->setRotation(0);
+    // the next setCoordinate is always a change, and resumes the kept index entry
+    m_coord = MapCoordinate();
+    MapSpatialIndex::instance()->setEnabled(this, false);
+}
+
 const QSet<MapObjectItem *> &MapObjectItem::items()
 {
     return m_items;
 }
 
+const QPixmap &MapObjectItem::defaultIcon()
+{
+    static const QPixmap icon(default_xpm);
+    return icon;
+}
+
+void MapObjectItem::rebaseMotion(const MapCoordinate &base, const QPointF &point)
+{
+    m_motion->base = base;
+    m_motion->time = motionClock();
+    m_motion->error = this->pos() - point;
+}
+
+MapCoordinate MapObjectItem::motionCoordinate() const
+{
+    return extrapolate(m_motion->base, m_speed, m_euler.x(), motionClock() - m_motion->time);
+}
+
+/// 只有所在场景有地图在显示时才能判断是否可见，开启航位推算的对象每帧都会移动，不延迟
+bool MapObjectItem::shouldDefer(const QPointF &point) const
+{
+    if(!m_deferrable || m_motion || !scene())
+        return false;
+    auto iter = m_activeRects.constFind(scene());
+    if(iter == m_activeRects.constEnd())
+        return false;
+    return !iter.value().contains(this->pos()) && !iter.value().contains(point);
+}
+
+void MapObjectItem::defer(quint8 pending)
+{
+    if(!m_pending)
+        m_pendingItems.insert(this);
+    m_pending |= pending;
+}
+
+void MapObjectItem::notifyDeferred()
+{
+    if(notifier()->hasReceivers())
+        emit notifier()->batchUpdated({this});
+}
+
+void MapObjectItem::clearPending(quint8 pending)
+{
+    if(!(m_pending & pending))
+        return;
+    m_pending &= ~pending;
+    if(!m_pending)
+        m_pendingItems.remove(this);
+}
+
+/// 着色后的图标来自共享缓存，不再使用QGraphicsColorizeEffect逐帧离屏渲染
+void MapObjectItem::updateIcon()
+{
+    this->setOffset(0, 0);
+    this->setPixmap(MapIconCache::tinted(m_icon, m_iconColor, m_iconStrength));
+    // make sure that the center of icon is positioned at current position
+    auto boundRect = this->boundingRect();
+    setOffset(-boundRect.center());
+}
+
+void MapObjectItem::applyBatch(const MapObjectUpdate *updates, int count)
+{
+    if(count <= 0)
+        return;
+    static const auto coordinateSignal = QMetaMethod::fromSignal(&MapObjectItem::coordinateChanged);
+    static const auto eulerSignal = QMetaMethod::fromSignal(&MapObjectItem::eulerChanged);
+
+    // 1.project all coordinates at once
+    QVector<double> lat(count), lon(count);
+    for(int i = 0; i < count; ++i) {
+        lat[i] = updates[i].coord.latitude;
+        lon[i] = updates[i].coord.longitude;
+    }
+    QVector<QPointF> points(count);
+    GraphicsMap::toScene(lat.constData(), lon.constData(), points.data(), count);
+
+    // 2.apply, the bsp index already keeps moved items unindexed until the next query, only the items with receivers emit their own signals
+    QVector<MapObjectItem*> changed;
+    changed.reserve(count);
+    for(int i = 0; i < count; ++i) {
+        const auto &update = updates[i];
+        auto item = update.item;
+        if(!item)
+            continue;
+        bool itemChanged = false;
+        if(update.coord.isValid() && !(item->m_coord == update.coord)) {
+            item->m_coord = update.coord;
+            MapSpatialIndex::instance()->update(item, item->m_coord);
+            if(item->shouldDefer(points.at(i))) {
+                item->m_pendingPos = points.at(i);
+                item->defer(PendingCoordinate);
+            }
+            else {
+                if(item->m_motion)
+                    item->rebaseMotion(update.coord, points.at(i));
+                else
+                    item->setPos(points.at(i));
+                item->clearPending(PendingCoordinate);
+                if(item->isSignalConnected(coordinateSignal))
+                    emit item->coordinateChanged(update.coord.toGeoCoordinate());
+            }
+            itemChanged = true;
+        }
+        if(update.hasEuler && item->m_euler != update.euler) {
+            if(item->m_motion) {
+                const auto coord = item->motionCoordinate();
+                item->rebaseMotion(coord, GraphicsMap::toScene(coord));
+            }
+            item->m_euler = update.euler;
+            if(item->shouldDefer(item->pos())) {
+                item->defer(PendingEuler);
+            }
+            else {
+                item->setRotation(update.euler.x());
+                item->clearPending(PendingEuler);
+                if(item->isSignalConnected(eulerSignal))
+                    emit item->eulerChanged(update.euler);
+            }
+            itemChanged = true;
+        }
+        if(itemChanged)
+            changed.append(item);
+    }
+    if(!changed.isEmpty())
+        emit notifier()->batchUpdated(changed);
+}
+
+void MapObjectItem::applyBatch(const QVector<MapObjectUpdate> &updates)
+{
+    applyBatch(updates.constData(), updates.size());
+}
+
+MapObjectNotifier *MapObjectItem::notifier()
+{
+    static MapObjectNotifier notifier;
+    return &notifier;
+}
+
+void MapObjectItem::advanceMotion(const QGraphicsScene *scene)
+{
+    if(m_motionItems.isEmpty() || !scene)
+        return;
+    const qint64 now = motionClock();
+    // several maps may show the same scene, the positions only depend on the time
+    auto &last = m_motionTimes[scene];
+    if(last == now)
+        return;
+    last = now;
+
+    // 1.extrapolate all objects of the scene and project them at once
+    QVector<MapObjectItem*> items;
+    QVector<double> lat, lon;
+    items.reserve(m_motionItems.size());
+    lat.reserve(m_motionItems.size());
+    lon.reserve(m_motionItems.size());
+    for(auto item : qAsConst(m_motionItems)) {
+        if(item->scene() != scene || !item->isVisible())
+            continue;
+        const auto coord = item->motionCoordinate();
+        items.append(item);
+        lat.append(coord.latitude);
+        lon.append(coord.longitude);
+    }
+    QVector<QPointF> points(items.size());
+    GraphicsMap::toScene(lat.constData(), lon.constData(), points.data(), items.size());
+
+    // 2.fade out the error of the last rebase, so that a new position never makes a jump
+    for(int i = 0; i < items.size(); ++i) {
+        auto item = items.at(i);
+        const auto &motion = *item->m_motion;
+        const qreal fade = qMax(0.0, 1.0 - (now - motion.time) / qreal(MOTION_CORRECTION_MS));
+        const auto pos = points.at(i) + motion.error * fade;
+        if(item->pos() != pos)
+            item->setPos(pos);
+    }
+}
+
+void MapObjectItem::updateViewport(const QGraphicsScene *scene, const QGraphicsView *view, const QRectF &rect)
+{
+    // 1.unite the visible rects of all views of the scene
+    auto &views = m_viewports[scene];
+    if(rect.isNull())
+        views.remove(view);
+    else
+        views.insert(view, rect);
+    QRectF active;
+    for(const auto &viewRect : qAsConst(views)) {
+        active |= viewRect;
+    }
+    if(views.isEmpty()) {
+        m_viewports.remove(scene);
+        m_activeRects.remove(scene);
+    }
+    else {
+        m_activeRects.insert(scene, active);
+    }
+    if(m_pendingItems.isEmpty())
+        return;
+
+    // 2.apply the items which come into view, or all of them when the scene has no view any more
+    QVector<MapObjectItem*> entered;
+    for(auto item : qAsConst(m_pendingItems)) {
+        if(item->scene() != scene)
+            continue;
+        if(active.isNull() || active.contains(item->pos())
+                || ((item->m_pending & PendingCoordinate) && active.contains(item->m_pendingPos)))
+            entered.append(item);
+    }
+    for(auto item : qAsConst(entered)) {
+        item->flush();
+    }
+}
+
+void MapObjectItem::flushAll()
+{
+    const auto items = m_pendingItems;
+    for(auto item : items) {
+        item->flush();
+    }
+}
+
 QVariant MapObjectItem::itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value)
 {
    if(change == ItemRotationHasChanged) {
        emit rotationChanged(this->rotation());
    }
+   else if(change == ItemSceneHasChanged) {
+       flush();
+   }
    return QGraphicsPixmapItem::itemChange(change, value);
 }
 
@@ -310,8 +689,12 @@ void MapObjectItem::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 {
     QGraphicsPixmapItem::mouseMoveEvent(event);
 
-    m_coord = GraphicsMap::toCoordinate(this->scenePos());
-    emit coordinateDragged(m_coord);
+    auto coord = GraphicsMap::toCoordinate(this->scenePos());
+    m_coord = coord;
+    if(m_motion)
+        rebaseMotion(m_coord, this->scenePos());
+    MapSpatialIndex::instance()->update(this, m_coord);
+    emit coordinateDragged(coord);
 }
 
 void MapObjectItem::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
@@ -338,6 +721,6 @@ void MapObjectItem::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
 
 void MapObjectItem::contextMenuEvent(QGraphicsSceneContextMenuEvent *event)
 {
-    if(m_checkable)
-        m_menu->exec(QCursor::pos());
+    if(m_checkable && MapPropertyMenu::exec(this))
+        emit propertyRequset(this);
 }
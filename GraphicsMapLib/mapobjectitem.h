@@ -2,14 +2,44 @@
 #define MAPOBJECTITEM_H
 
 #include "maprouteitem.h"
+#include "mapcoordinate.h"
 #include <QGraphicsPixmapItem>
+#include <QHash>
+#include <QMetaMethod>
 #include <QGeoCoordinate>
 #include <QVector3D>
 #include <QDebug>
 #include <QMenu>
 
+class QGraphicsView;
 class MapTableItem;
 class MapSuctcheonItem;
+class MapObjectItem;
+
+/// 批量更新中的一项
+struct MapObjectUpdate
+{
+    MapObjectItem *item;
+    MapCoordinate  coord;               ///< 无效坐标表示不修改位置
+    QVector3D      euler;
+    bool           hasEuler = false;    ///< 是否修改欧拉角
+};
+
+/*!
+ * \brief 地图对象的批量更新通知
+ * \details 每次MapObjectItem::applyBatch只发出一次信号，代替逐个对象的coordinateChanged和eulerChanged；
+ * 视图外延迟的setCoordinate/setEuler不发出coordinateChanged/eulerChanged，也通过该信号通知
+ */
+class MapObjectNotifier : public QObject
+{
+    Q_OBJECT
+public:
+    /// 是否有接收者，没有时不构造通知列表
+    bool hasReceivers() const { return isSignalConnected(QMetaMethod::fromSignal(&MapObjectNotifier::batchUpdated)); }
+signals:
+    /// 本批次中位置或欧拉角发生改变的对象
+    void batchUpdated(const QVector<MapObjectItem*> &items);
+};
 
 /*!
  * \brief 地图对象
@@ -26,16 +56,17 @@ public:
     ~MapObjectItem();
     /// 设置经纬度位置
     void setCoordinate(const QGeoCoordinate &coord);
-    /// 获取当前经纬度位置
-    const QGeoCoordinate &coordinate() const;
+    void setMapCoordinate(const MapCoordinate &coord);
+    /// 获取当前经纬度位置，大量调用时请使用mapCoordinate以免构造QGeoCoordinate
+    QGeoCoordinate coordinate() const;
+    const MapCoordinate &mapCoordinate() const;
     /// 设置欧拉角  修改当前地图飞机对象
     void setEuler(const QVector3D &euler);
     /// 获取欧拉角
     const QVector3D &euler() const;
     /// 设置图标，无效资源将使用默认图标
     void setIcon(const QPixmap &pixmap);
-    /// 设置图标为纯色，传QColor()可以取消纯色 note: 高分辨图片对该接口性能影响较大
-    /// \bug QGraphicsView使用OpenGL窗口时，第二个实例调用该函数会变成黑框
+    /// 设置图标为纯色，传QColor()可以取消纯色，着色结果由MapIconCache缓存并在对象间共用
     void setIconColor(const QColor &color, qreal strength = 1.0);
     /// 设置文字
     void setText(const QString &text, Qt::Alignment align = Qt::AlignCenter);
@@ -59,6 +90,33 @@ public:
     /// 节点速度  note:支持航路节点速度存储 亦可指代当前节点初始速度
     void setSpeed(double speed);
     const double getSpeed() const;
+    /*!
+     * \brief 设置航位推算
+     * \details 开启后每帧绘制前根据速度(米/秒)和欧拉角的航向外推显示位置，不再需要高频调用setCoordinate，
+     * 收到新的位置时从当前显示位置平滑过渡到外推位置，coordinate()始终为最后一次设置的真实位置
+     * \note 需要通过GraphicsMap::setFrameRate定时刷新，超过5秒没有新的位置时停止外推
+     * \note 开启后scenePos()是外推的显示位置，不再与coordinate()对应，需要上报位置的场景坐标时请投影mapCoordinate()
+     */
+    void setDeadReckoning(bool on);
+    bool isDeadReckoning() const;
+    /*!
+     * \brief 设置视图外延迟更新
+     * \details 开启后，新旧位置都在所有地图的可见范围之外时，setCoordinate、setEuler和applyBatch只记录最新状态，
+     * 不移动图元、不更新场景索引也不发出coordinateChanged/eulerChanged(航迹和标牌因此不更新)，
+     * 对象进入可见范围、被移到其他场景或者调用flush时一次应用
+     * \note coordinate()和euler()始终返回最新值，MapSpatialIndex也始终更新；开启航位推算的对象不延迟
+     * \note 延迟期间的改变通过notifier()的batchUpdated通知，电子围栏、聚合和接近告警等只依赖最新状态的功能不受影响
+     */
+    void setDeferredUpdate(bool on);
+    bool isDeferredUpdate() const;
+    /// 立即应用延迟的更新，需要读取场景位置或者需要信号时调用
+    void flush();
+    /*!
+     * \brief 恢复默认状态，对象池回收时调用
+     * \details 恢复默认图标、清空文字和选中状态、关闭航位推算和延迟更新，位置置为无效并暂停在MapSpatialIndex中的索引项(再次setCoordinate时恢复)，航点从所在的MapRouteItem取出，避免航路删除被回收的实例
+     * \note 不断开信号连接，也不会从MapClusterLayer、MapGeofenceEngine等处移除
+     */
+    void reset();
 
     /// 标牌
     void takeOver(MapSuctcheonItem * suct) { m_Suct = suct; }
@@ -66,6 +124,24 @@ public:
 public:
     /// 获取所有的实例
     static const QSet<MapObjectItem*> &items();
+    /// 默认图标，所有对象共用
+    static const QPixmap &defaultIcon();
+    /*!
+     * \brief 批量修改位置和欧拉角，建议每帧调用一次
+     * \details 1.所有坐标一次投影到场景；
+     * 2.只对连接了coordinateChanged/eulerChanged的对象逐个发出信号(如依附的航迹、距离环和居中)，
+     * 其他对象的改变通过notifier()的batchUpdated信号一次通知
+     */
+    static void applyBatch(const MapObjectUpdate *updates, int count);
+    static void applyBatch(const QVector<MapObjectUpdate> &updates);
+    /// 批量更新的通知对象
+    static MapObjectNotifier *notifier();
+    /// 外推场景中开启了航位推算的对象，由GraphicsMap的帧定时器在刷新视口之前调用，同一时刻的重复调用会被忽略
+    static void advanceMotion(const QGraphicsScene *scene);
+    /// 记录视图的可见场景范围并应用进入范围的延迟更新，由GraphicsMap在可见范围改变后、绘制之外调用，空矩形表示移除该视图
+    static void updateViewport(const QGraphicsScene *scene, const QGraphicsView *view, const QRectF &rect);
+    /// 应用所有对象延迟的更新
+    static void flushAll();
 
 signals:
     void clicked(bool checked = false);
@@ -79,6 +155,25 @@ signals:
     void rotationChanged(qreal degree);
     void routeChanged(MapRouteItem *route);
     void propertyRequset(MapObjectItem *item);
+private:
+    /// 航位推算状态
+    struct Motion;
+    void updateIcon();
+    /// 以新的起点重新开始外推，记录当前显示位置的误差
+    void rebaseMotion(const MapCoordinate &base, const QPointF &point);
+    /// 当前外推的位置，不含误差
+    MapCoordinate motionCoordinate() const;
+    /// 延迟的更新
+    enum Pending : quint8 {
+        PendingCoordinate = 0x01,
+        PendingEuler      = 0x02
+    };
+    /// 新旧位置是否都在可见范围之外
+    bool shouldDefer(const QPointF &point) const;
+    void defer(quint8 pending);
+    void clearPending(quint8 pending);
+    /// 延迟的改变不发出coordinateChanged/eulerChanged，通过批量通知告知只关心最新状态的接收者
+    void notifyDeferred();
 protected:
     /// 获取rotation信号和移动信号
     virtual QVariant itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value) override;
@@ -91,13 +186,21 @@ protected:
     virtual void contextMenuEvent(QGraphicsSceneContextMenuEvent *event) override;
 private:
     static QSet<MapObjectItem*> m_items;         ///< 所有实例
+    static QSet<MapObjectItem*> m_motionItems;   ///< 开启了航位推算的实例
+    static QHash<const QGraphicsScene*, qint64> m_motionTimes;  ///< 各场景上次外推的时刻
+    static QSet<MapObjectItem*> m_pendingItems;  ///< 有延迟更新的实例
+    static QHash<const QGraphicsScene*, QHash<const QGraphicsView*, QRectF>> m_viewports;  ///< 各场景中地图的可见范围
+    static QHash<const QGraphicsScene*, QRectF> m_activeRects;  ///< 各场景所有可见范围的并集
 protected:
     bool m_enableMouse = true;
     bool m_checkable = false;
     bool m_checked = false;
 private:
-    QGeoCoordinate          m_coord;
+    MapCoordinate           m_coord;
     QVector3D               m_euler;
+    QPixmap                 m_icon;             ///< 未着色的图标
+    QColor                  m_iconColor;        ///< 图标颜色
+    qreal                   m_iconStrength = 1.0;
     QGraphicsEllipseItem    m_border;
     QGraphicsSimpleTextItem m_text;
     MapRouteItem           *m_route = nullptr;
@@ -105,13 +208,14 @@ private:
     //
     QPoint m_pressPos;
     // 节点速度  note:支持航路节点速度存储 亦可指代当前节点初始速度
-    double m_speed;
+    double m_speed = 0;
+    Motion *m_motion = nullptr;     ///< 航位推算状态，未开启时为空
+    bool    m_deferrable = false;   ///< 是否开启视图外延迟更新
+    quint8  m_pending = 0;          ///< 延迟的更新
+    QPointF m_pendingPos;           ///< 延迟的场景位置
 
     //MapTableItem	*m_Suct = nullptr; //显示标牌对象
     MapSuctcheonItem *m_Suct = nullptr;
-
-    QMenu   *m_menu;
-    QAction *m_action;
 };
 
 #endif // MAPOBJECTITEM_H
@@ -167,7 +167,7 @@ bool MapPolygonOperator::keyPressEvent(QKeyEvent *event)
     if(!m_polygon)
         return false;
     if(event->key() == Qt::Key_Backspace) {
-        m_polygon->remove(m_polygon->points().size()-1);
+        m_polygon->remove(m_polygon->count()-1);
     }
     return false;
 }
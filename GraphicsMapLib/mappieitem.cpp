@@ -1,6 +1,7 @@
 ﻿#include "mappieitem.h"
 #include "graphicsmap.h"
 #include "mapobjectitem.h"
+#include "mapgeodesic.h"
 
 QSet<MapPieItem*> MapPieItem::m_items;
 QSet<MapTriTrapItem*> MapTriTrapItem::m_items;
@@ -69,11 +70,15 @@ void MapPieItem::setAngle(const qreal &degree)
 
 void MapPieItem::updatePie()
 {
-    auto up = m_coord.atDistanceAndAzimuth(m_radius, 0);
-    auto right = m_coord.atDistanceAndAzimuth(m_radius, 90);
-    auto upPoint = GraphicsMap::toScene(up);
-    auto rightPoint = GraphicsMap::toScene(right);
-    auto centerPoint = GraphicsMap::toScene(m_coord);
+    // up and right in one batch
+    const MapCoordinate center = m_coord;
+    const double distances[2] = {m_radius, m_radius};
+    const double azimuths[2] = {0, 90};
+    MapCoordinate coords[2];
+    MapGeodesic::destinations(center, distances, azimuths, coords, 2);
+    auto upPoint = GraphicsMap::toScene(coords[0]);
+    auto rightPoint = GraphicsMap::toScene(coords[1]);
+    auto centerPoint = GraphicsMap::toScene(center);
     //
     QPointF topLeft(2*centerPoint.rx() - rightPoint.rx(), upPoint.ry());
     QPointF bottomRight(rightPoint.rx(), 2*centerPoint.ry() - upPoint.ry());
@@ -191,15 +196,24 @@ void MapTriTrapItem::updateTrapezoid()
     auto span_2 = m_span / 2;
     auto beginAz = m_azimuth + m_attachAzimuth - span_2;
     auto endAz = m_azimuth + m_attachAzimuth + span_2;
-    auto coord1 = m_coord.atDistanceAndAzimuth(m_near, beginAz);
-    auto coord2 = m_coord.atDistanceAndAzimuth(m_near, endAz);
-    auto coord3 = m_coord.atDistanceAndAzimuth(m_far, endAz);
-    auto coord4 = m_coord.atDistanceAndAzimuth(m_far, beginAz);
-    auto point0 = GraphicsMap::toScene(m_coord);
-    auto point1 = GraphicsMap::toScene(coord1);
-    auto point2 = GraphicsMap::toScene(coord2);
-    auto point3 = GraphicsMap::toScene(coord3);
-    auto point4 = GraphicsMap::toScene(coord4);
+    // the center and the four corners are computed and projected in one batch
+    const double distances[4] = {m_near, m_near, m_far, m_far};
+    const double azimuths[4] = {beginAz, endAz, endAz, beginAz};
+    MapCoordinate coords[5];
+    coords[0] = m_coord;
+    MapGeodesic::destinations(coords[0], distances, azimuths, coords + 1, 4);
+    double lat[5], lon[5];
+    for(int i = 0; i < 5; ++i) {
+        lat[i] = coords[i].latitude;
+        lon[i] = coords[i].longitude;
+    }
+    QPointF points[5];
+    GraphicsMap::toScene(lat, lon, points, 5);
+    const auto &point0 = points[0];
+    const auto &point1 = points[1];
+    const auto &point2 = points[2];
+    const auto &point3 = points[3];
+    const auto &point4 = points[4];
     {   // Self
         QPolygonF polygon;
         polygon.append(point0);
@@ -1,5 +1,7 @@
 ﻿#include "mappolygonitem.h"
 #include "graphicsmap.h"
+#include "mapspatialindex.h"
+#include "mappropertymenu.h"
 #include <QGraphicsEllipseItem>
 #include <QGraphicsSceneMouseEvent>
 #include <QGraphicsSceneHoverEvent>
@@ -16,14 +18,6 @@ MapPolygonItem::MapPolygonItem() :
     pen.setWidth(1);
 //    pen.setCosmetic(true);
     this->setPen(pen);
-
-    m_menu = new QMenu;
-    m_action = new QAction;
-    m_menu->addAction(m_action);
-    m_action->setText(u8"右键属性");
-    connect(m_action, &QAction::triggered, this, [=](){
-        emit propertyRequset(this);
-    }, Qt::DirectConnection);
     //
     m_items.insert(this);
     updateEditable();
@@ -32,6 +26,7 @@ MapPolygonItem::MapPolygonItem() :
 MapPolygonItem::~MapPolygonItem()
 {
     m_items.remove(this);
+    MapSpatialIndex::instance()->remove(this);
 }
 
 void MapPolygonItem::setEditable(bool editable)
@@ -82,7 +77,7 @@ void MapPolygonItem::remove(int index)
 {
     if(index < 0 || index >= m_coords.size())
         return;
-    auto coord = m_coords.at(index);
+    auto coord = m_coords.at(index).toGeoCoordinate();
     m_coords.removeAt(index);
     m_points.removeAt(index);
     //
@@ -97,23 +92,29 @@ void MapPolygonItem::removeEnd()
 }
 
 void MapPolygonItem::setPoints(const QVector<QGeoCoordinate> &coords)
+{
+    setMapPoints(MapCoordinate::fromGeoCoordinates(coords));
+}
+
+void MapPolygonItem::setMapPoints(const QVector<MapCoordinate> &coords)
 {
     if(m_coords == coords)
         return;
 
     // Change previous coords and points
     m_coords = coords;
-    m_points.clear();
-    for(auto &coord : coords) {
-        auto point = GraphicsMap::toScene(coord);
-        m_points.append(point);
-    }
+    m_points = GraphicsMap::toScene(coords);
     updatePolygon();
     //
     emit changed();
 }
 
-const QVector<QGeoCoordinate> &MapPolygonItem::points() const
+QVector<QGeoCoordinate> MapPolygonItem::points() const
+{
+    return MapCoordinate::toGeoCoordinates(m_coords);
+}
+
+const QVector<MapCoordinate> &MapPolygonItem::mapPoints() const
 {
     return m_coords;
 }
@@ -123,9 +124,9 @@ int MapPolygonItem::count()
     return m_coords.size();
 }
 
-const QGeoCoordinate &MapPolygonItem::at(int i) const
+QGeoCoordinate MapPolygonItem::at(int i) const
 {
-    return m_coords.at(i);
+    return m_coords.at(i).toGeoCoordinate();
 }
 
 const QSet<MapPolygonItem *> &MapPolygonItem::items()
@@ -150,14 +151,15 @@ void MapPolygonItem::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
 
 void MapPolygonItem::contextMenuEvent(QGraphicsSceneContextMenuEvent *event)
 {
-    if(m_editable)
-        m_menu->exec(QCursor::pos());
+    if(m_editable && MapPropertyMenu::exec(this))
+        emit propertyRequset(this);
 }
 
 void MapPolygonItem::updatePolygon()
 {
     // Reset polygon data to QGraphicsPolygonItem
     this->setPolygon(m_points);
+    MapSpatialIndex::instance()->update(this, MapSpatialIndex::boundingRect(m_coords));
 
     updateEditable();
 }
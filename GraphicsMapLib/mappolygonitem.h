@@ -6,6 +6,7 @@
 #include <QGraphicsEllipseItem>
 #include <QGeoCoordinate>
 #include <QMenu>
+#include "mapcoordinate.h"
 
 /*!
  * \brief 多边形
@@ -30,11 +31,13 @@ public:
     void removeEnd();
     /// 设置多边形顶点
     void setPoints(const QVector<QGeoCoordinate> &coords);
-    /// 获取多边形顶点
-    const QVector<QGeoCoordinate> &points() const;
+    void setMapPoints(const QVector<MapCoordinate> &coords);
+    /// 获取多边形顶点，大量顶点时请使用mapPoints以免逐个构造QGeoCoordinate
+    QVector<QGeoCoordinate> points() const;
+    const QVector<MapCoordinate> &mapPoints() const;
     int count();
     /// 获取某个点的位置
-    const QGeoCoordinate &at(int i) const;
+    QGeoCoordinate at(int i) const;
 
 public:
     /// 获取所有的实例
@@ -64,11 +67,8 @@ private:
     bool    m_editable;   ///< 鼠标是否可交互编辑
     bool    m_sceneAdded; ///< 是否已被添加到场景
     //
-    QVector<QGeoCoordinate>      m_coords;     ///< 经纬点列表
+    QVector<MapCoordinate>       m_coords;     ///< 经纬点列表
     QVector<QPointF>             m_points;     ///< 场景坐标点列表
-
-    QMenu   *m_menu;
-    QAction *m_action;
 };
 
 #endif // MAPPOLYGONITEM_H
@@ -0,0 +1,195 @@
+﻿#include "mapprojection.h"
+#include <QtMath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MAP_PROJECTION_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define MAP_PROJECTION_AVX2
+#define MAP_AVX2_TARGET
+#include <immintrin.h>
+#elif defined(MAP_PROJECTION_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// build the AVX2 kernel anyway, and choose it when the CPU supports
+#define MAP_PROJECTION_AVX2
+#define MAP_PROJECTION_AVX2_RUNTIME
+#define MAP_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+#define MAX_LATITUDE MapProjection::maxLatitude()  ///< 纬度限制，与MapWebMercator::toScene一致
+
+/// sin的泰勒展开系数(x^3 ~ x^19)，|x| <= π/2时截断误差小于1e-16
+static const double SIN_COEF[9] = {
+    -1.0 / 6.0,
+    1.0 / 120.0,
+    -1.0 / 5040.0,
+    1.0 / 362880.0,
+    -1.0 / 39916800.0,
+    1.0 / 6227020800.0,
+    -1.0 / 1307674368000.0,
+    1.0 / 355687428096000.0,
+    -1.0 / 121645100408832000.0
+};
+/// atanh级数 t^(2k+1)/(2k+1) 的项数，|t| <= 0.172时截断误差小于1e-16
+static const int ATANH_TERMS = 10;
+
+static void mercatorScalar(const double *lat, const double *lon, QPointF *points, int count, double radius)
+{
+    for(int i = 0; i < count; ++i) {
+        double radLon = qDegreesToRadians(lon[i]);
+        double y = lat[i];
+        if(!qIsNaN(y)) {
+            double radLat = qDegreesToRadians(qBound(-MAX_LATITUDE, y, MAX_LATITUDE));
+            y = qLn(qTan(M_PI_4 + radLat / 2.0));
+        }
+        points[i] = QPointF(radius * radLon, -radius * y);
+    }
+}
+
+#ifdef MAP_PROJECTION_SSE2
+static inline __m128d sinSSE2(__m128d x)
+{
+    __m128d x2 = _mm_mul_pd(x, x);
+    __m128d poly = _mm_set1_pd(SIN_COEF[8]);
+    for(int i = 7; i >= 0; --i)
+        poly = _mm_add_pd(_mm_mul_pd(poly, x2), _mm_set1_pd(SIN_COEF[i]));
+    poly = _mm_add_pd(_mm_mul_pd(poly, x2), _mm_set1_pd(1.0));
+    return _mm_mul_pd(poly, x);
+}
+
+/// 仅适用于正规的正数
+static inline __m128d logSSE2(__m128d x)
+{
+    const __m128i bits = _mm_castpd_si128(x);
+    // exponent: the biased exponent is small, so it can be converted by the 2^52 magic number
+    const __m128d magic = _mm_set1_pd(4503599627370496.0);
+    __m128d exponent = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(bits, 52), _mm_castpd_si128(magic))), magic);
+    exponent = _mm_sub_pd(exponent, _mm_set1_pd(1023.0));
+    // mantissa in [1, 2), and then move it into [sqrt(0.5), sqrt(2))
+    const __m128i mantissaMask = _mm_set1_epi64x(0x000FFFFFFFFFFFFFLL);
+    __m128d mantissa = _mm_or_pd(_mm_castsi128_pd(_mm_and_si128(bits, mantissaMask)), _mm_set1_pd(1.0));
+    __m128d large = _mm_cmpgt_pd(mantissa, _mm_set1_pd(M_SQRT2));
+    mantissa = _mm_or_pd(_mm_andnot_pd(large, mantissa), _mm_and_pd(large, _mm_mul_pd(mantissa, _mm_set1_pd(0.5))));
+    exponent = _mm_add_pd(exponent, _mm_and_pd(large, _mm_set1_pd(1.0)));
+    // ln(m) = 2 * atanh((m-1)/(m+1))
+    __m128d t = _mm_div_pd(_mm_sub_pd(mantissa, _mm_set1_pd(1.0)), _mm_add_pd(mantissa, _mm_set1_pd(1.0)));
+    __m128d t2 = _mm_mul_pd(t, t);
+    __m128d poly = _mm_set1_pd(1.0 / (2 * ATANH_TERMS - 1));
+    for(int k = ATANH_TERMS - 2; k >= 0; --k)
+        poly = _mm_add_pd(_mm_mul_pd(poly, t2), _mm_set1_pd(1.0 / (2 * k + 1)));
+    __m128d lnMantissa = _mm_mul_pd(_mm_mul_pd(poly, t), _mm_set1_pd(2.0));
+    return _mm_add_pd(_mm_mul_pd(exponent, _mm_set1_pd(M_LN2)), lnMantissa);
+}
+
+/// 每次处理2个点，返回已处理的数量
+static int mercatorSSE2(const double *lat, const double *lon, QPointF *points, int count, double radius)
+{
+    const __m128d degToRad = _mm_set1_pd(M_PI / 180.0);
+    const __m128d maxLat = _mm_set1_pd(MAX_LATITUDE);
+    const __m128d minLat = _mm_set1_pd(-MAX_LATITUDE);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d r = _mm_set1_pd(radius);
+    const __m128d negHalfR = _mm_set1_pd(-0.5 * radius);
+    double *out = reinterpret_cast<double*>(points);
+
+    int i = 0;
+    for(; i + 2 <= count; i += 2) {
+        __m128d la = _mm_loadu_pd(lat + i);
+        __m128d lo = _mm_loadu_pd(lon + i);
+        __m128d invalid = _mm_cmpunord_pd(la, la);
+        // NOTE: operand order matters, min/max return the second operand when the first one is NaN
+        la = _mm_max_pd(minLat, _mm_min_pd(maxLat, la));
+        __m128d s = sinSSE2(_mm_mul_pd(la, degToRad));
+        // atanh(s) = 0.5 * ln((1+s)/(1-s))
+        __m128d y = _mm_mul_pd(logSSE2(_mm_div_pd(_mm_add_pd(one, s), _mm_sub_pd(one, s))), negHalfR);
+        y = _mm_or_pd(_mm_andnot_pd(invalid, y), _mm_and_pd(invalid, la));
+        __m128d x = _mm_mul_pd(_mm_mul_pd(lo, degToRad), r);
+        // interleave into QPointF
+        _mm_storeu_pd(out + 2*i, _mm_unpacklo_pd(x, y));
+        _mm_storeu_pd(out + 2*i + 2, _mm_unpackhi_pd(x, y));
+    }
+    return i;
+}
+#endif
+
+#ifdef MAP_PROJECTION_AVX2
+MAP_AVX2_TARGET static inline __m256d sinAVX2(__m256d x)
+{
+    __m256d x2 = _mm256_mul_pd(x, x);
+    __m256d poly = _mm256_set1_pd(SIN_COEF[8]);
+    for(int i = 7; i >= 0; --i)
+        poly = _mm256_add_pd(_mm256_mul_pd(poly, x2), _mm256_set1_pd(SIN_COEF[i]));
+    poly = _mm256_add_pd(_mm256_mul_pd(poly, x2), _mm256_set1_pd(1.0));
+    return _mm256_mul_pd(poly, x);
+}
+
+/// 仅适用于正规的正数
+MAP_AVX2_TARGET static inline __m256d logAVX2(__m256d x)
+{
+    const __m256i bits = _mm256_castpd_si256(x);
+    const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+    __m256d exponent = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), _mm256_castpd_si256(magic))), magic);
+    exponent = _mm256_sub_pd(exponent, _mm256_set1_pd(1023.0));
+    const __m256i mantissaMask = _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL);
+    __m256d mantissa = _mm256_or_pd(_mm256_castsi256_pd(_mm256_and_si256(bits, mantissaMask)), _mm256_set1_pd(1.0));
+    __m256d large = _mm256_cmp_pd(mantissa, _mm256_set1_pd(M_SQRT2), _CMP_GT_OQ);
+    mantissa = _mm256_blendv_pd(mantissa, _mm256_mul_pd(mantissa, _mm256_set1_pd(0.5)), large);
+    exponent = _mm256_add_pd(exponent, _mm256_and_pd(large, _mm256_set1_pd(1.0)));
+    __m256d t = _mm256_div_pd(_mm256_sub_pd(mantissa, _mm256_set1_pd(1.0)), _mm256_add_pd(mantissa, _mm256_set1_pd(1.0)));
+    __m256d t2 = _mm256_mul_pd(t, t);
+    __m256d poly = _mm256_set1_pd(1.0 / (2 * ATANH_TERMS - 1));
+    for(int k = ATANH_TERMS - 2; k >= 0; --k)
+        poly = _mm256_add_pd(_mm256_mul_pd(poly, t2), _mm256_set1_pd(1.0 / (2 * k + 1)));
+    __m256d lnMantissa = _mm256_mul_pd(_mm256_mul_pd(poly, t), _mm256_set1_pd(2.0));
+    return _mm256_add_pd(_mm256_mul_pd(exponent, _mm256_set1_pd(M_LN2)), lnMantissa);
+}
+
+/// 每次处理4个点，返回已处理的数量
+MAP_AVX2_TARGET static int mercatorAVX2(const double *lat, const double *lon, QPointF *points, int count, double radius)
+{
+    const __m256d degToRad = _mm256_set1_pd(M_PI / 180.0);
+    const __m256d maxLat = _mm256_set1_pd(MAX_LATITUDE);
+    const __m256d minLat = _mm256_set1_pd(-MAX_LATITUDE);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d r = _mm256_set1_pd(radius);
+    const __m256d negHalfR = _mm256_set1_pd(-0.5 * radius);
+    double *out = reinterpret_cast<double*>(points);
+
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m256d la = _mm256_loadu_pd(lat + i);
+        __m256d lo = _mm256_loadu_pd(lon + i);
+        __m256d invalid = _mm256_cmp_pd(la, la, _CMP_UNORD_Q);
+        la = _mm256_max_pd(minLat, _mm256_min_pd(maxLat, la));
+        __m256d s = sinAVX2(_mm256_mul_pd(la, degToRad));
+        __m256d y = _mm256_mul_pd(logAVX2(_mm256_div_pd(_mm256_add_pd(one, s), _mm256_sub_pd(one, s))), negHalfR);
+        y = _mm256_blendv_pd(y, la, invalid);
+        __m256d x = _mm256_mul_pd(_mm256_mul_pd(lo, degToRad), r);
+        // [x0 y0 x2 y2] [x1 y1 x3 y3] -> [x0 y0 x1 y1] [x2 y2 x3 y3]
+        __m256d low = _mm256_unpacklo_pd(x, y);
+        __m256d high = _mm256_unpackhi_pd(x, y);
+        _mm256_storeu_pd(out + 2*i, _mm256_permute2f128_pd(low, high, 0x20));
+        _mm256_storeu_pd(out + 2*i + 4, _mm256_permute2f128_pd(low, high, 0x31));
+    }
+    return i;
+}
+#endif
+
+void MapProjection::mercator(const double *lat, const double *lon, QPointF *points, int count, double radius)
+{
+    // QPointF is stored as two doubles, the vectorized kernels write it directly
+    static_assert(sizeof(QPointF) == 2 * sizeof(double), "QPointF must be two doubles");
+    int done = 0;
+#if defined(MAP_PROJECTION_AVX2_RUNTIME)
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    if(hasAVX2)
+        done = mercatorAVX2(lat, lon, points, count, radius);
+    else
+        done = mercatorSSE2(lat, lon, points, count, radius);
+#elif defined(MAP_PROJECTION_AVX2)
+    done = mercatorAVX2(lat, lon, points, count, radius);
+#elif defined(MAP_PROJECTION_SSE2)
+    done = mercatorSSE2(lat, lon, points, count, radius);
+#endif
+    mercatorScalar(lat + done, lon + done, points + done, count - done, radius);
+}
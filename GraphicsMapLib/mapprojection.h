@@ -0,0 +1,169 @@
+﻿#ifndef MAPPROJECTION_H
+#define MAPPROJECTION_H
+
+#include <QPointF>
+#include <QtMath>
+#include <QRectF>
+#include <QTransform>
+
+/*!
+ * \brief 投影批量计算
+ * \details 正向Web墨卡托投影 x=R*λ，y=-R*ln(tan(π/4+φ/2))=-R*atanh(sin φ)，
+ * 其中sin和ln使用多项式逼近，以AVX2(4点)或SSE2(2点)双精度向量化计算，剩余的点使用标量计算，
+ * 在Web墨卡托有效纬度范围内与逐点调用qTan/qLn的结果相对误差小于1e-11
+ * \note GCC编译时即使未开启AVX2也会生成AVX2版本，运行时根据CPU选择
+ * \note 该类只负责数值计算，场景坐标的约定(如R的取值)由GraphicsMap决定
+ */
+class MapProjection
+{
+public:
+    /*!
+     * \brief 批量正向Web墨卡托投影
+     * \param lat 纬度数组，单位度
+     * \param lon 经度数组，单位度
+     * \param points 输出的场景坐标数组，y轴向下
+     * \param count 点数量，三个数组均至少需要count个元素
+     * \param radius 投影半径，即场景坐标下赤道周长/2π
+     * \note 无效的经纬度(NaN)输出NaN，纬度会被限制在(-90, 90)的开区间内以免出现无穷大
+     */
+    static void mercator(const double *lat, const double *lon, QPointF *points, int count, double radius);
+    /// Web墨卡托投影的纬度限制，防止在极点处出现无穷大
+    static constexpr double maxLatitude() { return 89.9999; }
+};
+
+/// 场景约定：经度[-180, 180]映射为宽度为Length的场景，地图处于ZoomBase级时场景单位与屏幕像素1:1
+struct MapScene {
+    enum : int {
+        ZoomBase = 10,                      ///< 低于ZoomBase级时场景放大，反之缩小
+        Length   = (1 << ZoomBase) * 256    ///< 场景宽度
+    };
+};
+
+/// Web墨卡托投影(EPSG:3857)，场景为正方形
+struct MapWebMercator {
+    /// 场景高度与宽度之比
+    static constexpr double heightRatio() { return 1.0; }
+    /// 投影半径 R = Length / 2π
+    static constexpr double radius() { return MapScene::Length / 2.0 / M_PI; }
+
+    /// \see https://blog.csdn.net/iispring/article/details/8565177
+    /// \note 纬度与批量计算一样限制在MapProjection::maxLatitude()之内
+    static inline QPointF toScene(double lat, double lon) {
+        double radLon = qDegreesToRadians(lon);
+        // qBound would turn NaN into the limit
+        double radLat = qDegreesToRadians(qIsNaN(lat) ? lat : qBound(-MapProjection::maxLatitude(), lat, MapProjection::maxLatitude()));
+        // NOTO: as for Qt, it's y asscending from up to bottom
+        return {radius() * radLon, -radius() * qLn(qTan(M_PI_4 + radLat/2.0))};
+    }
+    static inline void toCoordinate(const QPointF &point, double &lat, double &lon) {
+        auto radLon = point.x() / radius();
+        auto radLat = 2 * qAtan(qExp(point.y() / radius())) - M_PI_2;
+        lat = qRadiansToDegrees(-radLat);
+        lon = qRadiansToDegrees(radLon);
+    }
+    static inline void toScene(const double *lat, const double *lon, QPointF *points, int count) {
+        MapProjection::mercator(lat, lon, points, count, radius());
+    }
+};
+
+/// 等经纬度投影(EPSG:4326)，场景宽高比为2:1
+struct MapEquirectangular {
+    static constexpr double heightRatio() { return 0.5; }
+    /// 每度经纬度对应的场景长度
+    static constexpr double scale() { return MapScene::Length / 360.0; }
+
+    static inline QPointF toScene(double lat, double lon) {
+        return {lon * scale(), -lat * scale()};
+    }
+    static inline void toCoordinate(const QPointF &point, double &lat, double &lon) {
+        lat = -point.y() / scale();
+        lon = point.x() / scale();
+    }
+    /// 只有乘法，编译器可以自动向量化
+    static inline void toScene(const double *lat, const double *lon, QPointF *points, int count) {
+        for(int i = 0; i < count; ++i)
+            points[i] = QPointF(lon[i] * scale(), -lat[i] * scale());
+    }
+};
+
+/*!
+ * \brief 瓦片划分方式
+ * \tparam TileLen 瓦片像素长度
+ * \tparam MatrixWidth 0级瓦片的列数，EPSG:4326瓦片通常0级为2列1行
+ */
+template<int TileLen, int MatrixWidth>
+struct MapTiling {
+    enum : int { TileLength = TileLen };
+    /// 瓦片层级与地图缩放层级之差，保证整数层级时瓦片像素与屏幕像素1:1
+    static constexpr int zoomOffset() { return log2(TileLen / 256) + log2(MatrixWidth); }
+    /// 指定层级的瓦片列数
+    static inline quint32 columns(int zoom) { return quint32(MatrixWidth) << zoom; }
+    /// 指定层级的瓦片在场景中的边长
+    static inline double sceneTileLength(int zoom) { return double(MapScene::Length) / columns(zoom); }
+
+private:
+    static constexpr int log2(int value) { return value <= 1 ? 0 : 1 + log2(value / 2); }
+};
+
+/*!
+ * \brief 瓦片方案，由投影方式和瓦片划分方式组合而成
+ * \details 瓦片矩阵覆盖整个场景，瓦片编号从左上角开始，x向右递增，y向下递增(XYZ方式)
+ */
+template<class P, class T>
+struct MapTileScheme {
+    typedef P Projection;
+    typedef T Tiling;
+
+    /// 指定层级的瓦片行数
+    static inline quint32 rows(int zoom) { return quint32(Tiling::columns(zoom) * Projection::heightRatio()); }
+    /// 场景范围
+    static inline QRectF sceneRect() {
+        const double height = MapScene::Length * Projection::heightRatio();
+        return QRectF(-MapScene::Length/2.0, -height/2, MapScene::Length, height);
+    }
+    /// 地图缩放层级对应的瓦片层级
+    static inline int tileZoom(float zoom) { return qMax(0, qFloor(zoom + 0.5) - Tiling::zoomOffset()); }
+    /// 场景坐标所在的瓦片编号(可能超出瓦片矩阵)
+    static inline QPointF tileAt(const QPointF &scenePos, int zoom) {
+        return (scenePos - sceneRect().topLeft()) / Tiling::sceneTileLength(zoom);
+    }
+    /// 瓦片图元的变换，将瓦片像素映射到场景
+    static inline QTransform tileTransform(int zoom, quint32 x, quint32 y) {
+        const double length = Tiling::sceneTileLength(zoom);
+        const double scale = length / Tiling::TileLength;
+        const auto origin = sceneRect().topLeft();
+        return QTransform(scale, 0, 0, scale, origin.x() + x * length, origin.y() + y * length);
+    }
+};
+
+/// 内置的瓦片方案
+enum MapScheme {
+    WebMercator256,     ///< Web墨卡托，256像素瓦片，XYZ/TMS瓦片的默认方案
+    WebMercator512,     ///< Web墨卡托，512像素瓦片
+    Geographic256,      ///< 等经纬度，256像素瓦片，0级2x1张
+    Geographic512       ///< 等经纬度，512像素瓦片，0级2x1张
+};
+
+/*!
+ * \brief 将运行时的瓦片方案分发到对应的模板实例
+ * \details 每次调用只分发一次，func内部的计算都是编译期确定的内联代码，例如：
+ * \code
+ * mapSchemeDispatch(scheme, [&](auto s) { return decltype(s)::Projection::toScene(lat, lon); });
+ * \endcode
+ */
+template<class Func>
+inline auto mapSchemeDispatch(MapScheme scheme, Func &&func) -> decltype(func(MapTileScheme<MapWebMercator, MapTiling<256, 1>>()))
+{
+    switch (scheme) {
+    case WebMercator512:
+        return func(MapTileScheme<MapWebMercator, MapTiling<512, 1>>());
+    case Geographic256:
+        return func(MapTileScheme<MapEquirectangular, MapTiling<256, 2>>());
+    case Geographic512:
+        return func(MapTileScheme<MapEquirectangular, MapTiling<512, 2>>());
+    default:
+        return func(MapTileScheme<MapWebMercator, MapTiling<256, 1>>());
+    }
+}
+
+#endif // MAPPROJECTION_H
@@ -0,0 +1,28 @@
+﻿#include "mappropertymenu.h"
+#include <QCoreApplication>
+#include <QCursor>
+#include <QMenu>
+#include <QPointer>
+
+static QMenu   *s_menu = nullptr;      ///< 共用的菜单
+static QAction *s_action = nullptr;    ///< 右键属性
+
+/// 在QApplication析构之前释放菜单
+static void destroyMenu()
+{
+    delete s_menu;
+    s_menu = nullptr;
+    s_action = nullptr;
+}
+
+bool MapPropertyMenu::exec(const QObject *item)
+{
+    if(!s_menu) {
+        s_menu = new QMenu;
+        s_action = s_menu->addAction(u8"右键属性");
+        qAddPostRoutine(destroyMenu);
+    }
+    // the menu runs a nested event loop, the item may be deleted in it
+    QPointer<const QObject> guard(item);
+    return s_menu->exec(QCursor::pos()) == s_action && guard;
+}
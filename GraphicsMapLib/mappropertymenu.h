@@ -0,0 +1,17 @@
+﻿#ifndef MAPPROPERTYMENU_H
+#define MAPPROPERTYMENU_H
+
+#include <QObject>
+
+/*!
+ * \brief 图元共用的右键属性菜单
+ * \details 所有图元共用一个菜单，第一次弹出时创建，图元不再各自创建QMenu和QAction
+ */
+class MapPropertyMenu
+{
+public:
+    /// 在光标处弹出菜单，选择了"右键属性"并且图元在菜单弹出期间没有被删除时返回true
+    static bool exec(const QObject *item);
+};
+
+#endif // MAPPROPERTYMENU_H
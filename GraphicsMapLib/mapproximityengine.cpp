@@ -0,0 +1,468 @@
+﻿#include "mapproximityengine.h"
+#include "mapobjectitem.h"
+#include "mapgeodesic.h"
+#include <QSet>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+
+#define METERS_PER_DEGREE (MapGeodesic::earthRadius() * M_PI / 180)    ///< 每度纬度的长度，米
+#define MIN_CELL_METERS 500.0   ///< 网格的最小边长，米，避免告警距离很小时网格过多
+#define MAX_TRACK_CELLS 256     ///< 对象覆盖的网格超过该值时单独与所有对象比较
+
+/*!
+ * \brief 接近告警检测器
+ * \details 运行在工作线程中，保存对象网格和当前的告警，只由MapProximityEngine调用
+ */
+class MapProximityWorker : public QObject
+{
+public:
+    typedef MapProximityEngine::State       State;
+    typedef MapProximityEngine::TrackUpdate TrackUpdate;
+    typedef MapProximityEngine::RawEvent    RawEvent;
+
+    MapProximityWorker() :
+        m_distance(0),
+        m_lookahead(0),
+        m_cellDegrees(1),
+        m_columns(360)
+    {
+
+    }
+
+    /// 先更新对象的网格，全部登记后再计算，避免同一帧移动的对象互相漏检
+    QVector<RawEvent> process(double distance, double lookahead, const QVector<TrackUpdate> &tracks)
+    {
+        QVector<RawEvent> events;
+        QVector<int> moved;
+        if(distance != m_distance || lookahead != m_lookahead) {
+            // the cell size and the swept ranges depend on both, so all tracks are indexed again
+            m_distance = distance;
+            m_lookahead = lookahead;
+            m_cellDegrees = qMax(distance, MIN_CELL_METERS) / METERS_PER_DEGREE;
+            m_columns = qCeil(360 / m_cellDegrees);
+            m_cells.clear();
+            m_largeTracks.clear();
+            moved.reserve(m_tracks.size() + tracks.size());
+            for(auto iter = m_tracks.begin(); iter != m_tracks.end(); ++iter) {
+                indexTrack(iter.key(), iter.value());
+                moved.append(iter.key());
+            }
+        }
+        for(const auto &update : tracks) {
+            if(update.removed) {
+                removeTrack(update.id, events);
+                continue;
+            }
+            auto iter = m_tracks.find(update.id);
+            if(iter == m_tracks.end())
+                iter = m_tracks.insert(update.id, Track());
+            else
+                unindexTrack(update.id, iter.value());
+            auto &track = iter.value();
+            const double heading = qDegreesToRadians(update.heading);
+            track.latitude = update.latitude;
+            track.longitude = update.longitude;
+            track.vx = update.speed * std::sin(heading);
+            track.vy = update.speed * std::cos(heading);
+            indexTrack(update.id, track);
+            moved.append(update.id);
+        }
+        std::sort(moved.begin(), moved.end());
+        moved.erase(std::unique(moved.begin(), moved.end()), moved.end());
+        //
+        m_evaluated.clear();
+        for(int id : qAsConst(moved)) {
+            evaluate(id, events);
+        }
+        return events;
+    }
+
+    void clear()
+    {
+        m_tracks.clear();
+        m_cells.clear();
+        m_largeTracks.clear();
+        m_states.clear();
+    }
+
+private:
+    struct Track
+    {
+        double latitude = 0;
+        double longitude = 0;
+        double vx = 0;              ///< 向东的速度，米每秒
+        double vy = 0;              ///< 向北的速度，米每秒
+        int    left = 0, right = -1, top = 0, bottom = -1;  ///< 覆盖的网格范围，列号未取模
+        bool   large = false;       ///< 是否单独与所有对象比较
+        QVector<int> partners;      ///< 有告警的对象，从小到大排列
+    };
+
+private:
+    static quint64 cellKey(int x, int y)
+    {
+        return quint64(quint32(x)) << 32 | quint32(y);
+    }
+
+    static quint64 pairKey(int first, int second)
+    {
+        return quint64(quint32(qMin(first, second))) << 32 | quint32(qMax(first, second));
+    }
+
+    static void insertSorted(QVector<int> &list, int id)
+    {
+        auto iter = std::lower_bound(list.begin(), list.end(), id);
+        if(iter == list.end() || *iter != id)
+            list.insert(iter, id);
+    }
+
+    static void removeSorted(QVector<int> &list, int id)
+    {
+        auto iter = std::lower_bound(list.begin(), list.end(), id);
+        if(iter != list.end() && *iter == id)
+            list.erase(iter);
+    }
+
+    int column(int x) const
+    {
+        return ((x % m_columns) + m_columns) % m_columns;
+    }
+
+    /// 登记当前位置到预测时间后位置的范围，两个对象在预测时间内接近到告警距离之内时范围必然相交
+    void indexTrack(int id, Track &track)
+    {
+        const double margin = m_distance / 2 / METERS_PER_DEGREE;
+        const double endLat = track.latitude + track.vy * m_lookahead / METERS_PER_DEGREE;
+        // a meter spans more longitude towards the poles, so the latitude nearest to them is used
+        const double cosLat = std::cos(qDegreesToRadians(qMin(qMax(qAbs(track.latitude), qAbs(endLat)) + margin, 89.0)));
+        const double endLon = track.longitude + track.vx * m_lookahead / METERS_PER_DEGREE / cosLat;
+        track.left = qFloor((qMin(track.longitude, endLon) - margin / cosLat + 180) / m_cellDegrees);
+        track.right = qFloor((qMax(track.longitude, endLon) + margin / cosLat + 180) / m_cellDegrees);
+        track.top = qFloor((qMin(track.latitude, endLat) - margin + 90) / m_cellDegrees);
+        track.bottom = qFloor((qMax(track.latitude, endLat) + margin + 90) / m_cellDegrees);
+        const qint64 columns = qint64(track.right) - track.left + 1;
+        track.large = columns >= m_columns || columns * (qint64(track.bottom) - track.top + 1) > MAX_TRACK_CELLS;
+        if(track.large) {
+            m_largeTracks.append(id);
+            return;
+        }
+        for(int y = track.top; y <= track.bottom; ++y) {
+            for(int x = track.left; x <= track.right; ++x) {
+                m_cells[cellKey(column(x), y)].append(id);
+            }
+        }
+    }
+
+    void unindexTrack(int id, const Track &track)
+    {
+        if(track.large) {
+            m_largeTracks.removeOne(id);
+            return;
+        }
+        for(int y = track.top; y <= track.bottom; ++y) {
+            for(int x = track.left; x <= track.right; ++x) {
+                auto cell = m_cells.find(cellKey(column(x), y));
+                if(cell == m_cells.end())
+                    continue;
+                cell.value().removeOne(id);
+                if(cell.value().isEmpty())
+                    m_cells.erase(cell);
+            }
+        }
+    }
+
+    /// 删除对象及其告警，不产生解除事件
+    /// 删除对象，已有的告警以距离未知的解除事件报告
+    void removeTrack(int id, QVector<RawEvent> &events)
+    {
+        auto iter = m_tracks.find(id);
+        if(iter == m_tracks.end())
+            return;
+        unindexTrack(id, iter.value());
+        for(int partner : qAsConst(iter.value().partners)) {
+            const State previous = m_states.take(pairKey(id, partner));
+            events.append({qMin(id, partner), qMax(id, partner), MapProximityEngine::Clear, previous, qQNaN(), qQNaN(), 0});
+            auto other = m_tracks.find(partner);
+            if(other != m_tracks.end())
+                removeSorted(other.value().partners, id);
+        }
+        m_tracks.erase(iter);
+    }
+
+    /// 与同一网格中的对象、单独比较的对象以及已有告警的对象计算会遇
+    void evaluate(int id, QVector<RawEvent> &events)
+    {
+        auto iter = m_tracks.constFind(id);
+        if(iter == m_tracks.constEnd())
+            return;
+        const auto &track = iter.value();
+        m_candidates.clear();
+        if(track.large) {
+            m_candidates = m_tracks.keys().toVector();
+        }
+        else {
+            for(int y = track.top; y <= track.bottom; ++y) {
+                for(int x = track.left; x <= track.right; ++x) {
+                    auto cell = m_cells.constFind(cellKey(column(x), y));
+                    if(cell != m_cells.constEnd())
+                        m_candidates.append(cell.value());
+                }
+            }
+            m_candidates.append(m_largeTracks);
+        }
+        m_candidates.append(track.partners);
+        std::sort(m_candidates.begin(), m_candidates.end());
+        m_candidates.erase(std::unique(m_candidates.begin(), m_candidates.end()), m_candidates.end());
+        for(int other : qAsConst(m_candidates)) {
+            if(other == id)
+                continue;
+            const auto key = pairKey(id, other);
+            if(m_evaluated.contains(key))
+                continue;
+            m_evaluated.insert(key);
+            evaluatePair(qMin(id, other), qMax(id, other), key, events);
+        }
+    }
+
+    /// 在两者中点的局部平面中按匀速直线运动计算最近会遇点
+    void evaluatePair(int first, int second, quint64 key, QVector<RawEvent> &events)
+    {
+        auto &a = m_tracks[first];
+        auto &b = m_tracks[second];
+        double dLon = b.longitude - a.longitude;
+        if(dLon > 180)
+            dLon -= 360;
+        else if(dLon < -180)
+            dLon += 360;
+        const double px = dLon * METERS_PER_DEGREE * std::cos(qDegreesToRadians((a.latitude + b.latitude) / 2));
+        const double py = (b.latitude - a.latitude) * METERS_PER_DEGREE;
+        const double wx = b.vx - a.vx;
+        const double wy = b.vy - a.vy;
+        const double speed2 = wx * wx + wy * wy;
+        // a receding or relatively static pair is closest now
+        const double time = speed2 > 1e-9 ? qMax(0.0, -(px * wx + py * wy) / speed2) : 0.0;
+        const double range = qSqrt(px * px + py * py);
+        auto distanceAt = [&](double t) {
+            return qSqrt((px + wx * t) * (px + wx * t) + (py + wy * t) * (py + wy * t));
+        };
+        const double cpaDistance = distanceAt(time);
+        State state = MapProximityEngine::Clear;
+        if(range <= m_distance)
+            state = MapProximityEngine::Close;
+        else if(m_lookahead > 0 && distanceAt(qMin(time, m_lookahead)) <= m_distance)
+            state = MapProximityEngine::Approaching;
+        //
+        const State previous = m_states.value(key, MapProximityEngine::Clear);
+        if(state == MapProximityEngine::Clear && previous == MapProximityEngine::Clear)
+            return;
+        if(state == MapProximityEngine::Clear) {
+            m_states.remove(key);
+            removeSorted(a.partners, second);
+            removeSorted(b.partners, first);
+        }
+        else {
+            m_states.insert(key, state);
+            insertSorted(a.partners, second);
+            insertSorted(b.partners, first);
+        }
+        events.append({first, second, state, previous, range, cpaDistance, time});
+    }
+
+private:
+    double  m_distance;     ///< 告警距离，米
+    double  m_lookahead;    ///< 预测时间，秒
+    double  m_cellDegrees;  ///< 网格边长，度
+    int     m_columns;      ///< 一周的网格列数，列号按此取模
+    //
+    QHash<int, Track>               m_tracks;       ///< 对象
+    QHash<quint64, QVector<int>>    m_cells;        ///< 网格到对象的索引
+    QVector<int>                    m_largeTracks;  ///< 覆盖网格过多的对象
+    QHash<quint64, State>           m_states;       ///< 有告警的对象对
+    //
+    QVector<int>    m_candidates;   ///< 计算时的临时列表
+    QSet<quint64>   m_evaluated;    ///< 本帧已计算的对象对
+};
+
+MapProximityEngine::MapProximityEngine(QObject *parent) : QObject(parent),
+    m_nextId(0),
+    m_distance(1000),
+    m_lookahead(60),
+    m_settingsChanged(true),
+    m_worker(new MapProximityWorker),
+    m_frames(m_worker, "ProximityThread")
+{
+    connect(MapObjectItem::notifier(), &MapObjectNotifier::batchUpdated, this, &MapProximityEngine::markTracks);
+    connect(&m_frames, &MapFrameWorker::frame, this, &MapProximityEngine::postFrame);
+    setFrameRate(10);
+}
+
+void MapProximityEngine::addTrack(MapObjectItem *track)
+{
+    if(!track || m_trackIds.contains(track))
+        return;
+    const int id = m_nextId++;
+    m_tracks.insert(id, {track, track});
+    m_trackIds.insert(track, id);
+    auto mark = [this, id]() { markTrack(id); };
+    connect(track, &MapObjectItem::coordinateChanged, this, mark);
+    connect(track, &MapObjectItem::coordinateDragged, this, mark);
+    connect(track, &MapObjectItem::eulerChanged, this, mark);
+    connect(track, &QObject::destroyed, this, [this, id]() { removeTrackId(id); });
+    markTrack(id);
+}
+
+void MapProximityEngine::removeTrack(MapObjectItem *track)
+{
+    auto iter = m_trackIds.constFind(track);
+    if(iter != m_trackIds.constEnd())
+        removeTrackId(iter.value());
+}
+
+void MapProximityEngine::clear()
+{
+    for(const auto &track : qAsConst(m_tracks)) {
+        if(track.item)
+            disconnect(track.item.data(), nullptr, this, nullptr);
+    }
+    m_tracks.clear();
+    m_trackIds.clear();
+    m_warnings.clear();
+    m_dirtyTracks.clear();
+    // results of the frame in process are dropped as the ids are unknown now
+    auto worker = m_worker;
+    m_frames.run([worker]() { worker->clear(); });
+}
+
+void MapProximityEngine::setDistance(double meters)
+{
+    if(m_distance == meters)
+        return;
+    m_distance = meters;
+    m_settingsChanged = true;
+}
+
+double MapProximityEngine::distance() const
+{
+    return m_distance;
+}
+
+void MapProximityEngine::setLookahead(double seconds)
+{
+    if(m_lookahead == seconds)
+        return;
+    m_lookahead = seconds;
+    m_settingsChanged = true;
+}
+
+double MapProximityEngine::lookahead() const
+{
+    return m_lookahead;
+}
+
+void MapProximityEngine::setFrameRate(int fps)
+{
+    m_frames.setFrameRate(fps);
+}
+
+QVector<MapProximityEngine::Event> MapProximityEngine::warnings() const
+{
+    QVector<Event> result;
+    result.reserve(m_warnings.size());
+    for(const auto &event : m_warnings) {
+        result.append(event);
+    }
+    return result;
+}
+
+void MapProximityEngine::removeTrackId(int id)
+{
+    auto iter = m_tracks.find(id);
+    if(iter == m_tracks.end())
+        return;
+    if(iter.value().item)
+        disconnect(iter.value().item.data(), nullptr, this, nullptr);
+    m_trackIds.remove(iter.value().key);
+    m_tracks.erase(iter);
+    m_dirtyTracks.insert(id, {id, true, 0, 0, 0, 0});
+    for(auto warning = m_warnings.begin(); warning != m_warnings.end();) {
+        if(int(warning.key() >> 32) == id || int(quint32(warning.key())) == id)
+            warning = m_warnings.erase(warning);
+        else
+            ++warning;
+    }
+}
+
+/// 只记录位置、速度和航向，检测在下一帧进行
+void MapProximityEngine::markTrack(int id)
+{
+    auto track = m_tracks.value(id).item.data();
+    if(!track)
+        return;
+    const auto &coord = track->mapCoordinate();
+    // an invalid position takes the track out of the grid until it has a valid one again
+    if(!coord.isValid()) {
+        m_dirtyTracks.insert(id, {id, true, 0, 0, 0, 0});
+        return;
+    }
+    const double heading = track->euler().x();
+    const double speed = qIsFinite(track->getSpeed()) && qIsFinite(heading) ? track->getSpeed() : 0;
+    m_dirtyTracks.insert(id, {id, false, coord.latitude, coord.longitude, speed, qIsFinite(heading) ? heading : 0});
+}
+
+void MapProximityEngine::markTracks(const QVector<MapObjectItem *> &items)
+{
+    if(m_trackIds.isEmpty())
+        return;
+    for(auto item : items) {
+        auto iter = m_trackIds.constFind(item);
+        if(iter != m_trackIds.constEnd())
+            markTrack(iter.value());
+    }
+}
+
+void MapProximityEngine::postFrame()
+{
+    // keep accumulating while the worker is busy
+    if(m_frames.isBusy() || (m_dirtyTracks.isEmpty() && !m_settingsChanged))
+        return;
+    QVector<TrackUpdate> tracks;
+    tracks.reserve(m_dirtyTracks.size());
+    for(const auto &update : qAsConst(m_dirtyTracks)) {
+        tracks.append(update);
+    }
+    m_dirtyTracks.clear();
+    m_settingsChanged = false;
+    //
+    auto worker = m_worker;
+    const double distance = m_distance;
+    const double lookahead = m_lookahead;
+    m_frames.post([worker, distance, lookahead, tracks]() { return worker->process(distance, lookahead, tracks); },
+                  [this](const QVector<RawEvent> &events) { onProcessed(events); });
+}
+
+/// 编号转换为图元，忽略已经删除的对象
+void MapProximityEngine::onProcessed(const QVector<RawEvent> &events)
+{
+    QVector<Event> result;
+    result.reserve(events.size());
+    for(const auto &event : events) {
+        auto first = m_tracks.value(event.first).item.data();
+        auto second = m_tracks.value(event.second).item.data();
+        if(!first || !second)
+            continue;
+        const Event item{first, second, event.state, event.previous, event.range, event.cpaDistance, event.cpaTime};
+        if(event.state == Clear)
+            m_warnings.remove(pairKey(event.first, event.second));
+        else
+            m_warnings.insert(pairKey(event.first, event.second), item);
+        result.append(item);
+    }
+    if(!result.isEmpty())
+        emit triggered(result);
+}
+
+/// 小编号在高位
+quint64 MapProximityEngine::pairKey(int first, int second)
+{
+    return quint64(quint32(qMin(first, second))) << 32 | quint32(qMax(first, second));
+}
@@ -0,0 +1,122 @@
+﻿#ifndef MAPPROXIMITYENGINE_H
+#define MAPPROXIMITYENGINE_H
+
+#include "mapframeworker.h"
+#include <QObject>
+#include <QHash>
+#include <QPointer>
+#include <QVector>
+
+class MapObjectItem;
+class MapProximityWorker;
+
+/*!
+ * \brief 接近告警引擎
+ * \details 监视大量地图对象两两之间的距离和最近会遇点(CPA/TCPA)，检测在工作线程中完成：
+ * 1.对象按当前位置到预测时间后位置的范围，外扩告警距离的一半，登记到经纬度均匀网格中，只有位于同一网格的两个对象才计算会遇，
+ * 覆盖网格过多的对象单独与所有对象比较；
+ * 2.对象的coordinateChanged、eulerChanged和MapObjectItem::applyBatch的批量通知只记录新的位置、速度和航向，
+ * 每帧把变化的对象一次性交给工作线程，只重新登记和计算这些对象，工作线程繁忙时继续累积；
+ * 3.会遇按局部平面匀速直线运动计算，航向取欧拉角的x分量，速度取getSpeed，单位米每秒；
+ * 4.每帧计算过的告警对和解除告警的对象对通过triggered信号在主线程发出
+ * \note 单独调用setSpeed不会触发重新计算
+ * \note 对象被删除时不产生解除事件；对象位置变为无效时退出检测，已有的告警以距离为NaN的解除事件报告
+ */
+class MapProximityEngine : public QObject
+{
+    Q_OBJECT
+public:
+    /// 告警状态
+    enum State {
+        Clear,          ///< 无告警
+        Approaching,    ///< 预测时间内将接近到告警距离之内
+        Close           ///< 当前已在告警距离之内
+    };
+    /// 对象对的告警事件
+    struct Event
+    {
+        MapObjectItem *first;
+        MapObjectItem *second;
+        State          state;       ///< 当前状态，Clear表示告警解除
+        State          previous;    ///< 上次的状态
+        double         range;       ///< 当前距离，米
+        double         cpaDistance; ///< 最近会遇距离，米
+        double         cpaTime;     ///< 到达最近会遇点的时间，秒，正在远离时为0
+    };
+
+    explicit MapProximityEngine(QObject *parent = nullptr);
+    /// 添加对象，位置和航向改变时自动更新
+    void addTrack(MapObjectItem *track);
+    /// 删除对象
+    void removeTrack(MapObjectItem *track);
+    /// 删除所有对象
+    void clear();
+    /// 设置告警距离，单位米，默认1000
+    void setDistance(double meters);
+    double distance() const;
+    /// 设置预测时间，单位秒，默认60，0表示只判断当前距离
+    void setLookahead(double seconds);
+    double lookahead() const;
+    /// 设置检测的帧率，默认10
+    void setFrameRate(int fps);
+    /// 当前所有的告警
+    QVector<Event> warnings() const;
+
+signals:
+    /// 一帧内计算过的告警和解除的告警
+    void triggered(const QVector<MapProximityEngine::Event> &events);
+
+public:
+    /// 发往工作线程的对象状态
+    struct TrackUpdate
+    {
+        int    id;
+        bool   removed;
+        double latitude;
+        double longitude;
+        double speed;       ///< 米每秒
+        double heading;     ///< 度，正北顺时针
+    };
+    /// 工作线程产生的事件
+    struct RawEvent
+    {
+        int    first;
+        int    second;
+        State  state;
+        State  previous;
+        double range;
+        double cpaDistance;
+        double cpaTime;
+    };
+
+private:
+    void removeTrackId(int id);
+    void markTrack(int id);
+    void markTracks(const QVector<MapObjectItem*> &items);
+    void postFrame();
+    void onProcessed(const QVector<RawEvent> &events);
+    static quint64 pairKey(int first, int second);
+
+private:
+    struct Track
+    {
+        MapObjectItem          *key;    ///< m_trackIds的键，对象析构后仍可用于删除
+        QPointer<MapObjectItem> item;
+    };
+
+private:
+    QHash<int, Track>           m_tracks;       ///< 对象编号到对象
+    QHash<MapObjectItem*, int>  m_trackIds;     ///< 对象到编号
+    int                         m_nextId;       ///< 下一个编号，编号不复用
+    QHash<quint64, Event>       m_warnings;     ///< 当前的告警，以两个对象的编号为键
+    //
+    double                      m_distance;
+    double                      m_lookahead;
+    bool                        m_settingsChanged;  ///< 告警距离或预测时间是否改变
+    QHash<int, TrackUpdate>     m_dirtyTracks;      ///< 本帧改变的对象
+    //
+    MapProximityWorker *m_worker;       ///< 工作线程中的检测器，由m_frames删除
+    MapFrameWorker      m_frames;       ///< 工作线程和帧定时器
+};
+
+#endif // MAPPROXIMITYENGINE_H
@@ -1,19 +1,48 @@
 ﻿#include "maprangeringitem.h"
 #include "graphicsmap.h"
 #include "mapobjectitem.h"
+#include "mapgeodesic.h"
 #include <QStyleOptionGraphicsItem>
 #include <QPainter>
 #include <QTimer>
 #include <QDebug>
 #include <QtMath>
+#include <QVarLengthArray>
 
 void qt_graphicsItem_highlightSelected(QGraphicsItem *item, QPainter *painter, const QStyleOptionGraphicsItem *option);
 
+#define LATITUDE_BUCKET 0.1      ///< 几何缓存的纬度区间，区间内椭圆形状的误差小于0.3%(纬度60度)
+
 QSet<MapRangeRingItem*> MapRangeRingItem::m_items;
 
+/// 批量计算多个距离圈在场景中的椭圆半径(x为东向，y为北向) \param radius 半径数组，单位千米
+static void ellipseRadii(const MapCoordinate &coord, const QPointF &center, const float *radius, QPointF *result, int count)
+{
+    // the top and right points of each ring are computed in one batch
+    QVarLengthArray<double, 8> distances(count * 2);
+    QVarLengthArray<double, 8> azimuths(count * 2);
+    for(int i = 0; i < count; ++i) {
+        distances[i*2] = distances[i*2+1] = radius[i] * 1e3;
+        azimuths[i*2] = 0;
+        azimuths[i*2+1] = 90;
+    }
+    QVarLengthArray<MapCoordinate, 8> coords(count * 2);
+    MapGeodesic::destinations(coord, distances.constData(), azimuths.constData(), coords.data(), count * 2);
+    for(int i = 0; i < count; ++i) {
+        auto top = GraphicsMap::toScene(coords[i*2]);
+        auto right = GraphicsMap::toScene(coords[i*2+1]);
+        result[i] = QPointF(right.rx() - center.rx(), center.ry() - top.ry());
+    }
+}
+
 MapRangeRingItem::MapRangeRingItem() :
     m_cross(true),
+    m_radius(0),
     m_rotation(0),
+    m_screenRadius(0),
+    m_zoom(MapScene::ZoomBase),
+    m_geometryValid(false),
+    m_latitudeBucket(0),
     m_attachObj(nullptr)
 {
     m_pen.setWidth(2);
@@ -42,8 +71,10 @@ void MapRangeRingItem::setCoordinate(const QGeoCoordinate &coord)
     if(m_coord == coord)
         return;
     m_coord = coord;
-    updateBoundingRect();
     setPos(GraphicsMap::toScene(m_coord));
+    if(m_screenRadius > 0)
+        updateScreenRadius();
+    updateGeometry();
 }
 
 void MapRangeRingItem::setRotation(const qreal &degree)
@@ -60,9 +91,29 @@ void MapRangeRingItem::setRadius(const float &km)
     if(m_radius == km)
         return;
     m_radius = km;
-    updateBoundingRect();
     // 30km respond to 10 point size for font
     m_font.setPointSizeF(km / 30 * 10);
+    m_geometryValid = false;
+    updateGeometry();
+}
+
+float MapRangeRingItem::radius() const
+{
+    return m_radius;
+}
+
+void MapRangeRingItem::setScreenRadius(int pixel)
+{
+    if(m_screenRadius == pixel)
+        return;
+    m_screenRadius = pixel;
+    if(m_screenRadius > 0)
+        updateScreenRadius();
+}
+
+int MapRangeRingItem::screenRadius() const
+{
+    return m_screenRadius;
 }
 
 void MapRangeRingItem::attach(MapObjectItem *obj)
@@ -103,7 +154,8 @@ void MapRangeRingItem::setFont(const QFont &font)
     if(m_font == font)
         return;
     m_font = font;
-    update();
+    m_geometryValid = false;
+    updateGeometry();
 }
 
 QPen MapRangeRingItem::pen() const
@@ -130,48 +182,89 @@ void MapRangeRingItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *
 {
     Q_UNUSED(widget)
 
-    // radius of ellpise
-    auto ellpiseRadius = [&](const float &radius) {
-        auto topCoord = m_coord.atDistanceAndAzimuth(radius * 1e3, 0);
-        auto rightCoord = m_coord.atDistanceAndAzimuth(radius * 1e3, 90);
-        auto top = GraphicsMap::toScene(topCoord);
-        auto right = GraphicsMap::toScene(rightCoord);
-        auto center = this->pos();
-        auto rx = right.rx() - center.rx();
-        auto ry = center.ry() - top.ry();
-        return QPointF(rx, ry);
-    };
-    //
+    /*--------------- fixed ratation ----------------*/
+    // 1.draw ellipse and dial with azimuth, both are cached
     painter->setPen(m_pen);
-    painter->setFont(m_font);
     painter->setBrush(Qt::NoBrush);
-    auto radius0 = ellpiseRadius(m_radius / 3);
-    auto radius1 = ellpiseRadius(m_radius / 3 * 2);
-    auto radius2 = ellpiseRadius(m_radius);
-    /*--------------- fixed ratation ----------------*/
-    // 1.draw ellipse
-    painter->drawEllipse({0, 0}, radius0.rx(), radius0.ry());
-    painter->drawEllipse({0, 0}, radius1.rx(), radius1.ry());
-    painter->drawEllipse({0, 0}, radius2.rx(), radius2.ry());
+    painter->drawPath(m_dialPath);
+    painter->fillPath(m_dialTextPath, m_pen.color());
 
-    // 2.draw dial with azimuth
+    /*--------------- mutable ratation ----------------*/
+    // 2.draw cross shape with a ligter color
+    // Painter Begin
     painter->save();
+    painter->rotate(m_rotation);
+    if(m_cross) {
+        const auto &radius2 = m_radii[2];
+        auto pen = painter->pen();
+        pen.setColor(pen.color().lighter());
+        pen.setStyle(Qt::DashLine);
+        painter->setPen(pen);
+        painter->drawLine(QLineF(-radius2.rx(), 0, radius2.rx(), 0));
+        painter->drawLine(QLineF(0 ,-radius2.ry(), 0, radius2.ry()));
+    }
+    // 3.draw distance text
+    painter->fillPath(m_distanceTextPath, m_pen.color().lighter(130));
+    // Painter End
+    painter->restore();
+
+    // copied from qt source (maybe not work for current)
+    if (option->state & QStyle::State_Selected)
+        qt_graphicsItem_highlightSelected(this, painter, option);
+}
+
+QVariant MapRangeRingItem::itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value)
+{
+    if(change != ItemSceneHasChanged)
+        return QGraphicsItem::itemChange(change, value);
+
+    disconnect(m_zoomConnection);
+    disconnect(m_schemeConnection);
+    if(auto map = GraphicsMap::fromScene(scene())) {
+        m_zoomConnection = connect(map, &GraphicsMap::zoomChanged, this, &MapRangeRingItem::updateZoom);
+        m_schemeConnection = connect(map, &GraphicsMap::schemeRequested, this, &MapRangeRingItem::updateScheme);
+        updateZoom(map->zoomLevel());
+    }
+    return QGraphicsItem::itemChange(change, value);
+}
+
+void MapRangeRingItem::updateBoundingRect()
+{
+    prepareGeometryChange();
+    qreal halfpw = m_pen.style() == Qt::NoPen ? qreal(0) : m_pen.widthF() / 2;
+    auto rx = m_radii[2].rx();
+    auto ry = m_radii[2].ry();
+    m_boundRect = QRectF(-rx, -ry, rx * 2, ry * 2).united(m_dialTextPath.controlPointRect());
+    m_boundRect.adjust(-halfpw, -halfpw, halfpw, halfpw);
+}
+
+/// 重新生成椭圆、刻度和文字的路径，同一纬度区间内椭圆形状不变
+void MapRangeRingItem::updateGeometry()
+{
+    const int bucket = qRound(m_coord.latitude() / LATITUDE_BUCKET);
+    if(m_geometryValid && m_latitudeBucket == bucket)
+        return;
+    m_geometryValid = true;
+    m_latitudeBucket = bucket;
+    // the shape only depends on the latitude
+    const MapCoordinate center(bucket * LATITUDE_BUCKET, 0);
+    const float rings[3] = {m_radius / 3, m_radius / 3 * 2, m_radius};
+    ellipseRadii(center, GraphicsMap::toScene(center), rings, m_radii, 3);
+    const auto &radius0 = m_radii[0];
+    const auto &radius1 = m_radii[1];
+    const auto &radius2 = m_radii[2];
+    // 1.ellipse
+    m_dialPath = QPainterPath();
+    for(const auto &radius : m_radii) {
+        m_dialPath.addEllipse({0, 0}, radius.x(), radius.y());
+    }
+    // 2.dial with azimuth
+    m_dialTextPath = QPainterPath();
     QFontMetricsF fontMetrix(m_font);
-    auto textRect = fontMetrix.boundingRect("N");
     for(int i = 0; i < 12; ++i) {
         int az = i * 30;
         QString number;
         switch (az) {
-        case 30:
-        case 60:
-        case 120:
-        case 150:
-        case 210:
-        case 240:
-        case 300:
-        case 330:
-            number = QString::number(az);
-            break;
         case 0:
             number = "N";
             break;
@@ -184,66 +277,68 @@ void MapRangeRingItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *
         case 270:
             number = "W";
             break;
+        default:
+            number = QString::number(az);
+            break;
         }
-        textRect = fontMetrix.boundingRect(number);
-        painter->drawLine(0.0, -radius2.ry(), 0.0, -radius2.ry()*0.98);
-        painter->drawText(-textRect.width()/2, -radius2.y() + textRect.height(), number);
-        painter->rotate(30);
+        QTransform transform;
+        transform.rotate(az);
+        QPainterPath tick;
+        tick.moveTo(0.0, -radius2.ry());
+        tick.lineTo(0.0, -radius2.ry()*0.98);
+        m_dialPath.addPath(transform.map(tick));
+        auto textRect = fontMetrix.boundingRect(number);
+        QPainterPath text;
+        text.addText(-textRect.width()/2, -radius2.y() + textRect.height(), m_font, number);
+        m_dialTextPath.addPath(transform.map(text));
     }
-    painter->restore();
+    // 3.distance text, rotated with the item in paint
+    QPainterPath distanceText;
+    auto addDistance = [&](float km, qreal y) {
+        auto text = QString::number(km)+"Km";
+        auto textRect = fontMetrix.boundingRect(text);
+        distanceText.addText(-textRect.width()/2, -y, m_font, text);
+    };
+    addDistance(m_radius/3, radius0.y());
+    addDistance(m_radius/3*2, radius1.y());
+    addDistance(m_radius, radius2.y());
+    QTransform transform;
+    transform.rotate(45);
+    m_distanceTextPath = transform.map(distanceText);
+    //
+    updateBoundingRect();
+    update();
+}
 
-    /*--------------- mutable ratation ----------------*/
-    // 3.draw cross shape with a ligter color
-    // Painter Begin
-    painter->save();
-    painter->rotate(m_rotation);
-    if(m_cross) {
-        painter->save();
-        auto pen = painter->pen();
-        pen.setColor(pen.color().lighter());
-        pen.setStyle(Qt::DashLine);
-        painter->setPen(pen);
-        painter->drawLine(-radius2.rx(), 0, radius2.rx(), 0);
-        painter->drawLine(0 ,-radius2.ry(), 0, radius2.ry());
-        painter->restore();
-    }
-    auto pen = painter->pen();
-    pen.setColor(pen.color().lighter(130));
-    painter->setPen(pen);
-
-    // 4.draw distance text
-    painter->rotate(45);
-    auto km = QString::number(m_radius/3)+"Km";
-    textRect = fontMetrix.boundingRect(km);
-    painter->drawText(-textRect.width()/2, -radius0.y(), km);
-    km = QString::number(m_radius/3*2)+"Km";
-    textRect = fontMetrix.boundingRect(km);
-    painter->drawText(-textRect.width()/2, -radius1.y(), km);
-    km = QString::number(m_radius)+"Km";
-    textRect = fontMetrix.boundingRect(km);
-    painter->drawText(-textRect.width()/2, -radius2.y(), km);
-    painter->rotate(-45);
-    // Painter End
-    painter->restore();
+/// 根据缩放层级和所在纬度计算半径，使外环在屏幕上保持m_screenRadius像素
+void MapRangeRingItem::updateScreenRadius()
+{
+    // measure in the same latitude bucket as the cached shape
+    const MapCoordinate center(qRound(m_coord.latitude() / LATITUDE_BUCKET) * LATITUDE_BUCKET, 0);
+    auto east = MapGeodesic::destination(center, 1e3, 90);
+    auto scenePerKm = GraphicsMap::toScene(east).x() - GraphicsMap::toScene(center).x();
+    if(scenePerKm <= 0)
+        return;
+    auto scenePerPixel = qPow(2, MapScene::ZoomBase - m_zoom);
+    auto km = m_screenRadius * scenePerPixel / scenePerKm;
+    setRadius(QString::number(km, 'g', 3).toFloat());
+}
 
-    // copied from qt source (maybe not work for current)
-    if (option->state & QStyle::State_Selected)
-        qt_graphicsItem_highlightSelected(this, painter, option);
+/// 瓦片方案改变后场景位置和缓存的椭圆都需要重新计算
+void MapRangeRingItem::updateScheme()
+{
+    setPos(GraphicsMap::toScene(m_coord));
+    m_geometryValid = false;
+    if(m_screenRadius > 0)
+        updateScreenRadius();
+    updateGeometry();
 }
 
-void MapRangeRingItem::updateBoundingRect()
+void MapRangeRingItem::updateZoom(const float &zoom)
 {
-    prepareGeometryChange();
-    qreal halfpw = m_pen.style() == Qt::NoPen ? qreal(0) : m_pen.widthF() / 2;
-    auto topCoord = m_coord.atDistanceAndAzimuth(m_radius * 1e3, 0);
-    auto rightCoord = m_coord.atDistanceAndAzimuth(m_radius * 1e3, 90);
-    auto top = GraphicsMap::toScene(topCoord);
-    auto right = GraphicsMap::toScene(rightCoord);
-    auto center = this->pos();
-    auto rx = right.rx() - center.rx();
-    auto ry = center.ry() - top.ry();
-    m_boundRect.adjust(-rx, -ry, rx, ry);
-    m_boundRect.adjust(-halfpw, -halfpw, halfpw, halfpw);
+    m_zoom = zoom;
+    if(m_screenRadius > 0)
+        updateScreenRadius();
 }
 
 void qt_graphicsItem_highlightSelected(QGraphicsItem *item, QPainter *painter, const QStyleOptionGraphicsItem *option)
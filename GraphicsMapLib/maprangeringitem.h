@@ -6,14 +6,15 @@
 #include <QGraphicsItem>
 #include <QPen>
 #include <QFont>
+#include <QPainterPath>
 
 class MapObjectItem;
 
 /*!
  * \brief 距离环
- * \details 显示三个地理等距椭圆环，如果需要实现屏幕恒等大小的效果，需要外部手动调用setRadius接口来实现
+ * \details 显示三个地理等距椭圆环，通过setScreenRadius可以开启屏幕恒等大小模式，随地图缩放自动调整半径
  * 该图形通常显示为椭圆，仅在水平方向和垂直方向的距离较为准确，其他角度通常都有误差，在低纬度上误差较小对结果影响不大
- * \warning 该元素对渲染效率影响较大，会占用过多CPU，暂未找到好的解决方案
+ * \note 椭圆、刻度和文字预先生成路径缓存，仅在半径、字体或者纬度区间(0.1度)改变时重新生成，绘制时不再计算和排版
  */
 class MapRangeRingItem : public QObject, public QGraphicsItem
 {
@@ -27,8 +28,16 @@ public:
     void setCoordinate(const QGeoCoordinate &coord);
     ///  覆盖基类的同名函数，提供信号槽机制
     void setRotation(const qreal &degree);
-    /// 设置半径
+    /// 设置半径，单位千米，开启屏幕恒等大小模式时由地图缩放自动设置
     void setRadius(const float &km);
+    float radius() const;
+    /*!
+     * \brief 设置屏幕恒等大小模式
+     * \param pixel 外环在屏幕上的半径，单位像素，0表示关闭
+     * \note 半径取3位有效数字，使刻度文字保持简洁
+     */
+    void setScreenRadius(int pixel);
+    int screenRadius() const;
     /// 依附到地图对象，将会自动更新位置
     void attach(MapObjectItem *obj);
     /// 取消依附地图对象，后续手动更新位置
@@ -50,8 +59,15 @@ public:
     virtual QRectF boundingRect() const override;
     virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
 
+protected:
+    virtual QVariant itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value) override;
+
 private:
     void updateBoundingRect();
+    void updateGeometry();
+    void updateScreenRadius();
+    void updateZoom(const float &zoom);
+    void updateScheme();
 
 private:
     static QSet<MapRangeRingItem*> m_items;         ///< 所有实例
@@ -66,6 +82,18 @@ private:
     //
     QRectF m_boundRect;
     //
+    int          m_screenRadius;        ///< 屏幕恒等大小模式下外环的像素半径
+    float        m_zoom;                ///< 所在地图的缩放层级
+    QMetaObject::Connection m_zoomConnection;   ///< 与所在地图缩放信号的连接
+    QMetaObject::Connection m_schemeConnection; ///< 与所在地图瓦片方案信号的连接
+    //
+    bool         m_geometryValid;       ///< 缓存是否有效
+    int          m_latitudeBucket;      ///< 缓存对应的纬度区间
+    QPointF      m_radii[3];            ///< 三个环的椭圆半径(场景坐标)
+    QPainterPath m_dialPath;            ///< 椭圆和方位刻度
+    QPainterPath m_dialTextPath;        ///< 方位文字
+    QPainterPath m_distanceTextPath;    ///< 距离文字，随朝向旋转
+    //
     MapObjectItem *m_attachObj;
 };
 
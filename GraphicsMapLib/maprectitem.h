@@ -49,7 +49,9 @@ protected:
 
 private:
     void updateRect();
+    void updateIndex();
     void updateEditable();
+    void createCtrls();
 
 private:
     static QSet<MapRectItem*> m_items;         ///< 所有实例
@@ -63,9 +65,9 @@ private:
     QGeoCoordinate m_topLeftCoord;        ///< 左上经纬度
     QGeoCoordinate m_bottomRightCoord;    ///< 右下经纬度
     //
-    QGraphicsRectItem    m_rectCtrl;       ///< 矩形
-    QGraphicsEllipseItem m_firstCtrl;      ///< 对角控制点1
-    QGraphicsEllipseItem m_secondCtrl;     ///< 对角控制点2
+    QGraphicsRectItem    *m_rectCtrl;       ///< 矩形，第一次编辑时创建
+    QGraphicsEllipseItem *m_firstCtrl;      ///< 对角控制点1，第一次编辑时创建
+    QGraphicsEllipseItem *m_secondCtrl;     ///< 对角控制点2，第一次编辑时创建
 };
 
 #endif // MAPRECTITEM_H
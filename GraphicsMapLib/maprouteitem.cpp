@@ -1,5 +1,6 @@
 ﻿#include "maprouteitem.h"
 #include "graphicsmap.h"
+#include "mapspatialindex.h"
 #include "mapobjectitem.h"
 
 QSet<MapRouteItem*> MapRouteItem::m_items;
@@ -7,7 +8,9 @@ QSet<MapRouteItem*> MapRouteItem::m_items;
 MapRouteItem::MapRouteItem() :
     m_moveable(false),
     m_checkable(false),
-    m_exclusive(true)
+    m_exclusive(true),
+    m_geodesic(true),
+    m_zoom(MapScene::ZoomBase)
 {
     //
     m_normalPen = this->pen();
@@ -26,6 +29,7 @@ MapRouteItem::MapRouteItem() :
 MapRouteItem::~MapRouteItem()
 {
     m_items.remove(this);
+    MapSpatialIndex::instance()->remove(this);
 }
 
 void MapRouteItem::setMoveable(bool movable)
@@ -93,6 +97,19 @@ void MapRouteItem::setExclusive(bool exclusive)
     }
 }
 
+void MapRouteItem::setGeodesic(bool on)
+{
+    if(m_geodesic == on)
+        return;
+    m_geodesic = on;
+    updatePolyline();
+}
+
+bool MapRouteItem::isGeodesic() const
+{
+    return m_geodesic;
+}
+
 MapObjectItem* MapRouteItem::append(MapObjectItem *point)
 {
     bindPoint(point);
@@ -169,6 +186,21 @@ void MapRouteItem::remove(MapObjectItem *point)
     remove(index);
 }
 
+MapObjectItem *MapRouteItem::take(MapObjectItem *point)
+{
+    auto index = m_points.indexOf(point);
+    if(index < 0)
+        return nullptr;
+
+    m_points.removeAt(index);
+    point->disconnect(this);
+    point->setParentItem(nullptr);
+    updatePolyline();
+    //
+    emit removed(index);
+    return point;
+}
+
 const QVector<MapObjectItem*> &MapRouteItem::setPoints(const QVector<MapObjectItem *> &points)
 {
     if(points == m_points)
@@ -230,11 +262,23 @@ void MapRouteItem::updatePolyline()
     // update path
     if(m_points.isEmpty()) {
         setPath(QPainterPath());
+        MapSpatialIndex::instance()->remove(this);
         return;
     }
-    QPainterPath path(GraphicsMap::toScene(m_points.first()->coordinate()));
-    for(int i = 1; i < m_points.size(); ++i) {
-        path.lineTo(GraphicsMap::toScene(m_points.at(i)->coordinate()));
+    QVector<MapCoordinate> coords;
+    coords.reserve(m_points.size());
+    for(auto point : qAsConst(m_points)) {
+        coords.append(point->mapCoordinate());
+    }
+    MapSpatialIndex::instance()->update(this, MapSpatialIndex::boundingRect(coords));
+    QPainterPath path;
+    if(m_geodesic) {
+        m_geodesicPath.setPoints(coords);
+        path = m_geodesicPath.path(m_zoom);
+    }
+    else {
+        m_geodesicPath.setPoints({});
+        path.addPolygon(GraphicsMap::toScene(coords));
     }
 
     for(int nIndex = 0; nIndex < m_points.size(); ++nIndex) {
@@ -243,6 +287,31 @@ void MapRouteItem::updatePolyline()
     setPath(path);
 }
 
+/// 缩放层级改变时从缓存中取出对应层级的大圆路径
+void MapRouteItem::updateZoom(const float &zoom)
+{
+    // the path only changes between buckets, not on every frame of a smooth zoom
+    const bool same = MapGeodesicPath::bucket(zoom) == MapGeodesicPath::bucket(m_zoom);
+    m_zoom = zoom;
+    if(same)
+        return;
+    if(m_geodesic && !m_points.isEmpty())
+        setPath(m_geodesicPath.path(m_zoom));
+}
+
+QVariant MapRouteItem::itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value)
+{
+    if(change != ItemSceneHasChanged)
+        return QGraphicsPathItem::itemChange(change, value);
+
+    disconnect(m_zoomConnection);
+    if(auto map = GraphicsMap::fromScene(scene())) {
+        m_zoomConnection = connect(map, &GraphicsMap::zoomChanged, this, &MapRouteItem::updateZoom);
+        updateZoom(map->zoomLevel());
+    }
+    return QGraphicsPathItem::itemChange(change, value);
+}
+
 void MapRouteItem::updatePointMoved()
 {
     auto ctrlItem = dynamic_cast<MapObjectItem*>(sender());
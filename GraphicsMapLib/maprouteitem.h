@@ -4,6 +4,7 @@
 #include <QGraphicsPathItem>
 #include <QGeoCoordinate>
 #include <QPen>
+#include "mapgeodesicpath.h"
 
 class MapObjectItem;
 
@@ -32,6 +33,9 @@ public:
     void toggle(MapObjectItem *point);
     /// 设置航点选中互斥性
     void setExclusive(bool exclusive);
+    /// 设置航段沿大圆绘制(默认开启)，关闭后航段为场景中的直线
+    void setGeodesic(bool on);
+    bool isGeodesic() const;
     /// 设置编辑状态和非编辑状态下两种画笔
     void setPen(bool editable, const QPen &pen);
     /// 获取画笔
@@ -48,6 +52,8 @@ public:
     /// 删除航点
     void remove(int index);
     void remove(MapObjectItem *point);
+    /// 取出航点但不删除，航点的生命周期交还调用者，不是航点时返回nullptr
+    MapObjectItem *take(MapObjectItem *point);
     /// 设置航点
     const QVector<MapObjectItem*> &setPoints(const QVector<MapObjectItem*> &points);
     /// 获取航点列表
@@ -69,11 +75,15 @@ signals:
     void updated(const int &index, const MapObjectItem *point);
     void changed();
 
+protected:
+    virtual QVariant itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value) override;
+
 private:
     static QSet<MapRouteItem*> m_items;         ///< 所有实例
 
 private:
     void updatePolyline();
+    void updateZoom(const float &zoom);
     void updatePointMoved();
     void updatePointPressed();
     void updatePointReleased();
@@ -88,6 +98,11 @@ private:
     //
     QVector<MapObjectItem*> m_points;               ///< 航点元素
     bool                    m_lastPointIsChecked;   ///< 上次触发按钮的选中状态
+    //
+    bool                    m_geodesic;             ///< 沿大圆绘制
+    MapGeodesicPath         m_geodesicPath;         ///< 大圆路径及各层级缓存
+    float                   m_zoom;                 ///< 所在地图的缩放层级
+    QMetaObject::Connection m_zoomConnection;       ///< 与所在地图缩放信号的连接
 };
 
 #endif // MAPROUTEITEM_H
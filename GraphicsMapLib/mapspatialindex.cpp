@@ -0,0 +1,398 @@
+﻿#include "mapspatialindex.h"
+#include "mapgeodesic.h"
+#include <QPolygonF>
+#include <QSet>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+
+#define LEVEL_COUNT 4               ///< 网格层数
+#define NEAREST_RADIUS 25e3         ///< 最近邻查询的初始半径，单位米，每次扩大4倍
+#define POLYGON_EPSILON 1e-9        ///< 退化外接矩形(线段)与多边形求交时的扩展量，单位度
+
+/// 每层网格的边长，单位度，最后一层覆盖全球
+static const double LEVEL_SIZES[LEVEL_COUNT] = {0.25, 2, 16, 360};
+
+/// 闭区间相交，宽度或高度为0的矩形(点状图元)也能正确判断
+static bool overlaps(const QRectF &a, const QRectF &b)
+{
+    return a.left() <= b.right() && a.right() >= b.left() && a.top() <= b.bottom() && a.bottom() >= b.top();
+}
+
+static bool isFinite(const QRectF &rect)
+{
+    return qIsFinite(rect.x()) && qIsFinite(rect.y()) && qIsFinite(rect.width()) && qIsFinite(rect.height());
+}
+
+/// 以经度为x、纬度为y的范围，跨越180度经线时拆分为两个
+static QVector<QRectF> longitudeSplit(double left, double right, double bottom, double top)
+{
+    if(right - left >= 360)
+        return {QRectF(QPointF(-180, bottom), QPointF(180, top))};
+    if(left < -180)
+        return {QRectF(QPointF(left + 360, bottom), QPointF(180, top)), QRectF(QPointF(-180, bottom), QPointF(right, top))};
+    if(right > 180)
+        return {QRectF(QPointF(left, bottom), QPointF(180, top)), QRectF(QPointF(-180, bottom), QPointF(right - 360, top))};
+    return {QRectF(QPointF(left, bottom), QPointF(right, top))};
+}
+
+MapSpatialIndex::MapSpatialIndex() :
+    m_levelCells(LEVEL_COUNT, 0),
+    m_levelItems(LEVEL_COUNT, 0),
+    m_disabled(0)
+{
+
+}
+
+MapSpatialIndex *MapSpatialIndex::instance()
+{
+    static MapSpatialIndex index;
+    return &index;
+}
+
+void MapSpatialIndex::update(QGraphicsItem *item, const MapCoordinate &coord)
+{
+    if(!coord.isValid()) {
+        remove(item);
+        return;
+    }
+    update(item, QRectF(coord.longitude, coord.latitude, 0, 0));
+}
+
+void MapSpatialIndex::update(QGraphicsItem *item, const QRectF &bounds)
+{
+    if(!isFinite(bounds)) {
+        remove(item);
+        return;
+    }
+    Entry entry;
+    entry.bounds = bounds;
+    entry.level = levelOf(bounds);
+    entry.cells = cellRange(entry.level, bounds);
+    entry.enabled = true;
+    auto iter = m_entries.find(item);
+    if(iter != m_entries.end()) {
+        auto &old = iter.value();
+        // updating a paused item resumes it
+        if(!old.enabled) {
+            old.enabled = true;
+            --m_disabled;
+        }
+        // moved inside the same cells, which is the common case of a moving object
+        if(old.level == entry.level && old.cells.left == entry.cells.left && old.cells.top == entry.cells.top
+                && old.cells.right == entry.cells.right && old.cells.bottom == entry.cells.bottom) {
+            old.bounds = bounds;
+            return;
+        }
+        removeCells(item, old);
+        old = entry;
+    }
+    else {
+        m_entries.insert(item, entry);
+    }
+    insertCells(item, entry);
+}
+
+void MapSpatialIndex::remove(QGraphicsItem *item)
+{
+    auto iter = m_entries.find(item);
+    if(iter == m_entries.end())
+        return;
+    removeCells(item, iter.value());
+    if(!iter.value().enabled)
+        --m_disabled;
+    m_entries.erase(iter);
+}
+
+void MapSpatialIndex::setEnabled(QGraphicsItem *item, bool enabled)
+{
+    auto iter = m_entries.find(item);
+    if(iter == m_entries.end() || iter.value().enabled == enabled)
+        return;
+    iter.value().enabled = enabled;
+    m_disabled += enabled ? -1 : 1;
+}
+
+int MapSpatialIndex::count() const
+{
+    return m_entries.size() - m_disabled;
+}
+
+QRectF MapSpatialIndex::bounds(const QGraphicsItem *item) const
+{
+    auto iter = m_entries.constFind(const_cast<QGraphicsItem*>(item));
+    return iter == m_entries.constEnd() ? QRectF() : iter.value().bounds;
+}
+
+QVector<QGraphicsItem*> MapSpatialIndex::intersects(const QRectF &rect, const Filter &filter) const
+{
+    QVector<QGraphicsItem*> result;
+    visit(rect, [&](QGraphicsItem *item, const Entry &entry) {
+        if(overlaps(entry.bounds, rect) && (!filter || filter(item)))
+            result.append(item);
+    });
+    return result;
+}
+
+QVector<QGraphicsItem*> MapSpatialIndex::intersects(const MapCoordinate &topLeft, const MapCoordinate &bottomRight, const Filter &filter) const
+{
+    if(!topLeft.isValid() || !bottomRight.isValid())
+        return {};
+    double right = bottomRight.longitude;
+    if(right < topLeft.longitude)
+        right += 360;
+    const auto rects = longitudeSplit(topLeft.longitude, right, bottomRight.latitude, topLeft.latitude);
+    if(rects.size() == 1)
+        return intersects(rects.first(), filter);
+    // an item covering all longitudes is found in both rects
+    auto result = intersects(rects.first(), filter);
+    QSet<QGraphicsItem*> found;
+    for(auto item : qAsConst(result)) {
+        found.insert(item);
+    }
+    for(auto item : intersects(rects.last(), filter)) {
+        if(!found.contains(item))
+            result.append(item);
+    }
+    return result;
+}
+
+QVector<QGraphicsItem*> MapSpatialIndex::withinRadius(const MapCoordinate &center, double radius, const Filter &filter) const
+{
+    QVector<QPair<double, QGraphicsItem*>> candidates;
+    collect(center, radius, filter, candidates);
+    QVector<QGraphicsItem*> result;
+    result.reserve(candidates.size());
+    for(const auto &candidate : qAsConst(candidates)) {
+        result.append(candidate.second);
+    }
+    return result;
+}
+
+QVector<QGraphicsItem*> MapSpatialIndex::intersects(const QVector<MapCoordinate> &polygon, const Filter &filter) const
+{
+    QVector<QGraphicsItem*> result;
+    const auto rect = boundingRect(polygon);
+    if(polygon.size() < 3 || !isFinite(rect))
+        return result;
+    QPolygonF shape;
+    shape.reserve(polygon.size());
+    for(const auto &coord : polygon) {
+        if(coord.isValid())
+            shape.append(QPointF(coord.longitude, coord.latitude));
+    }
+    visit(rect, [&](QGraphicsItem *item, const Entry &entry) {
+        if(!overlaps(entry.bounds, rect))
+            return;
+        const auto &bounds = entry.bounds;
+        bool inside;
+        if(bounds.width() == 0 && bounds.height() == 0)
+            inside = shape.containsPoint(bounds.topLeft(), Qt::OddEvenFill);
+        else
+            inside = shape.intersects(QPolygonF(bounds.adjusted(-POLYGON_EPSILON, -POLYGON_EPSILON, POLYGON_EPSILON, POLYGON_EPSILON)));
+        if(inside && (!filter || filter(item)))
+            result.append(item);
+    });
+    return result;
+}
+
+QVector<QGraphicsItem*> MapSpatialIndex::nearest(const MapCoordinate &coord, int k, const Filter &filter) const
+{
+    QVector<QGraphicsItem*> result;
+    if(k <= 0 || !coord.isValid() || count() == 0)
+        return result;
+    // grow the radius until k items are found, half of the circumference covers the whole earth
+    const double maxRadius = M_PI * MapGeodesic::earthRadius();
+    QVector<QPair<double, QGraphicsItem*>> candidates;
+    for(double radius = NEAREST_RADIUS; ; radius *= 4) {
+        candidates.clear();
+        collect(coord, qMin(radius, maxRadius), filter, candidates);
+        if(candidates.size() >= k || radius >= maxRadius)
+            break;
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const QPair<double, QGraphicsItem*> &a, const QPair<double, QGraphicsItem*> &b) {
+        return a.first < b.first;
+    });
+    const int count = qMin(k, candidates.size());
+    result.reserve(count);
+    for(int i = 0; i < count; ++i) {
+        result.append(candidates.at(i).second);
+    }
+    return result;
+}
+
+QRectF MapSpatialIndex::boundingRect(const QVector<MapCoordinate> &coords)
+{
+    double left = qInf(), right = -qInf(), bottom = qInf(), top = -qInf();
+    for(const auto &coord : coords) {
+        if(!coord.isValid())
+            continue;
+        left = qMin(left, coord.longitude);
+        right = qMax(right, coord.longitude);
+        bottom = qMin(bottom, coord.latitude);
+        top = qMax(top, coord.latitude);
+    }
+    if(left > right)
+        return QRectF(qQNaN(), qQNaN(), qQNaN(), qQNaN());
+    // spans over the antimeridian, cover all longitudes
+    if(right - left > 180) {
+        left = -180;
+        right = 180;
+    }
+    return QRectF(QPointF(left, bottom), QPointF(right, top));
+}
+
+double MapSpatialIndex::distance(const MapCoordinate &coord, const QRectF &bounds)
+{
+    // the nearest point is approximated by clamping, it is exact for a point
+    MapCoordinate nearest(qBound(bounds.top(), coord.latitude, bounds.bottom()), coord.longitude);
+    if(coord.longitude < bounds.left() || coord.longitude > bounds.right()) {
+        auto toLeft = std::fmod(bounds.left() - coord.longitude + 360, 360.0);
+        auto toRight = std::fmod(coord.longitude - bounds.right() + 360, 360.0);
+        nearest.longitude = toLeft < toRight ? bounds.left() : bounds.right();
+    }
+    return MapGeodesic::distance(coord, nearest);
+}
+
+/// 能容纳外接矩形的最细一层
+int MapSpatialIndex::levelOf(const QRectF &bounds)
+{
+    for(int level = 0; level < LEVEL_COUNT - 1; ++level) {
+        if(bounds.width() <= LEVEL_SIZES[level] && bounds.height() <= LEVEL_SIZES[level])
+            return level;
+    }
+    return LEVEL_COUNT - 1;
+}
+
+MapSpatialIndex::CellRange MapSpatialIndex::cellRange(int level, const QRectF &bounds)
+{
+    const double size = LEVEL_SIZES[level];
+    const int columns = qCeil(360 / size);
+    const int rows = qCeil(180 / size);
+    CellRange range;
+    range.left = qBound(0, qFloor((bounds.left() + 180) / size), columns - 1);
+    range.right = qBound(0, qFloor((bounds.right() + 180) / size), columns - 1);
+    range.top = qBound(0, qFloor((bounds.top() + 90) / size), rows - 1);
+    range.bottom = qBound(0, qFloor((bounds.bottom() + 90) / size), rows - 1);
+    return range;
+}
+
+quint64 MapSpatialIndex::cellKey(int level, int x, int y)
+{
+    return quint64(level) << 48 | quint64(y) << 24 | quint64(x);
+}
+
+void MapSpatialIndex::insertCells(QGraphicsItem *item, const Entry &entry)
+{
+    for(int y = entry.cells.top; y <= entry.cells.bottom; ++y) {
+        for(int x = entry.cells.left; x <= entry.cells.right; ++x) {
+            auto &cell = m_cells[cellKey(entry.level, x, y)];
+            if(cell.isEmpty())
+                ++m_levelCells[entry.level];
+            cell.append(item);
+        }
+    }
+    ++m_levelItems[entry.level];
+}
+
+void MapSpatialIndex::removeCells(QGraphicsItem *item, const Entry &entry)
+{
+    for(int y = entry.cells.top; y <= entry.cells.bottom; ++y) {
+        for(int x = entry.cells.left; x <= entry.cells.right; ++x) {
+            auto iter = m_cells.find(cellKey(entry.level, x, y));
+            if(iter == m_cells.end())
+                continue;
+            auto &cell = iter.value();
+            // the order in a cell does not matter, swap with the last one
+            int index = cell.indexOf(item);
+            if(index < 0)
+                continue;
+            cell[index] = cell.last();
+            cell.removeLast();
+            if(cell.isEmpty()) {
+                m_cells.erase(iter);
+                --m_levelCells[entry.level];
+            }
+        }
+    }
+    --m_levelItems[entry.level];
+}
+
+/*!
+ * \brief 遍历与矩形所在网格相交的图元
+ * \details 图元占据多个网格时，只在图元网格范围和查询网格范围交集的第一个网格中访问，因此每个图元只访问一次
+ */
+template<class Func>
+void MapSpatialIndex::visit(const QRectF &rect, Func func) const
+{
+    for(int level = 0; level < LEVEL_COUNT; ++level) {
+        if(m_levelItems.at(level) == 0)
+            continue;
+        const auto range = cellRange(level, rect);
+        auto visitCell = [&](int x, int y, const QVector<QGraphicsItem*> &cell) {
+            for(auto item : cell) {
+                const auto &entry = m_entries.find(item).value();
+                if(entry.enabled && x == qMax(entry.cells.left, range.left) && y == qMax(entry.cells.top, range.top))
+                    func(item, entry);
+            }
+        };
+        const qint64 cellCount = qint64(range.right - range.left + 1) * (range.bottom - range.top + 1);
+        if(cellCount <= m_levelCells.at(level)) {
+            for(int y = range.top; y <= range.bottom; ++y) {
+                for(int x = range.left; x <= range.right; ++x) {
+                    auto iter = m_cells.constFind(cellKey(level, x, y));
+                    if(iter != m_cells.constEnd())
+                        visitCell(x, y, iter.value());
+                }
+            }
+        }
+        else {
+            // fewer occupied cells than the cells in the range
+            for(auto iter = m_cells.constBegin(); iter != m_cells.constEnd(); ++iter) {
+                const auto key = iter.key();
+                if(int(key >> 48) != level)
+                    continue;
+                const int x = int(key & 0xFFFFFF);
+                const int y = int(key >> 24 & 0xFFFFFF);
+                if(x >= range.left && x <= range.right && y >= range.top && y <= range.bottom)
+                    visitCell(x, y, iter.value());
+            }
+        }
+    }
+}
+
+/// 半径内的图元和距离
+void MapSpatialIndex::collect(const MapCoordinate &center, double radius, const Filter &filter,
+                              QVector<QPair<double, QGraphicsItem*>> &result) const
+{
+    if(!center.isValid() || radius < 0)
+        return;
+    // the exact bounding box of a spherical cap
+    const double angle = radius / MapGeodesic::earthRadius();
+    const double deltaLat = qRadiansToDegrees(angle);
+    const double bottom = qMax(-90.0, center.latitude - deltaLat);
+    const double top = qMin(90.0, center.latitude + deltaLat);
+    double deltaLon = 180;
+    if(bottom > -90 && top < 90) {
+        const double ratio = qSin(qMin(angle, M_PI_2)) / qCos(qDegreesToRadians(center.latitude));
+        if(ratio < 1)
+            deltaLon = qRadiansToDegrees(qAsin(ratio));
+    }
+    const auto rects = longitudeSplit(center.longitude - deltaLon, center.longitude + deltaLon, bottom, top);
+    // an item wider than the gap between two rects will be visited twice
+    QSet<QGraphicsItem*> visited;
+    for(const auto &rect : rects) {
+        visit(rect, [&](QGraphicsItem *item, const Entry &entry) {
+            if(!overlaps(entry.bounds, rect))
+                return;
+            if(rects.size() > 1) {
+                if(visited.contains(item))
+                    return;
+                visited.insert(item);
+            }
+            const double distance = MapSpatialIndex::distance(center, entry.bounds);
+            if(distance <= radius && (!filter || filter(item)))
+                result.append(qMakePair(distance, item));
+        });
+    }
+}
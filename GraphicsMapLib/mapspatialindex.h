@@ -0,0 +1,100 @@
+﻿#ifndef MAPSPATIALINDEX_H
+#define MAPSPATIALINDEX_H
+
+#include <QHash>
+#include <QRectF>
+#include <QVector>
+#include <functional>
+#include "mapcoordinate.h"
+
+class QGraphicsItem;
+
+/*!
+ * \brief 地图图元的地理空间索引
+ * \details 分层网格索引，以经纬度外接矩形(x为经度，y为纬度)登记图元：
+ * 1.网格分为0.25度、2度、16度和全球四层，图元放入能容纳其外接矩形的最细一层，最多占据2x2个网格；
+ * 2.点状图元在同一网格内移动时只更新外接矩形，不需要改动网格；
+ * 3.查询时逐层遍历与查询范围相交的网格，网格数量多于该层已占用网格时改为遍历已占用网格
+ * \note MapObjectItem、MapPolygonItem、MapRouteItem、MapEllipseItem、MapRectItem、MapLineItem和MapFreePathItem在坐标改变时自动更新索引，
+ * 面状和线状图元按外接矩形判断，跨越180度经线的图元外接矩形覆盖整个经度范围
+ * \warning 只能在主线程使用
+ */
+class MapSpatialIndex
+{
+public:
+    /// 查询过滤条件，返回false的图元将被忽略
+    using Filter = std::function<bool(const QGraphicsItem*)>;
+
+    /// 全局索引，所有场景的图元共用
+    static MapSpatialIndex *instance();
+
+    /// 更新点状图元的位置，无效坐标将从索引中删除
+    void update(QGraphicsItem *item, const MapCoordinate &coord);
+    /// 更新图元的外接矩形，包含无效值(NaN)时将从索引中删除
+    void update(QGraphicsItem *item, const QRectF &bounds);
+    /// 从索引中删除
+    void remove(QGraphicsItem *item);
+    /*!
+     * \brief 暂停或恢复图元的索引项
+     * \details 暂停的图元不会被查询到，但保留索引项和所在网格，恢复或再次update时不需要分配内存，供对象池回收实例使用
+     */
+    void setEnabled(QGraphicsItem *item, bool enabled);
+    /// 索引中未暂停的图元数量
+    int count() const;
+    /// 图元的外接矩形，不在索引中时返回空矩形
+    QRectF bounds(const QGraphicsItem *item) const;
+
+    /// 外接矩形与经纬度矩形(x为经度，y为纬度)相交的图元，矩形不能跨越180度经线
+    QVector<QGraphicsItem*> intersects(const QRectF &rect, const Filter &filter = Filter()) const;
+    /// 外接矩形与左上角和右下角围成的区域相交的图元，左上角经度大于右下角时表示跨越180度经线
+    QVector<QGraphicsItem*> intersects(const MapCoordinate &topLeft, const MapCoordinate &bottomRight, const Filter &filter = Filter()) const;
+    /// 到中心点的距离不超过半径的图元，单位米
+    QVector<QGraphicsItem*> withinRadius(const MapCoordinate &center, double radius, const Filter &filter = Filter()) const;
+    /// 与多边形相交的图元，多边形不能跨越180度经线
+    QVector<QGraphicsItem*> intersects(const QVector<MapCoordinate> &polygon, const Filter &filter = Filter()) const;
+    /// 距离最近的k个图元，由近到远排列
+    QVector<QGraphicsItem*> nearest(const MapCoordinate &coord, int k, const Filter &filter = Filter()) const;
+
+    /// 计算坐标的经纬度外接矩形，没有有效坐标时返回无效矩形
+    static QRectF boundingRect(const QVector<MapCoordinate> &coords);
+    /// 点到外接矩形的最近距离，单位米
+    static double distance(const MapCoordinate &coord, const QRectF &bounds);
+
+private:
+    MapSpatialIndex();
+    /// 网格范围，闭区间
+    struct CellRange
+    {
+        int left;
+        int top;
+        int right;
+        int bottom;
+    };
+    struct Entry
+    {
+        QRectF bounds;
+        int    level;
+        CellRange cells;
+        bool   enabled;     ///< 暂停的图元不参与查询
+    };
+
+private:
+    static int levelOf(const QRectF &bounds);
+    static CellRange cellRange(int level, const QRectF &bounds);
+    static quint64 cellKey(int level, int x, int y);
+    void insertCells(QGraphicsItem *item, const Entry &entry);
+    void removeCells(QGraphicsItem *item, const Entry &entry);
+    template<class Func>
+    void visit(const QRectF &rect, Func func) const;
+    void collect(const MapCoordinate &center, double radius, const Filter &filter,
+                 QVector<QPair<double, QGraphicsItem*>> &result) const;
+
+private:
+    QHash<QGraphicsItem*, Entry>            m_entries;      ///< 图元到外接矩形和网格的索引
+    QHash<quint64, QVector<QGraphicsItem*>> m_cells;        ///< 网格到图元的索引
+    QVector<int>                            m_levelCells;   ///< 每层已占用的网格数量
+    QVector<int>                            m_levelItems;   ///< 每层的图元数量
+    int                                     m_disabled;     ///< 暂停的图元数量
+};
+
+#endif // MAPSPATIALINDEX_H
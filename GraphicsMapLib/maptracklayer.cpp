@@ -0,0 +1,312 @@
+﻿#include "maptracklayer.h"
+#include "graphicsmap.h"
+#include "mapobjectitem.h"
+#include "mapiconcache.h"
+#include <QGraphicsSceneMouseEvent>
+#include <QGraphicsView>
+#include <QStyleOptionGraphicsItem>
+#include <QtMath>
+
+#define ATLAS_WIDTH 1024    ///< 图集宽度，像素，高度按需增长
+#define ATLAS_PADDING 1     ///< 图集中图标之间的间隔，避免采样到相邻图标
+
+MapTrackLayer::MapTrackLayer() :
+    m_count(0),
+    m_atlasDirty(true),
+    m_shelfHeight(0),
+    m_iconRadius(0)
+{
+    this->setFlag(ItemUsesExtendedStyleOption);
+    m_atlasImage = QImage(ATLAS_WIDTH, 64, QImage::Format_ARGB32_Premultiplied);
+    m_atlasImage.fill(Qt::transparent);
+    addIcon(MapObjectItem::defaultIcon());
+}
+
+MapTrackLayer::~MapTrackLayer()
+{
+
+}
+
+int MapTrackLayer::addIcon(const QPixmap &pixmap)
+{
+    auto image = (pixmap.isNull() ? MapObjectItem::defaultIcon() : pixmap).toImage();
+    image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    m_iconImages.append(image);
+    m_iconRadius = qMax(m_iconRadius, qSqrt(image.width() * image.width() + image.height() * image.height()) / 2);
+    return m_iconImages.size() - 1;
+}
+
+int MapTrackLayer::add(const MapCoordinate &coord, qreal heading, int icon, const QColor &color)
+{
+    int id;
+    if(m_freeIds.isEmpty()) {
+        id = m_states.size();
+        m_latitudes.append(0);
+        m_longitudes.append(0);
+        m_positions.append(QPointF());
+        m_headings.append(0);
+        m_icons.append(0);
+        m_colors.append(0);
+        m_states.append(0);
+    }
+    else {
+        id = m_freeIds.takeLast();
+    }
+    m_latitudes[id] = coord.latitude;
+    m_longitudes[id] = coord.longitude;
+    m_positions[id] = GraphicsMap::toScene(coord);
+    m_headings[id] = heading;
+    m_icons[id] = icon >= 0 && icon < m_iconImages.size() ? icon : 0;
+    m_colors[id] = color.isValid() ? color.rgba() : 0;
+    m_states[id] = Used | Visible;
+    ++m_count;
+    update();
+    return id;
+}
+
+void MapTrackLayer::remove(int id)
+{
+    if(!isValidId(id))
+        return;
+    m_states[id] = 0;
+    m_freeIds.append(id);
+    --m_count;
+    update();
+}
+
+void MapTrackLayer::clear()
+{
+    m_latitudes.clear();
+    m_longitudes.clear();
+    m_positions.clear();
+    m_headings.clear();
+    m_icons.clear();
+    m_colors.clear();
+    m_states.clear();
+    m_freeIds.clear();
+    m_count = 0;
+    update();
+}
+
+int MapTrackLayer::count() const
+{
+    return m_count;
+}
+
+void MapTrackLayer::setPosition(int id, const MapCoordinate &coord, qreal heading)
+{
+    if(!isValidId(id))
+        return;
+    m_latitudes[id] = coord.latitude;
+    m_longitudes[id] = coord.longitude;
+    m_positions[id] = GraphicsMap::toScene(coord);
+    m_headings[id] = heading;
+    update();
+}
+
+void MapTrackLayer::setPositions(const int *ids, const double *lat, const double *lon, const float *headings, int count)
+{
+    if(count <= 0)
+        return;
+    m_batch.resize(count);
+    GraphicsMap::toScene(lat, lon, m_batch.data(), count);
+    for(int i = 0; i < count; ++i) {
+        const int id = ids[i];
+        if(!isValidId(id))
+            continue;
+        m_latitudes[id] = lat[i];
+        m_longitudes[id] = lon[i];
+        m_positions[id] = m_batch.at(i);
+        if(headings)
+            m_headings[id] = headings[i];
+    }
+    update();
+}
+
+void MapTrackLayer::setIcon(int id, int icon)
+{
+    if(!isValidId(id) || icon < 0 || icon >= m_iconImages.size())
+        return;
+    m_icons[id] = icon;
+    update();
+}
+
+void MapTrackLayer::setColor(int id, const QColor &color)
+{
+    if(!isValidId(id))
+        return;
+    m_colors[id] = color.isValid() ? color.rgba() : 0;
+    update();
+}
+
+void MapTrackLayer::setTrackVisible(int id, bool visible)
+{
+    if(!isValidId(id))
+        return;
+    m_states[id] = visible ? (Used | Visible) : Used;
+    update();
+}
+
+MapCoordinate MapTrackLayer::coordinate(int id) const
+{
+    if(!isValidId(id))
+        return MapCoordinate();
+    return MapCoordinate(m_latitudes.at(id), m_longitudes.at(id));
+}
+
+qreal MapTrackLayer::heading(int id) const
+{
+    return isValidId(id) ? m_headings.at(id) : 0;
+}
+
+QVector<int> MapTrackLayer::tracksAt(const QGraphicsView *view, const QPoint &pos) const
+{
+    QVector<int> result;
+    if(!view)
+        return result;
+    const auto transform = view->viewportTransform();
+    const qreal scale = qSqrt(transform.m11() * transform.m11() + transform.m12() * transform.m12());
+    if(scale <= 0)
+        return result;
+    // coarse test in the scene with the largest icon, then the exact test with the rotated icon
+    const auto scenePos = transform.inverted().map(QPointF(pos));
+    const qreal margin = m_iconRadius / scale;
+    const QRectF candidate(scenePos.x() - margin, scenePos.y() - margin, margin * 2, margin * 2);
+    for(int id = m_states.size() - 1; id >= 0; --id) {
+        if(m_states.at(id) != (Used | Visible) || !candidate.contains(m_positions.at(id)))
+            continue;
+        QTransform rotation;
+        rotation.rotate(-m_headings.at(id));
+        const auto local = rotation.map(QPointF(pos) - transform.map(m_positions.at(id)));
+        const auto size = m_iconImages.at(m_icons.at(id)).size();
+        if(qAbs(local.x()) <= size.width() / 2.0 && qAbs(local.y()) <= size.height() / 2.0)
+            result.append(id);
+    }
+    return result;
+}
+
+QVector<int> MapTrackLayer::tracksIn(const QRectF &sceneRect) const
+{
+    QVector<int> result;
+    for(int id = 0; id < m_states.size(); ++id) {
+        if(m_states.at(id) == (Used | Visible) && sceneRect.contains(m_positions.at(id)))
+            result.append(id);
+    }
+    return result;
+}
+
+/// 覆盖两种瓦片方案的整个场景，目标的裁剪在paint中完成
+QRectF MapTrackLayer::boundingRect() const
+{
+    return QRectF(-MapScene::Length, -MapScene::Length, MapScene::Length * 2, MapScene::Length * 2);
+}
+
+void MapTrackLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget)
+    const auto world = painter->worldTransform();
+    const qreal scale = qSqrt(world.m11() * world.m11() + world.m12() * world.m12());
+    if(scale <= 0 || m_count == 0)
+        return;
+
+    // 1.cull with the icon size and collect the fragments in device coordinates
+    const qreal margin = m_iconRadius / scale;
+    const QRectF visible = option->exposedRect.adjusted(-margin, -margin, margin, margin);
+    m_fragments.clear();
+    for(int id = 0; id < m_states.size(); ++id) {
+        if(m_states.at(id) != (Used | Visible))
+            continue;
+        const auto &pos = m_positions.at(id);
+        if(!visible.contains(pos))
+            continue;
+        const auto source = atlasRect(m_icons.at(id), m_colors.at(id));
+        m_fragments.append(QPainter::PixmapFragment::create(world.map(pos), source, 1, 1, m_headings.at(id)));
+    }
+    if(m_fragments.isEmpty())
+        return;
+
+    // 2.upload the atlas only when new icons or colors are added
+    if(m_atlasDirty) {
+        m_atlas = QPixmap::fromImage(m_atlasImage);
+        m_atlasDirty = false;
+    }
+    painter->setWorldTransform(QTransform());
+    painter->drawPixmapFragments(m_fragments.constData(), m_fragments.size(), m_atlas);
+    painter->setWorldTransform(world);
+}
+
+void MapTrackLayer::mousePressEvent(QGraphicsSceneMouseEvent *event)
+{
+    // let the event go through to the map if no track is pressed
+    const int id = trackAt(event);
+    if(id < 0) {
+        event->ignore();
+        return;
+    }
+    emit pressed(id);
+}
+
+void MapTrackLayer::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
+{
+    const int id = trackAt(event);
+    if(id < 0) {
+        event->ignore();
+        return;
+    }
+    emit doubleClicked(id);
+}
+
+bool MapTrackLayer::isValidId(int id) const
+{
+    return id >= 0 && id < m_states.size() && (m_states.at(id) & Used);
+}
+
+int MapTrackLayer::trackAt(QGraphicsSceneMouseEvent *event) const
+{
+    auto view = event->widget() ? qobject_cast<QGraphicsView*>(event->widget()->parentWidget()) : nullptr;
+    if(!view)
+        return -1;
+    const auto ids = tracksAt(view, view->mapFromScene(event->scenePos()));
+    return ids.isEmpty() ? -1 : ids.first();
+}
+
+/// 图标在图集中的位置，着色版本在第一次使用时生成
+QRect MapTrackLayer::atlasRect(int icon, QRgb color)
+{
+    const quint64 key = quint64(icon) << 32 | color;
+    auto iter = m_atlasRects.constFind(key);
+    if(iter != m_atlasRects.constEnd())
+        return iter.value();
+    //
+    // the same color as MapObjectItem::setIconColor
+    auto image = color ? MapIconCache::tinted(m_iconImages.at(icon), QColor::fromRgba(color)) : m_iconImages.at(icon);
+    const auto rect = allocate(image.size());
+    QPainter painter(&m_atlasImage);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(rect.topLeft(), image);
+    m_atlasRects.insert(key, rect);
+    m_atlasDirty = true;
+    return rect;
+}
+
+/// 按行分配图集空间，高度不足时扩大图集，已分配的位置不变
+QRect MapTrackLayer::allocate(const QSize &size)
+{
+    if(m_shelf.x() + size.width() > ATLAS_WIDTH) {
+        m_shelf = QPoint(0, m_shelf.y() + m_shelfHeight + ATLAS_PADDING);
+        m_shelfHeight = 0;
+    }
+    const QRect rect(m_shelf, size);
+    if(rect.bottom() >= m_atlasImage.height()) {
+        QImage atlas(ATLAS_WIDTH, qMax(m_atlasImage.height() * 2, rect.bottom() + 1), QImage::Format_ARGB32_Premultiplied);
+        atlas.fill(Qt::transparent);
+        QPainter painter(&atlas);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(0, 0, m_atlasImage);
+        painter.end();
+        m_atlasImage = atlas;
+    }
+    m_shelf.rx() += size.width() + ATLAS_PADDING;
+    m_shelfHeight = qMax(m_shelfHeight, size.height());
+    return rect;
+}
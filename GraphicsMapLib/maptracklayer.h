@@ -0,0 +1,113 @@
+﻿#ifndef MAPTRACKLAYER_H
+#define MAPTRACKLAYER_H
+
+#include <QObject>
+#include <QGraphicsItem>
+#include <QHash>
+#include <QImage>
+#include <QPainter>
+#include <QPixmap>
+#include "mapcoordinate.h"
+
+class QGraphicsView;
+
+/*!
+ * \brief 海量目标图层
+ * \details 在一个图元中绘制大量目标，代替逐个创建MapObjectItem：
+ * 1.位置、朝向、图标和颜色按数组分别存储(结构数组)，批量设置位置时一次投影所有坐标；
+ * 2.所有图标及其着色版本打包到一张图集中，绘制时裁剪视图外的目标，再通过一次drawPixmapFragments绘制；
+ * 3.图标保持屏幕大小，与MapObjectItem一致
+ * \note 目标没有菜单、文字和选中状态，点击通过pressed信号和tracksAt获取目标编号
+ */
+class MapTrackLayer : public QObject, public QGraphicsItem
+{
+    Q_OBJECT
+public:
+    MapTrackLayer();
+    ~MapTrackLayer();
+    /// 添加图标到图集，返回图标编号，编号0为MapObjectItem的默认图标
+    int addIcon(const QPixmap &pixmap);
+    /*!
+     * \brief 添加目标
+     * \param heading 朝向，单位度，顺时针为正
+     * \param icon 图标编号
+     * \param color 图标颜色，无效颜色表示使用图标原色
+     * \return 目标编号，删除后会被复用
+     */
+    int add(const MapCoordinate &coord, qreal heading = 0, int icon = 0, const QColor &color = QColor());
+    /// 删除目标
+    void remove(int id);
+    /// 删除所有目标，图标保留
+    void clear();
+    /// 目标数量
+    int count() const;
+    /// 设置位置和朝向
+    void setPosition(int id, const MapCoordinate &coord, qreal heading);
+    /// 批量设置位置和朝向，headings可以为空
+    void setPositions(const int *ids, const double *lat, const double *lon, const float *headings, int count);
+    /// 设置图标
+    void setIcon(int id, int icon);
+    /// 设置图标颜色，无效颜色表示使用图标原色
+    void setColor(int id, const QColor &color);
+    /// 设置目标是否显示
+    void setTrackVisible(int id, bool visible);
+    /// 获取位置
+    MapCoordinate coordinate(int id) const;
+    /// 获取朝向
+    qreal heading(int id) const;
+    /// 获取视图坐标处的目标，后绘制的(上层)在前
+    QVector<int> tracksAt(const QGraphicsView *view, const QPoint &pos) const;
+    /// 获取场景矩形内的目标
+    QVector<int> tracksIn(const QRectF &sceneRect) const;
+
+signals:
+    void pressed(int id);
+    void doubleClicked(int id);
+
+public:
+    virtual QRectF boundingRect() const override;
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+
+protected:
+    virtual void mousePressEvent(QGraphicsSceneMouseEvent *event) override;
+    virtual void mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event) override;
+
+private:
+    /// 目标状态
+    enum State : quint8 {
+        Used    = 0x01,
+        Visible = 0x02
+    };
+
+private:
+    bool isValidId(int id) const;
+    int trackAt(QGraphicsSceneMouseEvent *event) const;
+    QRect atlasRect(int icon, QRgb color);
+    QRect allocate(const QSize &size);
+
+private:
+    // tracks, indexed by id
+    QVector<double>  m_latitudes;   ///< 纬度
+    QVector<double>  m_longitudes;  ///< 经度
+    QVector<QPointF> m_positions;   ///< 场景坐标
+    QVector<float>   m_headings;    ///< 朝向
+    QVector<int>     m_icons;       ///< 图标编号
+    QVector<QRgb>    m_colors;      ///< 图标颜色，0表示原色
+    QVector<quint8>  m_states;      ///< 状态
+    QVector<int>     m_freeIds;     ///< 已删除可复用的编号
+    int              m_count;       ///< 目标数量
+    QVector<QPointF> m_batch;       ///< 批量投影的缓冲
+    //
+    QVector<QImage>        m_iconImages;    ///< 图标原图
+    QHash<quint64, QRect>  m_atlasRects;    ///< (图标, 颜色)在图集中的位置
+    QImage                 m_atlasImage;    ///< 图集
+    QPixmap                m_atlas;         ///< 图集，绘制用
+    bool                   m_atlasDirty;    ///< 图集是否需要重新上传
+    QPoint                 m_shelf;         ///< 当前行的插入位置
+    int                    m_shelfHeight;   ///< 当前行的高度
+    qreal                  m_iconRadius;    ///< 最大图标外接圆半径，像素
+    //
+    QVector<QPainter::PixmapFragment> m_fragments;  ///< 每帧复用的绘制片段
+};
+
+#endif // MAPTRACKLAYER_H
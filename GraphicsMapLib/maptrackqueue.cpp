@@ -0,0 +1,169 @@
+﻿#include "maptrackqueue.h"
+
+MapTrackQueue::MapTrackQueue(int capacity, QObject *parent) : QObject(parent),
+    m_enqueuePos(0),
+    m_dequeuePos(0),
+    m_dropped(0),
+    m_merged(0)
+{
+    const quint32 size = qNextPowerOfTwo(quint32(qMax(capacity, 2) - 1));
+    m_mask = size - 1;
+    m_cells = new Cell[size];
+    for(quintptr i = 0; i < size; ++i) {
+        m_cells[i].sequence.store(i);
+    }
+    //
+    connect(&m_frameTimer, &QTimer::timeout, this, &MapTrackQueue::drain);
+    setFrameRate(25);
+}
+
+MapTrackQueue::~MapTrackQueue()
+{
+    delete[] m_cells;
+}
+
+bool MapTrackQueue::push(int id, const MapCoordinate &coord)
+{
+    return enqueue({id, coord, QVector3D(), false});
+}
+
+bool MapTrackQueue::push(int id, const MapCoordinate &coord, const QVector3D &euler)
+{
+    return enqueue({id, coord, euler, true});
+}
+
+void MapTrackQueue::bind(int id, MapObjectItem *item)
+{
+    m_items.insert(id, item);
+}
+
+void MapTrackQueue::unbind(int id)
+{
+    m_items.remove(id);
+}
+
+int MapTrackQueue::drain()
+{
+    // 1.take at most one queue of entries, so that fast producers can not keep the gui thread here
+    m_batch.clear();
+    m_slots.clear();
+    Entry entry;
+    for(quintptr i = 0; i <= m_mask && dequeue(entry); ++i) {
+        auto iter = m_slots.constFind(entry.id);
+        if(iter == m_slots.constEnd()) {
+            m_slots.insert(entry.id, m_batch.size());
+            m_batch.append(entry);
+            continue;
+        }
+        // last value wins, but keep the euler of an older entry
+        auto &latest = m_batch[iter.value()];
+        if(!entry.hasEuler && latest.hasEuler) {
+            entry.euler = latest.euler;
+            entry.hasEuler = true;
+        }
+        latest = entry;
+        ++m_merged;
+    }
+    if(m_batch.isEmpty())
+        return 0;
+
+    // 2.apply to the bound items in one batch
+    m_updates.clear();
+    QVector<Entry> unboundEntries;
+    for(const auto &latest : qAsConst(m_batch)) {
+        auto item = m_items.value(latest.id).data();
+        if(item)
+            m_updates.append({item, latest.coord, latest.euler, latest.hasEuler});
+        else
+            unboundEntries.append(latest);
+    }
+    MapObjectItem::applyBatch(m_updates);
+    if(!unboundEntries.isEmpty())
+        emit unbound(unboundEntries);
+    return m_updates.size();
+}
+
+void MapTrackQueue::setFrameRate(int fps)
+{
+    m_frameTimer.setFrameRate(fps);
+}
+
+int MapTrackQueue::capacity() const
+{
+    return int(m_mask + 1);
+}
+
+int MapTrackQueue::backlog() const
+{
+    const auto backlog = qintptr(m_enqueuePos.loadAcquire() - m_dequeuePos.loadAcquire());
+    return int(qBound<qintptr>(0, backlog, qintptr(m_mask + 1)));
+}
+
+quintptr MapTrackQueue::dropped() const
+{
+    return m_dropped.loadAcquire();
+}
+
+quintptr MapTrackQueue::merged() const
+{
+    return m_merged;
+}
+
+void MapTrackQueue::resetCounters()
+{
+    m_dropped.storeRelease(0);
+    m_merged = 0;
+}
+
+/// 无锁写入，参见Dmitry Vyukov的有界MPMC队列
+bool MapTrackQueue::enqueue(const Entry &entry)
+{
+    Cell *cell;
+    quintptr pos = m_enqueuePos.load();
+    for(;;) {
+        cell = &m_cells[pos & m_mask];
+        const quintptr sequence = cell->sequence.loadAcquire();
+        const qintptr diff = qintptr(sequence) - qintptr(pos);
+        if(diff == 0) {
+            // the cell is free, try to claim it
+            if(m_enqueuePos.testAndSetRelaxed(pos, pos + 1, pos))
+                break;
+        }
+        else if(diff < 0) {
+            // the queue is full
+            m_dropped.fetchAndAddRelaxed(1);
+            return false;
+        }
+        else {
+            pos = m_enqueuePos.load();
+        }
+    }
+    cell->entry = entry;
+    cell->sequence.storeRelease(pos + 1);
+    return true;
+}
+
+bool MapTrackQueue::dequeue(Entry &entry)
+{
+    Cell *cell;
+    quintptr pos = m_dequeuePos.load();
+    for(;;) {
+        cell = &m_cells[pos & m_mask];
+        const quintptr sequence = cell->sequence.loadAcquire();
+        const qintptr diff = qintptr(sequence) - qintptr(pos + 1);
+        if(diff == 0) {
+            if(m_dequeuePos.testAndSetRelaxed(pos, pos + 1, pos))
+                break;
+        }
+        else if(diff < 0) {
+            // the queue is empty
+            return false;
+        }
+        else {
+            pos = m_dequeuePos.load();
+        }
+    }
+    entry = cell->entry;
+    cell->sequence.storeRelease(pos + m_mask + 1);
+    return true;
+}
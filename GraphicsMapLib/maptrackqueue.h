@@ -0,0 +1,88 @@
+﻿#ifndef MAPTRACKQUEUE_H
+#define MAPTRACKQUEUE_H
+
+#include <QObject>
+#include <QAtomicInteger>
+#include <QHash>
+#include <QPointer>
+#include "mapframetimer.h"
+#include <QVector3D>
+#include "mapobjectitem.h"
+
+/*!
+ * \brief 目标数据接收队列
+ * \details 网络线程通过push写入目标数据，主线程每帧取出一次，再通过MapObjectItem::applyBatch批量更新：
+ * 1.队列为固定容量的无锁多生产者多消费者环形队列，push不加锁也不分配内存，队列已满时丢弃并计数；
+ * 2.每帧取出时按目标编号合并，同一目标只保留最新的数据(没有欧拉角的数据沿用之前的欧拉角)；
+ * 3.积压、丢弃和合并的数量可以随时读取，用于监视负载
+ * \note push可以在任意线程调用，其他函数只能在主线程调用
+ */
+class MapTrackQueue : public QObject
+{
+    Q_OBJECT
+public:
+    /// 目标数据
+    struct Entry
+    {
+        int           id;
+        MapCoordinate coord;
+        QVector3D     euler;
+        bool          hasEuler;
+    };
+
+    /// 容量向上取整为2的幂
+    explicit MapTrackQueue(int capacity = 65536, QObject *parent = nullptr);
+    ~MapTrackQueue();
+    /// 写入目标数据，线程安全，队列已满时返回false
+    bool push(int id, const MapCoordinate &coord);
+    bool push(int id, const MapCoordinate &coord, const QVector3D &euler);
+    /// 绑定目标编号和地图对象
+    void bind(int id, MapObjectItem *item);
+    void unbind(int id);
+    /// 立即取出队列中的数据并更新对象，返回更新的目标数量
+    int drain();
+    /// 设置每秒取出的次数，默认25，0表示关闭，由外部调用drain
+    void setFrameRate(int fps);
+    /// 容量
+    int capacity() const;
+    /// 积压的数量，线程安全，为近似值
+    int backlog() const;
+    /// 因队列已满丢弃的数量，线程安全
+    quintptr dropped() const;
+    /// 被同一目标的新数据覆盖的数量
+    quintptr merged() const;
+    /// 清零丢弃和合并的计数
+    void resetCounters();
+
+signals:
+    /// 没有绑定地图对象的目标数据，可以在槽函数中创建对象并绑定
+    void unbound(const QVector<MapTrackQueue::Entry> &entries);
+
+private:
+    bool enqueue(const Entry &entry);
+    bool dequeue(Entry &entry);
+
+private:
+    /// 环形队列的单元，sequence表示单元可写或可读的序号
+    struct Cell
+    {
+        QAtomicInteger<quintptr> sequence;
+        Entry                    entry;
+    };
+
+private:
+    Cell                    *m_cells;       ///< 环形队列
+    quintptr                 m_mask;        ///< 容量-1
+    QAtomicInteger<quintptr> m_enqueuePos;  ///< 写入位置
+    QAtomicInteger<quintptr> m_dequeuePos;  ///< 读取位置
+    QAtomicInteger<quintptr> m_dropped;     ///< 丢弃的数量
+    quintptr                 m_merged;      ///< 合并的数量
+    //
+    QHash<int, QPointer<MapObjectItem>> m_items;    ///< 目标编号到地图对象
+    QVector<Entry>           m_batch;       ///< 每帧复用的合并结果
+    QHash<int, int>          m_slots;       ///< 目标编号在m_batch中的下标
+    QVector<MapObjectUpdate> m_updates;     ///< 每帧复用的批量更新
+    MapFrameTimer            m_frameTimer;  ///< 帧定时器
+};
+
+#endif // MAPTRACKQUEUE_H
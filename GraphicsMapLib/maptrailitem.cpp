@@ -1,6 +1,7 @@
 ﻿#include "maptrailitem.h"
 #include "graphicsmap.h"
 #include "mapobjectitem.h"
+#include "mapgeodesic.h"
 
 QSet<MapTrailItem*> MapTrailItem::m_items;
 
@@ -34,7 +35,7 @@ void MapTrailItem::addCoordinate(const QGeoCoordinate &coord)
         return;
     }
     //
-    if(m_coord.distanceTo(coord) < 50)
+    if(MapGeodesic::distance(m_coord, coord) < 50)
         return;
     //
     m_coord = coord;
@@ -43,10 +44,37 @@ void MapTrailItem::addCoordinate(const QGeoCoordinate &coord)
     setPath(path);
 }
 
+void MapTrailItem::addCoordinates(const QVector<QGeoCoordinate> &coords)
+{
+    // the same filter as addCoordinate, and then project the accepted points in one batch
+    QVector<MapCoordinate> accepted;
+    accepted.reserve(coords.size());
+    auto last = m_coord;
+    for(const MapCoordinate coord : coords) {
+        if(last.isValid() && MapGeodesic::distance(last, coord) < 50)
+            continue;
+        accepted.append(coord);
+        last = coord;
+    }
+    if(accepted.isEmpty())
+        return;
+    //
+    auto points = GraphicsMap::toScene(accepted);
+    auto path = this->path();
+    int i = 0;
+    if(!m_coord.isValid())
+        path.moveTo(points.at(i++));
+    for(; i < points.size(); ++i) {
+        path.lineTo(points.at(i));
+    }
+    m_coord = last;
+    setPath(path);
+}
+
 void MapTrailItem::clear()
 {
     setPath(QPainterPath());
-    m_coord = QGeoCoordinate();
+    m_coord = MapCoordinate();
 }
 
 void MapTrailItem::attach(MapObjectItem *obj)
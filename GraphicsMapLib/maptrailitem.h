@@ -3,6 +3,7 @@
 
 #include <QGraphicsPathItem>
 #include <QGeoCoordinate>
+#include "mapcoordinate.h"
 
 class MapObjectItem;
 
@@ -18,6 +19,8 @@ public:
     ~MapTrailItem();
     /// 添加经纬点轨迹（该函数会自动优化该点是否添加到轨迹点）
     void addCoordinate(const QGeoCoordinate &coord);
+    /// 批量添加经纬点轨迹，只更新一次路径，适合回放或者补录历史轨迹
+    void addCoordinates(const QVector<QGeoCoordinate> &coords);
     /// 清除轨迹
     void clear();
     /// 依附到地图对象，清除已存在的航迹，将会自动更新位置
@@ -32,7 +35,7 @@ public:
 private:
     static QSet<MapTrailItem*> m_items;         ///< 所有实例
 private:
-    QGeoCoordinate m_coord;    ///< 轨迹点0
+    MapCoordinate  m_coord;    ///< 轨迹点0
     //
     MapObjectItem *m_attachObj;
 };